@@ -0,0 +1,67 @@
+#include "allocount.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* the real allocator, --wrap sends every other call here first */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+/* the workers allocate too so every update is atomic */
+static AllocCounts allocCounts;
+static int reportSet = 0;
+
+static void reportAllocCounts(void) {
+    const char *path = getenv(ALLOCOUNTENV);
+    FILE *out;
+    AllocCounts counts;
+
+    if (path == NULL || (out = fopen(path, "w")) == NULL)
+        return;
+    getAllocCounts(&counts);
+    fprintf(out,
+            "{\"allocs\": %lu, \"reallocs\": %lu, \"frees\": %lu, "
+            "\"allocBytes\": %lu}\n",
+            (unsigned long)counts.allocs, (unsigned long)counts.reallocs,
+            (unsigned long)counts.frees, (unsigned long)counts.bytes);
+    fclose(out);
+}
+
+/* the first allocation happens before anything could want a report */
+static void countAlloc(uint64_t *counter, size_t bytes) {
+    if (!reportSet) {
+        reportSet = 1;
+        atexit(reportAllocCounts);
+    }
+    __sync_fetch_and_add(counter, 1);
+    __sync_fetch_and_add(&allocCounts.bytes, bytes);
+}
+
+void *__wrap_malloc(size_t size) {
+    countAlloc(&allocCounts.allocs, size);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t num, size_t size) {
+    countAlloc(&allocCounts.allocs, num * size);
+    return __real_calloc(num, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    countAlloc(&allocCounts.reallocs, size);
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) {
+    if (ptr != NULL)
+        __sync_fetch_and_add(&allocCounts.frees, 1);
+    __real_free(ptr);
+}
+
+void getAllocCounts(AllocCounts *counts) {
+    counts->allocs = __sync_fetch_and_add(&allocCounts.allocs, 0);
+    counts->reallocs = __sync_fetch_and_add(&allocCounts.reallocs, 0);
+    counts->frees = __sync_fetch_and_add(&allocCounts.frees, 0);
+    counts->bytes = __sync_fetch_and_add(&allocCounts.bytes, 0);
+}
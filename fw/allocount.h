@@ -0,0 +1,28 @@
+#ifndef ALLOCOUNT_H
+#define ALLOCOUNT_H
+#include <stdint.h>
+
+/*
+ * counts of calls into the allocator by anything linked with
+ * -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free and
+ * allocount.o (see the Makefile). bytes is everything ever asked for,
+ * not what is in use
+ */
+struct AllocCounts {
+    uint64_t allocs; /* malloc and calloc */
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t bytes;
+};
+typedef struct AllocCounts AllocCounts;
+
+/* the counts so far */
+void getAllocCounts(AllocCounts *counts);
+
+/*
+ * if the environment variable named by ALLOCOUNTENV is set the counts
+ * are written to the file it names as JSON when the program exits
+ */
+#define ALLOCOUNTENV "FWBENCH_ALLOCS"
+
+#endif /* ALLOCOUNT_H */
@@ -0,0 +1,275 @@
+#include "approx.h"
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* smallest power of two that is at least n */
+static unsigned int roundUpPow2(size_t n) {
+    unsigned int pow2 = 1;
+    while (pow2 < n)
+        pow2 *= 2;
+    return pow2;
+}
+
+ApproxCounts *constructApproxCounts(int cap, int useSketch) {
+    ApproxCounts *counts = (ApproxCounts *)calloc(1, sizeof(ApproxCounts));
+    unsigned int numSlots;
+
+    if (counts == NULL)
+        error(1, errno, "Failed to allocate approximate counts");
+    counts->cap = cap;
+    counts->counters = (ApproxCounter *)calloc(cap, sizeof(ApproxCounter));
+    counts->minHeap = (int *)malloc(cap * sizeof(int));
+    /* at most half full keeps the probes short */
+    numSlots = roundUpPow2((size_t)cap * 2);
+    counts->index = (HashSlot *)calloc(numSlots, sizeof(HashSlot));
+    counts->indexMask = numSlots - 1;
+    if (counts->counters == NULL || counts->minHeap == NULL ||
+        counts->index == NULL)
+        error(1, errno, "Failed to allocate approximate counts");
+    if (useSketch) {
+        numSlots = roundUpPow2((size_t)cap * SKETCHWIDTH);
+        counts->sketch = (uint32_t *)calloc((size_t)numSlots * SKETCHDEPTH,
+                                            sizeof(uint32_t));
+        if (counts->sketch == NULL)
+            error(1, errno, "Failed to allocate count-min sketch");
+        counts->sketchMask = numSlots - 1;
+    }
+    return counts;
+}
+
+/* the counters are only ordered by count so ties go either way */
+static void swapMinHeap(ApproxCounts *counts, int i, int j) {
+    int tmp = counts->minHeap[i];
+    counts->minHeap[i] = counts->minHeap[j];
+    counts->minHeap[j] = tmp;
+    counts->counters[counts->minHeap[i]].minPos = i;
+    counts->counters[counts->minHeap[j]].minPos = j;
+}
+
+static uint64_t minHeapCount(ApproxCounts *counts, int i) {
+    return counts->counters[counts->minHeap[i]].count;
+}
+
+static void siftUpMinHeap(ApproxCounts *counts, int i) {
+    int parent;
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (minHeapCount(counts, parent) <= minHeapCount(counts, i))
+            break;
+        swapMinHeap(counts, i, parent);
+        i = parent;
+    }
+}
+
+static void siftDownMinHeap(ApproxCounts *counts, int i) {
+    int kid, lowest;
+    while (1) {
+        lowest = i;
+        kid = 2 * i + 1;
+        if (kid < counts->numCounters &&
+            minHeapCount(counts, kid) < minHeapCount(counts, lowest))
+            lowest = kid;
+        kid++;
+        if (kid < counts->numCounters &&
+            minHeapCount(counts, kid) < minHeapCount(counts, lowest))
+            lowest = kid;
+        if (lowest == i)
+            break;
+        swapMinHeap(counts, i, lowest);
+        i = lowest;
+    }
+}
+
+/*
+ * finds the index slot for word. returns the slot with its counter or
+ * the empty slot it would go in if no counter has it
+ */
+static unsigned int findApproxSlot(ApproxCounts *counts, uint32_t hash,
+                                   const char *word, size_t wordLen) {
+    HashSlot *index = counts->index;
+    unsigned int i = hash & counts->indexMask;
+    ApproxCounter *counter;
+
+    while (index[i].word != HASHEMPTY) {
+        if (index[i].hash == hash) {
+            counter = &counts->counters[index[i].word - 1];
+            if (counter->wordLen == wordLen &&
+                memcmp(counter->word, word, wordLen) == 0)
+                break;
+        }
+        i = (i + 1) & counts->indexMask;
+    }
+    return i;
+}
+
+/* empties slot i shifting back whatever would no longer be found */
+static void removeApproxSlot(ApproxCounts *counts, unsigned int i) {
+    HashSlot *index = counts->index;
+    unsigned int mask = counts->indexMask, j = i, home;
+
+    while (1) {
+        j = (j + 1) & mask;
+        if (index[j].word == HASHEMPTY)
+            break;
+        home = index[j].hash & mask;
+        /* it can fill the gap unless its home is between the gap and it */
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            index[i] = index[j];
+            i = j;
+        }
+    }
+    index[i].word = HASHEMPTY;
+}
+
+/* where row's cell for hash is in the sketch */
+#define sketchCell(counts, hash, row)                                         \
+    ((size_t)(row) * ((counts)->sketchMask + 1) +                             \
+     (((uint32_t)(hash) + (row) * ((uint32_t)((hash) >> 32) | 1)) &           \
+      (counts)->sketchMask))
+
+/*
+ * counts one more in the sketch and returns the new estimate.
+ * only the cells that are as low as the estimate go up (conservative
+ * update) since the others are already over it. cells stop at
+ * UINT32_MAX rather than wrap
+ */
+static uint32_t bumpSketch(ApproxCounts *counts, uint64_t hash) {
+    size_t cells[SKETCHDEPTH];
+    uint32_t estimate = UINT32_MAX;
+    int row;
+
+    for (row = 0; row < SKETCHDEPTH; row++) {
+        cells[row] = sketchCell(counts, hash, row);
+        if (counts->sketch[cells[row]] < estimate)
+            estimate = counts->sketch[cells[row]];
+    }
+    if (estimate < UINT32_MAX)
+        estimate++;
+    for (row = 0; row < SKETCHDEPTH; row++) {
+        if (counts->sketch[cells[row]] < estimate)
+            counts->sketch[cells[row]] = estimate;
+    }
+    return estimate;
+}
+
+/* makes sure the sketch estimates at least count for hash */
+static void depositSketch(ApproxCounts *counts, uint64_t hash,
+                          uint64_t count) {
+    size_t cell;
+    int row;
+
+    if (count > UINT32_MAX)
+        count = UINT32_MAX;
+    for (row = 0; row < SKETCHDEPTH; row++) {
+        cell = sketchCell(counts, hash, row);
+        if (counts->sketch[cell] < count)
+            counts->sketch[cell] = count;
+    }
+}
+
+static void setApproxWord(ApproxCounter *counter, uint64_t hash,
+                          const char *word, size_t wordLen) {
+    if (counter->wordCap < wordLen + 1) {
+        counter->wordCap = wordLen + 1;
+        counter->word = (char *)realloc(counter->word, counter->wordCap);
+        if (counter->word == NULL)
+            error(1, errno, "Failed to allocate approximate word");
+    }
+    memcpy(counter->word, word, wordLen);
+    counter->wordLen = wordLen;
+    counter->hash = hash;
+}
+
+void countApproxWord(ApproxCounts *counts, const char *word, size_t wordLen) {
+    uint64_t hash = hashWord(word, wordLen);
+    uint32_t slotHash = (uint32_t)(hash >> 32);
+    unsigned int slot = findApproxSlot(counts, slotHash, word, wordLen);
+    unsigned int oldSlot;
+    ApproxCounter *counter;
+    uint64_t count = 1;
+    int counterNum, isNew;
+
+    counts->total++;
+    if (counts->index[slot].word != HASHEMPTY) {
+        counter = &counts->counters[counts->index[slot].word - 1];
+        counter->count++;
+        siftDownMinHeap(counts, counter->minPos);
+        return;
+    }
+
+    if (counts->sketch != NULL)
+        count = bumpSketch(counts, hash);
+
+    isNew = (counts->numCounters < counts->cap);
+    if (isNew) {
+        counterNum = counts->numCounters++;
+        counts->minHeap[counterNum] = counterNum;
+        counts->counters[counterNum].minPos = counterNum;
+    } else {
+        /* take over the counter with the lowest count */
+        counterNum = counts->minHeap[0];
+        counter = &counts->counters[counterNum];
+        if (counts->sketch == NULL) {
+            count = counter->count + 1;
+        } else {
+            /* not seen enough yet to be worth a counter */
+            if (count <= counter->count)
+                return;
+            depositSketch(counts, counter->hash, counter->count);
+        }
+        oldSlot = findApproxSlot(counts, (uint32_t)(counter->hash >> 32),
+                                 counter->word, counter->wordLen);
+        removeApproxSlot(counts, oldSlot);
+        /* the removal may have moved things around */
+        slot = findApproxSlot(counts, slotHash, word, wordLen);
+    }
+
+    counter = &counts->counters[counterNum];
+    setApproxWord(counter, hash, word, wordLen);
+    counter->count = count;
+    /* the one just seen is the only one known to be this word's */
+    counter->error = count - 1;
+    counts->index[slot].hash = slotHash;
+    counts->index[slot].word = counterNum + 1;
+    /* a new counter starts at the bottom, a taken over one at the root */
+    if (isNew)
+        siftUpMinHeap(counts, counter->minPos);
+    else
+        siftDownMinHeap(counts, counter->minPos);
+}
+
+TopWords *topApproxWords(ApproxCounts *counts, int n) {
+    TopWords *top = constructTopWords(n);
+    ApproxCounter *counter;
+    int i;
+
+    for (i = 0; i < counts->numCounters; i++) {
+        counter = &counts->counters[i];
+        counter->heapPos = NOTINHEAP;
+        updateTopWords(top, counter->count, &counter->heapPos, counter->word,
+                       counter->wordLen);
+    }
+    for (i = 0; i < counts->numCounters; i++) {
+        counter = &counts->counters[i];
+        if (counter->heapPos != NOTINHEAP)
+            top->heap[counter->heapPos].error = counter->error;
+    }
+    sortTopWords(top);
+    top->total = counts->total;
+    return top;
+}
+
+void freeApproxCounts(ApproxCounts *counts) {
+    int i;
+    if (counts == NULL)
+        return;
+    for (i = 0; i < counts->numCounters; i++)
+        free(counts->counters[i].word);
+    free(counts->counters);
+    free(counts->minHeap);
+    free(counts->index);
+    free(counts->sketch);
+    free(counts);
+}
@@ -0,0 +1,79 @@
+#ifndef APPROX_H
+#define APPROX_H
+#include "hashtable.h"
+#include "topwords.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* rows in the count-min sketch */
+#define SKETCHDEPTH 4
+/* sketch columns per counter, rounded up to a power of two */
+#define SKETCHWIDTH 8
+
+/*
+ * one of the words being watched and its estimated count.
+ * the true count is somewhere in [count - error, count]
+ */
+struct ApproxCounter {
+    uint64_t count;
+    uint64_t error;
+    int minPos;  /* where it is in the min heap */
+    int heapPos; /* where it is in the top words once picking them */
+    uint64_t hash;
+    char *word; /* reused when the counter is taken over */
+    size_t wordLen;
+    size_t wordCap;
+};
+typedef struct ApproxCounter ApproxCounter;
+
+/*
+ * approximate counts with a fixed number of counters using Space-Saving.
+ * a word without a counter takes over the one with the lowest count
+ * (the root of minHeap), starting from that count + 1 and remembering
+ * that all but one of those may not have been its. any word seen more
+ * often than the lowest count is guaranteed to have a counter.
+ *
+ * with a sketch, words without a counter are counted in a count-min
+ * sketch first and only take over a counter once the sketch says they
+ * have been seen more often than its count. counts then start from the
+ * sketch's (much closer) estimate instead. words with a counter skip
+ * the sketch and hand their count to it when they lose the counter,
+ * which keeps its estimates from ever being under.
+ *
+ * the counters are found through a hash index (slots as in a HashTable
+ * but holding counter numbers) with half its slots empty.
+ * memory is set by numCounters and doesn't grow with the input
+ * (other than a counter's word buffer growing to fit a longer word)
+ */
+struct ApproxCounts {
+    ApproxCounter *counters;
+    int numCounters;
+    int cap;
+    int *minHeap; /* counter numbers, lowest count first */
+    HashSlot *index; /* word is counter number + 1 or HASHEMPTY */
+    unsigned int indexMask;
+    uint32_t *sketch; /* SKETCHDEPTH rows of sketchMask + 1 */
+    unsigned int sketchMask;
+    uint64_t total; /* number of words counted, which never stops */
+};
+typedef struct ApproxCounts ApproxCounts;
+
+/*
+ * approximate counts constructor for cap counters.
+ * the count-min sketch is only used if useSketch is set
+ */
+ApproxCounts *constructApproxCounts(int cap, int useSketch);
+
+/* counts one more of word */
+void countApproxWord(ApproxCounts *counts, const char *word, size_t wordLen);
+
+/*
+ * picks the n words with the highest counts, along with their errors,
+ * sorted the same way as sortTopWords does. total is set to the
+ * number of words counted since how many were different isn't known
+ */
+TopWords *topApproxWords(ApproxCounts *counts, int n);
+
+void freeApproxCounts(ApproxCounts *counts);
+
+#endif /* APPROX_H */
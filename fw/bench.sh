@@ -0,0 +1,49 @@
+#!/usr/bin/env bash
+#
+# benchmarks fw on generated corpora, one JSON object per line on stdout.
+# usage: ./bench.sh [sizes ...]   (sizes as gencorpus -s takes them)
+#
+# for every size the corpus is generated once into $BENCHDIR and kept,
+# then fwbench times the tokenize, count and top words stages on their
+# own and every mode of a whole fw run (fwcount is fw that reports its
+# allocations). the corpus can be tuned with DISTINCT, EXPONENT and
+# WORDLEN, see gencorpus.c
+
+set -e
+
+BENCHDIR=${BENCHDIR:-/tmp/fwbench}
+DISTINCT=${DISTINCT:-100000}
+EXPONENT=${EXPONENT:-1}
+WORDLEN=${WORDLEN:-6}
+THREADS=${THREADS:-$(nproc)}
+SIZES=${*:-1M 16M 128M}
+
+MODES=(
+    "trie:-b trie"
+    "hash:-b hash"
+    "auto:"
+    "threads:-j $THREADS"
+    "approx:-a 10000"
+    "sketch:-a 10000 -s"
+    "window:-e 1000000 -w 4"
+    "snapshot:-o $BENCHDIR/bench.snap"
+)
+
+mkdir -p "$BENCHDIR"
+for size in $SIZES; do
+    name="zipf-$size-d$DISTINCT-z$EXPONENT-l$WORDLEN"
+    corpus="$BENCHDIR/$name.txt"
+    if [ ! -f "$corpus" ]; then
+        ./gencorpus -s "$size" -d "$DISTINCT" -z "$EXPONENT" -l "$WORDLEN" \
+            > "$corpus.tmp"
+        mv "$corpus.tmp" "$corpus"
+    fi
+    for backend in trie hash; do
+        ./fwbench stages -b $backend -l "$name" "$corpus"
+    done
+    for mode in "${MODES[@]}"; do
+        # the mode's options are split on purpose
+        ./fwbench run -l "$name" -m "${mode%%:*}" "$corpus" \
+            ./fwcount ${mode#*:}
+    done
+done
@@ -0,0 +1,274 @@
+#include "counts.h"
+#include "scan.h"
+#include "stats.h"
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * the trie only wins while nearly every word is a short one it has
+ * seen before (see the trie's word cache). the sample goes to the hash
+ * table once at least 1 in this many of its words is new or the words
+ * are longer than the cache takes on average
+ */
+#define HASHNEWWORDRATIO 16
+
+WordCounts *constructWordCounts(CountBackend backend) {
+    WordCounts *counts = (WordCounts *)calloc(1, sizeof(WordCounts));
+    if (counts == NULL)
+        error(1, errno, "Failed to allocate word counts");
+    counts->backend = backend;
+    if (backend == HASHBACKEND)
+        counts->table = constructHashTable();
+    else
+        counts->trie = constructTrie();
+    return counts;
+}
+
+WordId addWordId(WordCounts *counts, const char *word, size_t wordLen) {
+    unsigned int index;
+
+    /* getHashWord and getTrieNode use index twice so it is looked up
+     * before rather than inside them */
+    if (counts->backend == HASHBACKEND) {
+        index = insertHashWord(counts->table, word, wordLen);
+        getHashWord(counts->table, index)->count++;
+    } else {
+        index = insertTrieWord(counts->trie, word, wordLen);
+        getTrieNode(counts->trie, index)->count++;
+    }
+    return index;
+}
+
+void addWordCounts(WordCounts *counts, const char *word, size_t wordLen,
+                   int count) {
+    unsigned int index;
+
+    if (counts->backend == HASHBACKEND) {
+        index = insertHashWord(counts->table, word, wordLen);
+        getHashWord(counts->table, index)->count += count;
+    } else {
+        index = insertTrieWord(counts->trie, word, wordLen);
+        getTrieNode(counts->trie, index)->count += count;
+    }
+}
+
+/*
+ * forEachWordCount's (or forEachWordId's) visit and ctx while walking
+ * one of the backends
+ */
+struct WordCountWalk {
+    void (*visit)(void *ctx, int count, const char *word, size_t wordLen);
+    void (*visitId)(void *ctx, WordId id, const char *word, size_t wordLen);
+    int (*visitUntil)(void *ctx, WordId id, int count, const char *word,
+                      size_t wordLen);
+    void *ctx;
+};
+typedef struct WordCountWalk WordCountWalk;
+
+static void visitTrieCount(void *ctx, TrieIndex index, TrieNode *node,
+                           const char *word, size_t wordLen) {
+    WordCountWalk *walk = (WordCountWalk *)ctx;
+    (void)index;
+    walk->visit(walk->ctx, node->count, word, wordLen);
+}
+
+static void visitHashCount(void *ctx, HashIndex index, HashWord *entry,
+                           const char *word, size_t wordLen) {
+    WordCountWalk *walk = (WordCountWalk *)ctx;
+    (void)index;
+    walk->visit(walk->ctx, entry->count, word, wordLen);
+}
+
+static void visitTrieId(void *ctx, TrieIndex index, TrieNode *node,
+                        const char *word, size_t wordLen) {
+    WordCountWalk *walk = (WordCountWalk *)ctx;
+    (void)node;
+    walk->visitId(walk->ctx, index, word, wordLen);
+}
+
+static void visitHashId(void *ctx, HashIndex index, HashWord *entry,
+                        const char *word, size_t wordLen) {
+    WordCountWalk *walk = (WordCountWalk *)ctx;
+    (void)entry;
+    walk->visitId(walk->ctx, index, word, wordLen);
+}
+
+static int visitTrieUntil(void *ctx, TrieIndex index, TrieNode *node,
+                          const char *word, size_t wordLen) {
+    WordCountWalk *walk = (WordCountWalk *)ctx;
+    return walk->visitUntil(walk->ctx, index, node->count, word, wordLen);
+}
+
+void forEachWordCount(WordCounts *counts,
+                      void (*visit)(void *ctx, int count, const char *word,
+                                    size_t wordLen),
+                      void *ctx) {
+    WordCountWalk walk;
+    walk.visit = visit;
+    walk.ctx = ctx;
+    if (counts->backend == HASHBACKEND)
+        forEachHashWord(counts->table, visitHashCount, &walk);
+    else
+        forEachTrieWord(counts->trie, visitTrieCount, &walk);
+}
+
+void forEachWordId(WordCounts *counts,
+                   void (*visit)(void *ctx, WordId id, const char *word,
+                                 size_t wordLen),
+                   void *ctx) {
+    WordCountWalk walk;
+    walk.visitId = visit;
+    walk.ctx = ctx;
+    if (counts->backend == HASHBACKEND)
+        forEachHashWord(counts->table, visitHashId, &walk);
+    else
+        forEachTrieWord(counts->trie, visitTrieId, &walk);
+}
+
+WordId getWordIdLimit(WordCounts *counts) {
+    if (counts->backend == HASHBACKEND)
+        return counts->table->numWords;
+    return counts->trie->numNodes;
+}
+
+void getWordIdCounts(WordCounts *counts, WordId first, size_t num, int *out) {
+    WordId id;
+    size_t i;
+
+    if (counts->backend == HASHBACKEND) {
+        for (i = 0; i < num; i++) {
+            id = first + i;
+            out[i] = getHashWord(counts->table, id)->count;
+        }
+    } else {
+        for (i = 0; i < num; i++) {
+            id = first + i;
+            out[i] = getTrieNode(counts->trie, id)->count;
+        }
+    }
+}
+
+const char *getWordIdWord(WordCounts *counts, WordId id, size_t *wordLen,
+                          char **buf, size_t *cap) {
+    HashWord *entry;
+
+    if (counts->backend == HASHBACKEND) {
+        entry = getHashWord(counts->table, id);
+        *wordLen = entry->wordLen;
+        return entry->word;
+    }
+    *wordLen = getTrieWord(counts->trie, id, buf, cap);
+    return *buf;
+}
+
+int forEachWordIdDescending(WordCounts *counts,
+                            int (*visit)(void *ctx, WordId id, int count,
+                                         const char *word, size_t wordLen),
+                            void *ctx) {
+    WordCountWalk walk;
+    if (counts->backend == HASHBACKEND)
+        return 0;
+    walk.visitUntil = visit;
+    walk.ctx = ctx;
+    forEachTrieWordDescending(counts->trie, visitTrieUntil, &walk);
+    return 1;
+}
+
+void mergeWordCounts(WordCounts *into, WordCounts *from) {
+    if (into->backend == HASHBACKEND)
+        mergeHashTable(into->table, from->table);
+    else
+        mergeTrie(into->trie, from->trie);
+}
+
+void addWordCountsStats(WordCounts *counts) {
+    if (counts->backend == HASHBACKEND) {
+        STATSMEMORY(HASHMEMORY, getHashTableBytes(counts->table));
+    } else {
+        STATSMEMORY(TRIEMEMORY, getTrieBytes(counts->trie));
+        STATSADD(TRIENODES, counts->trie->numNodes);
+    }
+}
+
+void freeWordCounts(WordCounts *counts) {
+    if (counts == NULL)
+        return;
+    freeTrie(counts->trie);
+    freeHashTable(counts->table);
+    free(counts);
+}
+
+/* what the sample scan keeps track of */
+struct SampleStats {
+    HashTable *table;
+    size_t numWords;
+    size_t numNew;
+    size_t numBytes;
+};
+typedef struct SampleStats SampleStats;
+
+static void countSampleWord(void *ctx, const char *word, size_t wordLen) {
+    SampleStats *stats = (SampleStats *)ctx;
+    HashIndex index = insertHashWord(stats->table, word, wordLen);
+    HashWord *entry = getHashWord(stats->table, index);
+    if (entry->count++ == 0)
+        stats->numNew++;
+    stats->numWords++;
+    stats->numBytes += wordLen;
+}
+
+CountBackend chooseCountBackend(const unsigned char *sample, size_t len) {
+    SampleStats stats;
+    Scanner *scanner = constructScanner(countSampleWord, &stats);
+
+    stats.table = constructHashTable();
+    stats.numWords = 0;
+    stats.numNew = 0;
+    stats.numBytes = 0;
+    scanBytes(scanner, sample, len);
+    /* the sample gets read again for real, only that goes in the stats */
+    STATSCLEAR(scanner->stats);
+    freeScanner(scanner);
+    freeHashTable(stats.table);
+
+    if (stats.numWords == 0)
+        return TRIEBACKEND;
+    if (stats.numNew * HASHNEWWORDRATIO >= stats.numWords ||
+        stats.numBytes > stats.numWords * CACHEDWORDLEN)
+        return HASHBACKEND;
+    return TRIEBACKEND;
+}
+
+size_t readInputSample(char **inputs, int numImputs, unsigned char *sample) {
+    struct stat st;
+    size_t len = 0;
+    ssize_t got;
+    int inputIndex, fd;
+
+    for (inputIndex = 0; inputIndex < numImputs; inputIndex++) {
+        if (stat(inputs[inputIndex], &st) == -1 || !S_ISREG(st.st_mode) ||
+            (fd = open(inputs[inputIndex], O_RDONLY)) == -1)
+            continue;
+        while (len < SAMPLEBYTES &&
+               (got = read(fd, sample + len, SAMPLEBYTES - len)) > 0)
+            len += got;
+        close(fd);
+        break;
+    }
+    return len;
+}
+
+int parseCountBackend(const char *name) {
+    if (strcmp(name, "auto") == 0)
+        return AUTOBACKEND;
+    if (strcmp(name, "trie") == 0)
+        return TRIEBACKEND;
+    if (strcmp(name, "hash") == 0)
+        return HASHBACKEND;
+    return -1;
+}
@@ -0,0 +1,122 @@
+#ifndef COUNTS_H
+#define COUNTS_H
+#include "hashtable.h"
+#include "trie.h"
+#include <stddef.h>
+
+/* how many bytes from the start of the input are looked at to pick */
+#define SAMPLEBYTES (1 << 20)
+
+/*
+ * the ways words can be counted.
+ * the trie shares prefixes and walks words byte by byte which is
+ * cheap for ordinary text where the same short words keep coming up.
+ * the hash table hashes every word once and probes a flat array which
+ * wins when most words are new and long (urls, hashes, ids in logs)
+ */
+enum CountBackend { AUTOBACKEND, TRIEBACKEND, HASHBACKEND };
+typedef enum CountBackend CountBackend;
+
+/*
+ * the words counted so far in whichever backend was picked.
+ * everything outside of here only sees a word's count and id
+ * so the top words work the same with either
+ */
+struct WordCounts {
+    CountBackend backend;
+    Trie *trie;
+    HashTable *table;
+};
+typedef struct WordCounts WordCounts;
+
+/*
+ * a number for a word that stays the same for as long as the counts
+ * are around: its trie node or hash table index. never 0
+ */
+typedef unsigned int WordId;
+
+/* word counts constructor. backend must not be AUTOBACKEND */
+WordCounts *constructWordCounts(CountBackend backend);
+
+/* adds count to the word's count */
+void addWordCounts(WordCounts *counts, const char *word, size_t wordLen,
+                   int count);
+
+/* adds one to the word's count and returns the word's id */
+WordId addWordId(WordCounts *counts, const char *word, size_t wordLen);
+
+/*
+ * calls visit for every word counted along with its count.
+ * the order depends on the backend.
+ * the word is not null terminated and only valid during the call
+ */
+void forEachWordCount(WordCounts *counts,
+                      void (*visit)(void *ctx, int count, const char *word,
+                                    size_t wordLen),
+                      void *ctx);
+
+/* same as forEachWordCount but with each word's id instead of its count */
+void forEachWordId(WordCounts *counts,
+                   void (*visit)(void *ctx, WordId id, const char *word,
+                                 size_t wordLen),
+                   void *ctx);
+
+/* one past the highest id a word counted so far can have */
+WordId getWordIdLimit(WordCounts *counts);
+
+/*
+ * the counts of the num ids from first on, written to out. an id that
+ * isn't a word (a trie node in the middle of words) has a count of 0.
+ * reading a range at a time keeps the loop over it tight
+ */
+void getWordIdCounts(WordCounts *counts, WordId first, size_t num, int *out);
+
+/*
+ * the word with id and its length. trie words are spelled out into
+ * *buf, which is grown to fit (*cap is its size), while hash words are
+ * returned where they are. the word is not null terminated
+ */
+const char *getWordIdWord(WordCounts *counts, WordId id, size_t *wordLen,
+                          char **buf, size_t *cap);
+
+/*
+ * calls visit for words from the highest ranked of those with the same
+ * count down (see forEachTrieWordDescending) until it returns non zero.
+ * only the trie keeps its words in order, so for the hash table this
+ * returns 0 without calling visit at all. 1 otherwise
+ */
+int forEachWordIdDescending(WordCounts *counts,
+                            int (*visit)(void *ctx, WordId id, int count,
+                                         const char *word, size_t wordLen),
+                            void *ctx);
+
+/* adds everything in from to into. both must use the same backend */
+void mergeWordCounts(WordCounts *into, WordCounts *from);
+
+/*
+ * adds what the counts hold to the --stats totals (see stats.h): the
+ * memory of whichever backend it is and the number of trie nodes.
+ * nothing happens in builds without them
+ */
+void addWordCountsStats(WordCounts *counts);
+
+void freeWordCounts(WordCounts *counts);
+
+/*
+ * picks the backend that should be faster for input like sample
+ * by counting the words in it and seeing how many are new
+ */
+CountBackend chooseCountBackend(const unsigned char *sample, size_t len);
+
+/*
+ * reads up to SAMPLEBYTES from the start of the first input that is a
+ * regular file into sample and returns how many were read. pipes and
+ * the like are skipped (without being opened) since whatever was read
+ * from them would be gone by the time they are counted
+ */
+size_t readInputSample(char **inputs, int numImputs, unsigned char *sample);
+
+/* parses a backend name (trie, hash or auto). returns -1 if it is none */
+int parseCountBackend(const char *name);
+
+#endif /* COUNTS_H */
@@ -0,0 +1,562 @@
+#include "filter.h"
+#include "hashtable.h"
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEADSTATE 0
+/* ends a patch list */
+#define PATCHEND -1
+
+#define hasByte(state, c) ((state)->bytes[(c) >> 5] >> ((c)&31) & 1)
+#define setByte(state, c)                                                     \
+    ((state)->bytes[(c) >> 5] |= (uint32_t)1 << ((c)&31))
+#define foldByte(c) ((c) >= 'A' && (c) <= 'Z' ? (c) | 0x20 : (c))
+
+/*
+ * a piece of NFA on its way to being a whole pattern: where it starts
+ * and the list of outs that lead out of it, still to be filled in
+ */
+struct NfaPiece {
+    int start;
+    int out;
+};
+typedef struct NfaPiece NfaPiece;
+
+/* what parsing a pattern needs */
+struct PatternParser {
+    WordFilter *filter;
+    const char *pattern; /* the whole thing, for error messages */
+    const char *pos;
+    const char *end;
+};
+typedef struct PatternParser PatternParser;
+
+WordFilter *constructWordFilter(void) {
+    WordFilter *filter = (WordFilter *)calloc(1, sizeof(WordFilter));
+    if (filter == NULL)
+        error(1, errno, "Failed to allocate word filter");
+    return filter;
+}
+
+static int addNfaState(WordFilter *filter, enum FilterStateType type) {
+    FilterState *state;
+    if (filter->numNfa == filter->nfaCap) {
+        filter->nfaCap = (filter->nfaCap == 0 ? 64 : filter->nfaCap * 2);
+        filter->nfa = (FilterState *)realloc(
+            filter->nfa, filter->nfaCap * sizeof(FilterState));
+        if (filter->nfa == NULL)
+            error(1, errno, "Failed to grow word filter");
+    }
+    state = &filter->nfa[filter->numNfa];
+    memset(state, 0, sizeof(FilterState));
+    state->type = type;
+    state->out = PATCHEND;
+    state->out1 = PATCHEND;
+    return filter->numNfa++;
+}
+
+/* patch list entries are a state's index times 2, plus 1 for out1 */
+static int *patchField(WordFilter *filter, int entry) {
+    FilterState *state = &filter->nfa[entry >> 1];
+    return ((entry & 1) ? &state->out1 : &state->out);
+}
+
+/* points every out on the list at target */
+static void patchOuts(WordFilter *filter, int list, int target) {
+    int *field;
+    while (list != PATCHEND) {
+        field = patchField(filter, list);
+        list = *field;
+        *field = target;
+    }
+}
+
+static int joinOuts(WordFilter *filter, int a, int b) {
+    int list = a, *field;
+    if (a == PATCHEND)
+        return b;
+    while (*(field = patchField(filter, list)) != PATCHEND)
+        list = *field;
+    *field = b;
+    return a;
+}
+
+static void addRoot(WordFilter *filter, int start, int tag) {
+    int match = addNfaState(filter, MATCHSTATE);
+    filter->nfa[match].tag = tag;
+    if (filter->numRoots == filter->rootsCap) {
+        filter->rootsCap =
+            (filter->rootsCap == 0 ? 16 : filter->rootsCap * 2);
+        filter->roots =
+            (int *)realloc(filter->roots, filter->rootsCap * sizeof(int));
+        if (filter->roots == NULL)
+            error(1, errno, "Failed to grow word filter");
+    }
+    filter->roots[filter->numRoots++] = (start == PATCHEND ? match : start);
+}
+
+static void badPattern(const PatternParser *parser, const char *why) {
+    error(1, 0, "Bad pattern `%s': %s.", parser->pattern, why);
+}
+
+static NfaPiece parseAlternation(PatternParser *parser);
+
+/* a piece taking the bytes in a state that has been set up already */
+static NfaPiece bytePiece(int state) {
+    NfaPiece piece;
+    piece.start = state;
+    piece.out = state * 2;
+    return piece;
+}
+
+/* the byte after a \ or just the next one */
+static unsigned char parseByte(PatternParser *parser) {
+    if (*parser->pos == '\\') {
+        if (++parser->pos == parser->end)
+            badPattern(parser, "\\ at the end");
+    }
+    return (unsigned char)*parser->pos++;
+}
+
+/* parses a [] class, the [ already taken */
+static NfaPiece parseClass(PatternParser *parser) {
+    int index = addNfaState(parser->filter, BYTESTATE), negate = 0, i;
+    FilterState *state;
+    unsigned char lo, hi;
+    int c;
+
+    if (parser->pos < parser->end && *parser->pos == '^') {
+        negate = 1;
+        parser->pos++;
+    }
+    /* a ] first is just a ] */
+    state = &parser->filter->nfa[index];
+    if (parser->pos < parser->end && *parser->pos == ']') {
+        setByte(state, ']');
+        parser->pos++;
+    }
+    while (1) {
+        if (parser->pos == parser->end)
+            badPattern(parser, "[ without a ]");
+        if (*parser->pos == ']')
+            break;
+        lo = hi = parseByte(parser);
+        if (parser->pos + 1 < parser->end && parser->pos[0] == '-' &&
+            parser->pos[1] != ']') {
+            parser->pos++;
+            hi = parseByte(parser);
+            if (hi < lo)
+                badPattern(parser, "range out of order");
+        }
+        for (c = lo; c <= hi; c++)
+            setByte(state, foldByte(c));
+    }
+    parser->pos++;
+    for (i = 0; negate && i < 8; i++)
+        state->bytes[i] = ~state->bytes[i];
+    return bytePiece(index);
+}
+
+static NfaPiece parseAtom(PatternParser *parser) {
+    WordFilter *filter = parser->filter;
+    NfaPiece piece;
+    int index, c;
+
+    switch (*parser->pos) {
+    case '(':
+        parser->pos++;
+        piece = parseAlternation(parser);
+        if (parser->pos == parser->end || *parser->pos != ')')
+            badPattern(parser, "( without a )");
+        parser->pos++;
+        return piece;
+    case '[':
+        parser->pos++;
+        return parseClass(parser);
+    case '.':
+        parser->pos++;
+        index = addNfaState(filter, BYTESTATE);
+        memset(filter->nfa[index].bytes, 0xff,
+               sizeof(filter->nfa[index].bytes));
+        return bytePiece(index);
+    case '*':
+    case '+':
+    case '?':
+        badPattern(parser, "nothing to repeat");
+    }
+    c = parseByte(parser);
+    index = addNfaState(filter, BYTESTATE);
+    setByte(&filter->nfa[index], foldByte(c));
+    return bytePiece(index);
+}
+
+static NfaPiece parseRepeat(PatternParser *parser) {
+    NfaPiece piece = parseAtom(parser);
+    int split;
+    char op;
+
+    while (parser->pos < parser->end && (*parser->pos == '*' ||
+                                         *parser->pos == '+' ||
+                                         *parser->pos == '?')) {
+        op = *parser->pos++;
+        split = addNfaState(parser->filter, SPLITSTATE);
+        parser->filter->nfa[split].out = piece.start;
+        if (op == '?') {
+            piece.out = joinOuts(parser->filter, piece.out, split * 2 + 1);
+        } else {
+            /* loop back round for another go */
+            patchOuts(parser->filter, piece.out, split);
+            piece.out = split * 2 + 1;
+        }
+        if (op != '+')
+            piece.start = split;
+    }
+    return piece;
+}
+
+static NfaPiece parseConcatenation(PatternParser *parser) {
+    NfaPiece piece, next;
+    int empty;
+
+    if (parser->pos == parser->end || *parser->pos == '|' ||
+        *parser->pos == ')') {
+        empty = addNfaState(parser->filter, EMPTYSTATE);
+        return bytePiece(empty);
+    }
+    piece = parseRepeat(parser);
+    while (parser->pos < parser->end && *parser->pos != '|' &&
+           *parser->pos != ')') {
+        next = parseRepeat(parser);
+        patchOuts(parser->filter, piece.out, next.start);
+        piece.out = next.out;
+    }
+    return piece;
+}
+
+static NfaPiece parseAlternation(PatternParser *parser) {
+    NfaPiece piece = parseConcatenation(parser), other;
+    int split;
+
+    while (parser->pos < parser->end && *parser->pos == '|') {
+        parser->pos++;
+        other = parseConcatenation(parser);
+        split = addNfaState(parser->filter, SPLITSTATE);
+        parser->filter->nfa[split].out = piece.start;
+        parser->filter->nfa[split].out1 = other.start;
+        piece.start = split;
+        piece.out = joinOuts(parser->filter, piece.out, other.out);
+    }
+    return piece;
+}
+
+void addFilterPattern(WordFilter *filter, const char *pattern, int exclude) {
+    PatternParser parser;
+    NfaPiece piece;
+    int tag = (exclude ? EXCLUDETAG : INCLUDETAG);
+
+    parser.filter = filter;
+    parser.pattern = pattern;
+    parser.pos = pattern;
+    parser.end = pattern + strlen(pattern);
+    /* the whole word has to match anyway */
+    if (parser.pos < parser.end && *parser.pos == '^')
+        parser.pos++;
+    if (parser.end > parser.pos && parser.end[-1] == '$' &&
+        (parser.end - 1 == parser.pos || parser.end[-2] != '\\'))
+        parser.end--;
+
+    piece = parseAlternation(&parser);
+    if (parser.pos != parser.end)
+        badPattern(&parser, ") without a (");
+    addRoot(filter, piece.start, tag);
+    patchOuts(filter, piece.out, filter->numNfa - 1);
+    if (!exclude)
+        filter->hasIncludes = 1;
+}
+
+void addFilterWord(WordFilter *filter, const char *word, size_t wordLen) {
+    if (filter->stopwords == NULL)
+        filter->stopwords = constructHashTable();
+    insertHashWord(filter->stopwords, word, wordLen);
+}
+
+/*
+ * splits the bytes into classes so that no BYTESTATE takes some of a
+ * class and not the rest. the DFA only needs a column per class
+ */
+static void findByteClasses(WordFilter *filter) {
+    int remap[2][256], i, c, numClasses;
+    const FilterState *state;
+
+    memset(filter->classes, 0, sizeof(filter->classes));
+    filter->numClasses = 1;
+    for (i = 0; i < filter->numNfa; i++) {
+        state = &filter->nfa[i];
+        if (state->type != BYTESTATE)
+            continue;
+        for (c = 0; c < filter->numClasses; c++)
+            remap[0][c] = remap[1][c] = -1;
+        numClasses = 0;
+        for (c = 0; c < 256; c++) {
+            int *to = &remap[hasByte(state, c)][filter->classes[c]];
+            if (*to == -1)
+                *to = numClasses++;
+            filter->classes[c] = *to;
+        }
+        filter->numClasses = numClasses;
+    }
+}
+
+/* the DFA while it is being built */
+struct DfaBuilder {
+    WordFilter *filter;
+    int *sets; /* every DFA state's NFA states one after another */
+    size_t setsLen;
+    size_t setsCap;
+    size_t *setStarts; /* state i is sets[setStarts[i]..setStarts[i + 1]) */
+    uint32_t *hashes;
+    unsigned int statesCap;
+    unsigned int *slots; /* state + 1, or 0 if empty */
+    unsigned int mask;
+    int *stack;
+    int *marks; /* the generation each NFA state was last reached in */
+    int generation;
+};
+typedef struct DfaBuilder DfaBuilder;
+
+static int compInts(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static void pushSetState(DfaBuilder *builder, int state) {
+    if (builder->setsLen == builder->setsCap) {
+        builder->setsCap = builder->setsCap * 2 + 64;
+        builder->sets =
+            (int *)realloc(builder->sets, builder->setsCap * sizeof(int));
+        if (builder->sets == NULL)
+            error(1, errno, "Failed to grow word filter");
+    }
+    builder->sets[builder->setsLen++] = state;
+}
+
+/*
+ * adds every state reachable from the seeds without taking a byte to
+ * the end of sets, keeping only the ones that take bytes or match.
+ * the seeds are on the stack, numSeeds of them
+ */
+static void closeSet(DfaBuilder *builder, int numSeeds) {
+    const FilterState *nfa = builder->filter->nfa;
+    int depth = numSeeds, state;
+
+    builder->generation++;
+    while (depth > 0) {
+        state = builder->stack[--depth];
+        if (state < 0 || builder->marks[state] == builder->generation)
+            continue;
+        builder->marks[state] = builder->generation;
+        switch (nfa[state].type) {
+        case SPLITSTATE:
+            builder->stack[depth++] = nfa[state].out1;
+            /* fall through */
+        case EMPTYSTATE:
+            builder->stack[depth++] = nfa[state].out;
+            break;
+        default:
+            pushSetState(builder, state);
+        }
+    }
+}
+
+static void growDfaSlots(DfaBuilder *builder) {
+    unsigned int numSlots = (builder->mask + 1) * 2, i, j;
+    unsigned int *slots = (unsigned int *)calloc(numSlots, sizeof(int));
+
+    if (slots == NULL)
+        error(1, errno, "Failed to grow word filter");
+    for (i = 0; i < builder->filter->numStates; i++) {
+        j = builder->hashes[i] & (numSlots - 1);
+        while (slots[j] != 0)
+            j = (j + 1) & (numSlots - 1);
+        slots[j] = i + 1;
+    }
+    free(builder->slots);
+    builder->slots = slots;
+    builder->mask = numSlots - 1;
+}
+
+/*
+ * the DFA state for the set just closed at the end of sets, from
+ * setStarts[numStates] on. a new one is kept, one seen before is
+ * dropped from the end again
+ */
+static unsigned int findDfaState(DfaBuilder *builder) {
+    WordFilter *filter = builder->filter;
+    size_t start = builder->setStarts[filter->numStates];
+    size_t len = builder->setsLen - start, otherLen;
+    int *set = builder->sets + start;
+    uint32_t hash;
+    unsigned int i, state;
+
+    if (len > 1)
+        qsort(set, len, sizeof(int), compInts);
+    hash = hashWord((const char *)set, len * sizeof(int)) >> 32;
+    for (i = hash & builder->mask; builder->slots[i] != 0;
+         i = (i + 1) & builder->mask) {
+        state = builder->slots[i] - 1;
+        otherLen = builder->setStarts[state + 1] - builder->setStarts[state];
+        if (builder->hashes[state] == hash && otherLen == len &&
+            memcmp(builder->sets + builder->setStarts[state], set,
+                   len * sizeof(int)) == 0) {
+            builder->setsLen = start;
+            return state;
+        }
+    }
+
+    if (filter->numStates == FILTERMAXSTATES)
+        error(1, 0, "The patterns need more than %d states to check.",
+              FILTERMAXSTATES);
+    if (filter->numStates + 1 == builder->statesCap) {
+        builder->statesCap *= 2;
+        builder->setStarts = (size_t *)realloc(
+            builder->setStarts, builder->statesCap * sizeof(size_t));
+        builder->hashes = (uint32_t *)realloc(
+            builder->hashes, builder->statesCap * sizeof(uint32_t));
+        if (builder->setStarts == NULL || builder->hashes == NULL)
+            error(1, errno, "Failed to grow word filter");
+    }
+    state = filter->numStates++;
+    builder->hashes[state] = hash;
+    builder->setStarts[filter->numStates] = builder->setsLen;
+    builder->slots[i] = state + 1;
+    if (filter->numStates * 2 > builder->mask)
+        growDfaSlots(builder);
+    return state;
+}
+
+/* whether a word ending in the state with these NFA states is kept */
+static int isKeptSet(const WordFilter *filter, const int *set, size_t len) {
+    int tags = 0;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        if (filter->nfa[set[i]].type == MATCHSTATE)
+            tags |= filter->nfa[set[i]].tag;
+    }
+    return (!filter->hasIncludes || (tags & INCLUDETAG)) &&
+           !(tags & EXCLUDETAG);
+}
+
+/* fills in the transitions out of every state in the order they're found */
+static void buildDfa(DfaBuilder *builder) {
+    WordFilter *filter = builder->filter;
+    unsigned int state, nextState, cap = 0;
+    int firstByte[256], c, numSeeds;
+    size_t i, from, to;
+    const FilterState *nfaState;
+
+    for (c = 255; c >= 0; c--)
+        firstByte[filter->classes[c]] = c;
+    for (state = 0; state < filter->numStates; state++) {
+        if (filter->numStates > cap) {
+            cap = filter->numStates * 2;
+            filter->next = (unsigned int *)realloc(
+                filter->next, (size_t)cap * filter->numClasses *
+                                  sizeof(unsigned int));
+            filter->keep = (unsigned char *)realloc(filter->keep, cap);
+            if (filter->next == NULL || filter->keep == NULL)
+                error(1, errno, "Failed to grow word filter");
+        }
+        from = builder->setStarts[state];
+        to = builder->setStarts[state + 1];
+        filter->keep[state] =
+            isKeptSet(filter, builder->sets + from, to - from);
+        for (c = 0; c < filter->numClasses; c++) {
+            numSeeds = 0;
+            for (i = from; i < to; i++) {
+                nfaState = &filter->nfa[builder->sets[i]];
+                if (nfaState->type == BYTESTATE &&
+                    hasByte(nfaState, firstByte[c]))
+                    builder->stack[numSeeds++] = nfaState->out;
+            }
+            closeSet(builder, numSeeds);
+            nextState = findDfaState(builder);
+            /* sets may have moved */
+            from = builder->setStarts[state];
+            to = builder->setStarts[state + 1];
+            filter->next[(size_t)state * filter->numClasses + c] = nextState;
+        }
+    }
+}
+
+void compileWordFilter(WordFilter *filter) {
+    DfaBuilder builder;
+    int i;
+
+    findByteClasses(filter);
+    memset(&builder, 0, sizeof(builder));
+    builder.filter = filter;
+    builder.statesCap = 64;
+    builder.setsCap = 64;
+    builder.sets = (int *)malloc(builder.setsCap * sizeof(int));
+    builder.setStarts = (size_t *)malloc(builder.statesCap * sizeof(size_t));
+    builder.hashes = (uint32_t *)malloc(builder.statesCap * sizeof(uint32_t));
+    builder.mask = 63;
+    builder.slots = (unsigned int *)calloc(builder.mask + 1, sizeof(int));
+    /* a closure pushes the seeds, which are NFA states, and at most two
+     * more for every state it reaches */
+    builder.stack = (int *)malloc(
+        (3 * filter->numNfa + 1) * sizeof(int));
+    builder.marks = (int *)calloc(filter->numNfa + 1, sizeof(int));
+    if (builder.sets == NULL || builder.setStarts == NULL ||
+        builder.hashes == NULL ||
+        builder.slots == NULL || builder.stack == NULL ||
+        builder.marks == NULL)
+        error(1, errno, "Failed to allocate word filter");
+    builder.setStarts[0] = 0;
+
+    /* the empty set is DEADSTATE, then the start */
+    closeSet(&builder, 0);
+    findDfaState(&builder);
+    for (i = 0; i < filter->numRoots; i++)
+        builder.stack[i] = filter->roots[i];
+    closeSet(&builder, filter->numRoots);
+    filter->start = findDfaState(&builder);
+    buildDfa(&builder);
+
+    free(builder.sets);
+    free(builder.setStarts);
+    free(builder.hashes);
+    free(builder.slots);
+    free(builder.stack);
+    free(builder.marks);
+    free(filter->nfa);
+    filter->nfa = NULL;
+    free(filter->roots);
+    filter->roots = NULL;
+}
+
+int keepFilteredWord(const WordFilter *filter, const char *word,
+                     size_t wordLen) {
+    unsigned int state = filter->start;
+    size_t i;
+    for (i = 0; i < wordLen && state != DEADSTATE; i++)
+        state = filter->next[state * filter->numClasses +
+                             filter->classes[(unsigned char)word[i]]];
+    if (!filter->keep[state])
+        return 0;
+    return filter->stopwords == NULL ||
+           findHashWord(filter->stopwords, word, wordLen) == HASHEMPTY;
+}
+
+void freeWordFilter(WordFilter *filter) {
+    if (filter == NULL)
+        return;
+    free(filter->nfa);
+    free(filter->roots);
+    free(filter->next);
+    free(filter->keep);
+    freeHashTable(filter->stopwords);
+    free(filter);
+}
@@ -0,0 +1,98 @@
+#ifndef FILTER_H
+#define FILTER_H
+#include "hashtable.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* the most DFA states the patterns can compile to */
+#define FILTERMAXSTATES (1 << 16)
+
+/* what a FilterState does */
+enum FilterStateType { BYTESTATE, SPLITSTATE, EMPTYSTATE, MATCHSTATE };
+
+/* what a word reaching a MATCHSTATE matched */
+#define INCLUDETAG 1
+#define EXCLUDETAG 2
+
+/*
+ * a state of the NFA the patterns are parsed into. a BYTESTATE takes
+ * any of its bytes to out, a SPLITSTATE goes to both out and out1 and
+ * an EMPTYSTATE just goes on to out. while a piece is being built, outs
+ * still to be filled in hold the next one on the same patch list
+ */
+struct FilterState {
+    enum FilterStateType type;
+    int out;
+    int out1;
+    int tag;           /* for a MATCHSTATE */
+    uint32_t bytes[8]; /* for a BYTESTATE, a bit per byte */
+};
+typedef struct FilterState FilterState;
+
+/*
+ * decides which words get counted: words matching an include pattern
+ * (if there are any), and not matching an exclude pattern or being one
+ * of the stopwords.
+ *
+ * patterns are a small ERE: literal bytes, . for any byte, [] classes
+ * with ranges and ^, grouping, | and the * + ? repeats, with \ making
+ * the next byte literal. a pattern always has to match the whole word,
+ * so a ^ at the start or $ at the end changes nothing. words get to the
+ * filter lowercased, so are the letters in a pattern.
+ *
+ * the patterns are compiled into one DFA: each pattern becomes a piece
+ * of a Thompson NFA with a tagged match state, and the subset
+ * construction turns all of them into a single table indexed by state
+ * and byte class (bytes every pattern treats the same share a class,
+ * which keeps the table small). checking a word is then one lookup per
+ * byte, stopping as soon as nothing can match any more, however many
+ * patterns there are.
+ *
+ * stopwords only ever match whole so they go in a hash table instead,
+ * where a word the patterns keep is looked up once. that way a list
+ * of any size costs the same per word and doesn't grow the DFA
+ */
+struct WordFilter {
+    /* the NFA, gone once compiled */
+    FilterState *nfa;
+    int numNfa;
+    int nfaCap;
+    int *roots; /* where each pattern starts */
+    int numRoots;
+    int rootsCap;
+    int hasIncludes;
+    /* the DFA */
+    unsigned char classes[256]; /* the byte class of every byte */
+    int numClasses;
+    unsigned int *next; /* state * numClasses + class, 0 is dead */
+    unsigned char *keep; /* whether a word ending in each state is kept */
+    unsigned int numStates;
+    unsigned int start;
+    HashTable *stopwords; /* NULL if there aren't any */
+};
+typedef struct WordFilter WordFilter;
+
+WordFilter *constructWordFilter(void);
+
+/*
+ * adds a pattern words have to match to be counted (or mustn't, if
+ * exclude is set). exits with a message if the pattern is bad
+ */
+void addFilterPattern(WordFilter *filter, const char *pattern, int exclude);
+
+/* adds a word that is never counted */
+void addFilterWord(WordFilter *filter, const char *word, size_t wordLen);
+
+/*
+ * builds the DFA. nothing can be added after this. exits with a
+ * message if the patterns need more than FILTERMAXSTATES states
+ */
+void compileWordFilter(WordFilter *filter);
+
+/* whether the word gets counted. the filter must be compiled */
+int keepFilteredWord(const WordFilter *filter, const char *word,
+                     size_t wordLen);
+
+void freeWordFilter(WordFilter *filter);
+
+#endif /* FILTER_H */
@@ -1,17 +1,29 @@
-#include <ctype.h>
 #include <errno.h>
 #include <error.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "approx.h"
+#include "counts.h"
+#include "filter.h"
+#include "ngram.h"
+#include "scan.h"
+#include "selection.h"
+#include "shard.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "topwords.h"
+#include "window.h"
+
 #define DEFAULT_N 10
 #define ALPHABET_LENGTH 26
 #define TRUE 1
 #define FALSE 0
-#define WORDCAP 25 /*inital size for words*/
-#define NEWKIDS 5
 
 /*
  * for some reason gcc is throwing an error claiming i'm doing
@@ -20,473 +32,594 @@
 int getopt(int argc, char *const argv[], const char *options);
 
 /*
- * Used in a Trie data structure that is created
- * as the inputs are read.
- * if it is the end of a word endNode is set to 1
- * and count is updated
+ * counts stdin, constructing counts once the backend is known. if the
+ * backend is still to be picked the start is read first as the sample
+ * and scanned once it is chosen
  */
-struct TrieNode {
-    char ch;
-    int endNode; /*used as bool*/
-    int count;
-    int numKids;
-    struct TrieNode **kiddies; /*pointers to child nodes */
-};
-typedef struct TrieNode TrieNode;
+static void countStdin(Scanner *scanner, WordCounts **counts,
+                       CountBackend backend) {
+    unsigned char *sample = NULL;
+    size_t len = 0;
+    ssize_t got;
+
+    if (backend == AUTOBACKEND) {
+        sample = (unsigned char *)malloc(SAMPLEBYTES);
+        if (sample == NULL)
+            error(1, errno, "Failed to allocate sample");
+        STATSMARK(scanner->stats);
+        while (len < SAMPLEBYTES &&
+               (got = read(STDIN_FILENO, sample + len, SAMPLEBYTES - len)) > 0)
+            len += got;
+        STATSLAP(scanner->stats, READPHASE);
+        backend = chooseCountBackend(sample, len);
+    }
+    *counts = constructWordCounts(backend);
+    if (sample != NULL) {
+        scanBytes(scanner, sample, len);
+        free(sample);
+        /* the sample stopping short means it was all of stdin */
+        if (len < SAMPLEBYTES) {
+            finishInput(scanner);
+            return;
+        }
+    }
+    scanStream(scanner, STDIN_FILENO);
+}
 
 /*
- * used in a circularly linked list to keep track of
- * current top words while reading input
+ * scans every file in order reporting the ones that can't be opened.
+ * the scanner carries partial words over from one file to the next
  */
-struct WordCountNode {
-    int count;
-    char *word;
-    struct WordCountNode *prev;
-    struct WordCountNode *next; /* linked node */
-};
-typedef struct WordCountNode WordCountNode;
-
-/* default constructor for WordCountNode */
-WordCountNode *initializeWordCountNode(int count, char *word,
-                                       WordCountNode *next,
-                                       WordCountNode *prev) {
-    size_t wordLen;
-    WordCountNode *w = (WordCountNode *)malloc(sizeof(WordCountNode));
-    /* copy word to node */
-    if (word != NULL) {
-        wordLen = (strlen(word) + 1) * sizeof(char);
-        w->word = (char *)malloc(wordLen);
-        w->word = (char *)memcpy(w->word, word, wordLen);
-        /* w -> word = word; */
-    } else {
-        w->word = NULL;
+static void scanInputs(Scanner *scanner, char **inputs, int numImputs) {
+    int inputIndex;
+    char *fileName = NULL;
+
+    for (inputIndex = 0; inputIndex < numImputs; inputIndex++) {
+        fileName = inputs[inputIndex];
+        if (scanFile(scanner, fileName, 0, -1) == -1) {
+            fprintf(stderr, "%s: Failed to open file \"%s\"... %s\n", "fw",
+                    fileName, strerror(errno));
+        }
     }
-    w->prev = prev;
-    w->next = next;
-    w->count = count;
-    return w;
 }
 
-int isListEmpty(WordCountNode *w) {
-    /* booleans for if the corresponding node is valid */
-    int prev, next;
-    if (w) {
-        prev = w->prev != NULL && w->prev != w;
-        next = w->next != NULL && w->next != w;
-        /* return true if it is empty */
-        return !(prev || next);
-    }
-    /* else */
-    perror("Cannot check if an uninitialized list is empty.");
-    exit(1);
+/*
+ * called by the scanner for every word read. only the count changes,
+ * the top words are picked once everything has been counted.
+ * ctx is where the counts will be since on stdin they are only
+ * constructed once the backend has been picked
+ */
+static void countWordOnly(void *ctx, const char *word, size_t wordLen) {
+    addWordCounts(*(WordCounts **)ctx, word, wordLen, 1);
 }
 
-void popPrevNode(WordCountNode **w) {
-    WordCountNode *prev = NULL, *newPrev = NULL;
+/*
+ * counts every word in the inputs, or stdin if inputs is NULL.
+ * backend has to have been picked already unless reading stdin
+ * since that can only be read once
+ */
+WordCounts *countWords(char **inputs, int numImputs, CountBackend backend) {
+    WordCounts *counts = NULL;
+    Scanner *scanner = constructScanner(countWordOnly, &counts);
 
-    prev = (*w)->prev;
-    if (prev == (*w)) {
-        perror("Cannot pop node from empty list.");
-        exit(1);
+    if (inputs == NULL) {
+        countStdin(scanner, &counts, backend);
+    } else {
+        counts = constructWordCounts(backend);
+        scanInputs(scanner, inputs, numImputs);
     }
-    newPrev = prev->prev;
-    newPrev->next = (*w);
-    (*w)->prev = newPrev;
-    /* this is technically uneeded but will make sure it always breaks
-     * if I did something wrong */
-    prev->next = NULL;
-    prev->prev = NULL;
-
-    free(prev->word);
-    free(prev);
-    return;
+    freeScanner(scanner);
+    return counts;
 }
 
 /*
- * compares word nodes
- * throws an error if either of its parameters are null
- * or if one of the parameters has a count of -1
- * (i.e. it is the root node)
- * returns > 0 if a > b and < 0 if a < b
- * returns 0 if the nodes words are the same
- * compares words first by count then lexicographically
- * returning the greater of the two
+ * counts the inputs and picks the top words once at the end (see
+ * selection.h) with numThreads threads. nothing but the counts is
+ * touched while reading, the top words are only needed at the end
  */
-int compWordNode(WordCountNode *a, WordCountNode *b) {
-    int comp;
-    if (a == NULL || b == NULL)
-        error(1, ENOTSUP, "Cannot compare null nodes");
-    else if (a->count == -1 || b->count == -1)
-        error(0, ENOTSUP, "Cannot compare to root Node");
-    comp = strcmp(a->word, b->word);
-    if (comp == 0)
-        return 0;
-    else if (a->count > b->count || (a->count == b->count && comp > 0)) {
-        return 1;
-    } else
-        return -1;
+TopWords *countWordFrequencies(int n, char **inputs, int numImputs,
+                               int numThreads, CountBackend backend) {
+    WordCounts *counts = countWords(inputs, numImputs, backend);
+    TopWords *topWords;
+
+    STATSSTART(SELECTPHASE);
+    topWords = selectTopWords(counts, n, numThreads);
+    STATSEND(SELECTPHASE);
+    /* the top words keep their own copies of the words
+     * so the counts can go all at once */
+    addWordCountsStats(counts);
+    freeWordCounts(counts);
+    return topWords;
 }
 
-/* swaps data of two nodes */
-void swap(WordCountNode *a, WordCountNode *b) {
-    int tCnt = a->count;
-    char *tWrd = a->word;
-    /* printf("%s <-> %s", a->word,b->word); */
-    a->count = b->count;
-    a->word = b->word;
-    b->count = tCnt;
-    b->word = tWrd;
+/* called by the scanner for every word read when counting grams */
+static void countGramWordCb(void *ctx, const char *word, size_t wordLen) {
+    countGramWord((GramCounts *)ctx, word, wordLen);
 }
 
-/* sorts using compWordNode comparator
- * swapping as necessary */
-void sortWordList(WordCountNode **root) {
-    WordCountNode *cur;
-    int comp;
-    for (cur = (*root)->prev; cur != (*root) && cur->prev != (*root);
-         cur = cur->prev) {
-        if ((comp = compWordNode(cur, cur->prev)) > 0)
-            swap(cur, cur->prev);
-        else if (comp == 0)
-            perror("Wow this is bad. How could these nodes be equal");
+/*
+ * same as countWordFrequencies but counts runs of gramLen words
+ * (see ngram.h) rather than single words
+ */
+TopWords *countGramFrequencies(int n, char **inputs, int numImputs,
+                               int gramLen, CountBackend backend) {
+    GramCounts *grams = constructGramCounts(gramLen);
+    Scanner *scanner = constructScanner(countGramWordCb, grams);
+    TopWords *topWords;
+
+    if (inputs == NULL) {
+        countStdin(scanner, &grams->words, backend);
+    } else {
+        grams->words = constructWordCounts(backend);
+        scanInputs(scanner, inputs, numImputs);
     }
+    freeScanner(scanner);
+
+    STATSSTART(SELECTPHASE);
+    topWords = topGrams(grams, n);
+    STATSEND(SELECTPHASE);
+    addGramCountsStats(grams);
+    freeGramCounts(grams);
+    return topWords;
+}
+
+/* everything needed to pick the top words out of merged snapshots */
+struct SnapshotMerge {
+    TopWords *topWords;
+    int total;
+    SnapshotWriter *writer; /* NULL if the result isn't being saved */
+};
+typedef struct SnapshotMerge SnapshotMerge;
+
+/* called for every word of the merged snapshots in order */
+static void visitMergedWord(void *ctx, const char *word, size_t wordLen,
+                            uint64_t count) {
+    SnapshotMerge *merge = (SnapshotMerge *)ctx;
+    merge->total++;
+    /* every word comes once with its final count so no heapPos needed */
+    updateTopWords(merge->topWords, count, NULL, word, wordLen);
+    if (merge->writer != NULL)
+        writeSnapshotWord(merge->writer, word, wordLen, count);
 }
 
 /*
- * accepts a count and a word to insert into the wordlist
- * if it finds a node with the same word it updates it's count
- * and continues
- * if the count is >= to the count of the current lowest node
- * it creates a new node and adds it to the end
- * then it runs sortWordList
- * finally, pops the lowest node if it added a new node
- *
- * length of passed list is promised to have a length <= n
- * after this function has completed
+ * adds the counts in the snapshot files to the counts of the inputs
+ * (unless countInputs is FALSE) and picks the top words from the sum.
+ * the sum is saved as a snapshot to outPath if it isn't NULL, which
+ * is safe even if it is one of the snapshots being read
  */
-void tryAddToTopWordList(WordCountNode **root, int count, char *word, int n) {
-    WordCountNode *new = NULL, *cur = NULL;
-    int len = 0, added = FALSE;
-
-    for (cur = (*root)->next; cur != (*root); cur = cur->next) {
-        if (strcmp(cur->word, word) == 0) {
-            cur->count = count;
-            added = TRUE;
-            len++;
-            break;
-        }
-        len++;
-    }
-
-    if (!added && (len < n || count >= (*root)->prev->count)) {
-        new = initializeWordCountNode(count, word, (*root), (*root)->prev);
-        (*root)->prev->next = new;
-        (*root)->prev = new;
-        len++;
+TopWords *countWithSnapshots(int n, char **inputs, int numImputs,
+                             int numThreads, CountBackend backend,
+                             int countInputs, char **snapshotPaths,
+                             int numSnapshotPaths, const char *outPath) {
+    Snapshot **snapshots;
+    WordCounts *counts;
+    SnapshotMerge merge;
+    int i, numSnapshots = 0;
+
+    snapshots = (Snapshot **)malloc((numSnapshotPaths + 1) *
+                                    sizeof(Snapshot *));
+    if (snapshots == NULL)
+        error(1, errno, "Failed to allocate snapshots");
+    for (i = 0; i < numSnapshotPaths; i++)
+        snapshots[numSnapshots++] = openSnapshot(snapshotPaths[i]);
+    if (countInputs) {
+        if (numThreads > 1 && inputs != NULL)
+            counts = countWordsParallel(inputs, numImputs, numThreads,
+                                        backend);
+        else
+            counts = countWords(inputs, numImputs, backend);
+        snapshots[numSnapshots++] = snapshotWordCounts(counts);
+        addWordCountsStats(counts);
+        freeWordCounts(counts);
     }
-    sortWordList(root);
 
-    if (len > n) {
-        popPrevNode(root);
-    }
+    merge.topWords = constructTopWords(n);
+    merge.total = 0;
+    merge.writer = (outPath != NULL ? constructSnapshotWriter(outPath) : NULL);
+    STATSSTART(SELECTPHASE);
+    forEachMergedWord(snapshots, numSnapshots, visitMergedWord, &merge);
+    if (merge.writer != NULL)
+        closeSnapshotWriter(merge.writer);
+    sortTopWords(merge.topWords);
+    STATSEND(SELECTPHASE);
+    merge.topWords->total = merge.total;
+
+    for (i = 0; i < numSnapshots; i++)
+        closeSnapshot(snapshots[i]);
+    free(snapshots);
+    return merge.topWords;
 }
 
-/* resize curWord and curWordLen */
-void increaseWordCap(int *curWordPtrLenCap, char **curWordPtr) {
-    *curWordPtrLenCap = *curWordPtrLenCap + WORDCAP;
-    /*return in case realloc moves it*/
-    *curWordPtr =
-        (char *)realloc(*curWordPtr, (*curWordPtrLenCap) * sizeof(char));
+/* called by the scanner for every word read when counting approximately */
+static void countApproxWordCb(void *ctx, const char *word, size_t wordLen) {
+    countApproxWord((ApproxCounts *)ctx, word, wordLen);
 }
 
 /*
- * resets the current word
- * frees the words memory
- * sets the pointer to null
- * and sets wordcap to WORDCAP
+ * same as countWordFrequencies but only ever uses numCounters counters
+ * (see approx.h) so the top words come with how far off they may be
  */
-void resetCurWord(int *curWordPtrLenCap, char **curWordPtr) {
-    if (curWordPtr != NULL && *curWordPtr != NULL) {
-        free(*curWordPtr);
-        *curWordPtr = NULL;
-    }
-    if (curWordPtrLenCap != NULL)
-        *curWordPtrLenCap = WORDCAP;
-    *curWordPtr = (char *)calloc(*curWordPtrLenCap, sizeof(char));
+TopWords *countApproxFrequencies(int n, char **inputs, int numImputs,
+                                 int numCounters, int useSketch) {
+    ApproxCounts *counts = constructApproxCounts(numCounters, useSketch);
+    Scanner *scanner = constructScanner(countApproxWordCb, counts);
+    TopWords *topWords;
+
+    if (inputs == NULL)
+        scanStream(scanner, STDIN_FILENO);
+    else
+        scanInputs(scanner, inputs, numImputs);
+    freeScanner(scanner);
+
+    STATSSTART(SELECTPHASE);
+    topWords = topApproxWords(counts, n);
+    STATSEND(SELECTPHASE);
+    freeApproxCounts(counts);
+    return topWords;
 }
 
-/* appends a character to the current word resizing if necessary */
-void addToWord(int *curWordPtrLenCap, int *curWordPtrLen, char **curWordPtr,
-               int ch) {
-    if (curWordPtr == NULL || *curWordPtr == NULL)
-        resetCurWord(curWordPtrLenCap, curWordPtr);
+/*
+ * assumes the top words have been sorted.
+ * approximate counts get a column with how much they may be over by
+ * and the total is how many words were read rather than how many
+ * different ones
+ */
+void printWordList(const TopWords *topWords, int n, int approximate) {
+    int i;
 
-    (*curWordPtr)[*curWordPtrLen] = ch;
-    (*curWordPtrLen)++;
-    (*curWordPtr)[*curWordPtrLen] = '\0';
+    if (approximate)
+        printf("The top %d words (out of %lu read) are:\n", n,
+               (unsigned long)topWords->total);
+    else
+        printf("The top %d words (out of %lu) are:\n", n,
+               (unsigned long)topWords->total);
+    for (i = 0; i < topWords->len; i++) {
+        if (approximate)
+            printf("%*lu %*lu %s\n", 9,
+                   (unsigned long)topWords->heap[i].count, 9,
+                   (unsigned long)topWords->heap[i].error,
+                   topWords->heap[i].word);
+        else
+            printf("%*lu %s\n", 9, (unsigned long)topWords->heap[i].count,
+                   topWords->heap[i].word);
+    }
+}
 
-    if (*curWordPtrLen == (*curWordPtrLenCap - 1))
-        increaseWordCap(curWordPtrLenCap, curWordPtr);
+/* everything the windowed count needs between reads */
+struct WindowCounter {
+    Window *window;
+    int n;
+    int emitWords;   /* a period is this many words */
+    int emitSeconds; /* or this many seconds (one of them is 0) */
+    int wordsInPeriod;
+    struct timespec deadline; /* when the current period ends */
+};
+typedef struct WindowCounter WindowCounter;
+
+/* prints the top words in the window and moves on to the next period */
+static void emitWindow(WindowCounter *counter) {
+    TopWords *topWords;
+
+    STATSSTART(SELECTPHASE);
+    topWords = topWindowWords(counter->window, counter->n);
+    STATSEND(SELECTPHASE);
+    STATSSTART(PRINTPHASE);
+    printWordList(topWords, counter->n, FALSE);
+    /* someone is watching so don't let it sit in a buffer */
+    fflush(stdout);
+    STATSEND(PRINTPHASE);
+    freeTopWords(topWords);
+    nextWindowPeriod(counter->window);
+    counter->wordsInPeriod = 0;
+    counter->deadline.tv_sec += counter->emitSeconds;
 }
 
-/* trie node constructor */
-/* notably initializes kids as NULL */
-TrieNode *constructTrieNode(int ch) {
-    TrieNode *t = (TrieNode *)malloc(sizeof(TrieNode));
-    t->endNode = FALSE;
-    t->count = 0;
-    t->numKids = 0;
-    t->ch = ch;
-    t->kiddies = NULL; /*  (TrieNode **) malloc(10*sizeof(TrieNode *));*/
-    /* assign all nulls to kiddies */
-    /* t -> kiddies = NULL; */
-    return t;
+/* called by the scanner for every word read when counting a window */
+static void countWindowWordCb(void *ctx, const char *word, size_t wordLen) {
+    WindowCounter *counter = (WindowCounter *)ctx;
+    countWindowWord(counter->window, word, wordLen);
+    counter->wordsInPeriod++;
+    if (counter->wordsInPeriod == counter->emitWords)
+        emitWindow(counter);
 }
 
-/* gets next trienode by char and initializes it if
- * it is null, and adds it to the passed nodes kids
- * returns the found or created node*/
-TrieNode *getNextTrieNode(TrieNode *curNode, int ch) {
-    TrieNode **newKiddies = NULL, *kid = NULL;
-    int numKids = 0, i = 0;
-    if (curNode != NULL) {
-        newKiddies = curNode->kiddies;
-        numKids = curNode->numKids;
-    }
+/* milliseconds until the current period ends, 0 if it already has */
+static int millisUntilDeadline(const WindowCounter *counter) {
+    struct timespec now;
+    long millis;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    millis = (counter->deadline.tv_sec - now.tv_sec) * 1000L +
+             (counter->deadline.tv_nsec - now.tv_nsec) / 1000000L;
+    return (millis > 0 ? (int)millis : 0);
+}
 
-    if (newKiddies != NULL && numKids != 0) {
-        /* will continue if:
-         * i < numKids aka within bounds
-         * or: the node pointed to at kiddies[i] !=NULL
-         * nested i++ ensures i is incremented when kid == NULL
-         * so it holds the correct index*/
-        for (i = 0; i < numKids && (kid = newKiddies[i++]) != NULL;) {
-            if (kid->ch == ch) {
-                return kid;
+/*
+ * reads fd as it comes in rather than all at once so that periods
+ * measured in seconds end on time even while nothing is being read
+ */
+static void streamWindow(WindowCounter *counter, Scanner *scanner, int fd) {
+    unsigned char *buf = (unsigned char *)malloc(SCANWINDOW);
+    struct pollfd pfd;
+    ssize_t got;
+    int wait, ready;
+
+    if (buf == NULL)
+        error(1, errno, "Failed to allocate read buffer");
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (1) {
+        wait = -1;
+        if (counter->emitSeconds > 0) {
+            wait = millisUntilDeadline(counter);
+            if (wait == 0) {
+                emitWindow(counter);
+                continue;
             }
         }
+        ready = poll(&pfd, 1, wait);
+        if (ready == -1 && errno == EINTR)
+            continue;
+        if (ready == 0)
+            continue;
+        if (ready == -1)
+            break;
+        STATSMARK(scanner->stats);
+        got = read(fd, buf, SCANWINDOW);
+        STATSLAP(scanner->stats, READPHASE);
+        /* same as fgetc, a read error ends the file */
+        if (got <= 0)
+            break;
+        scanBytes(scanner, buf, got);
     }
-    /* i == numKids will be true when:
-     * loop ended when i !< numKids
-     * kid == NULL when:
-     * the array or the TN pointed too by kiddies[i]
-     * has not been initialized yet */
-    if (i == numKids || kid == NULL) {
-        numKids += 1;
-        newKiddies =
-            (TrieNode **)realloc(newKiddies, numKids * sizeof(TrieNode *));
-        if (newKiddies == NULL)
-            perror("Failed to realloc kids array");
-        newKiddies[i] = NULL;
-        curNode->numKids = numKids;
-    }
-
-    kid = constructTrieNode(ch);
-    newKiddies[i] = kid;
-    curNode->kiddies = newKiddies;
-    return curNode->kiddies[i];
+    finishInput(scanner);
+    free(buf);
 }
 
-WordCountNode *countWordFrequencies(int n, char **inputs, int numImputs) {
-    TrieNode *trieRoot = constructTrieNode(0);
-    WordCountNode *wordCountRoot; /* to be constructed shortly */
-    /* initialize current trie node to point at root */
-    TrieNode *curTrieNode = trieRoot;
-    int inputIndex, ch = 0, curWordLen = 0, curWordLenCap = WORDCAP, total = 0;
-    FILE *file;
-    char *curWord = NULL, *fileName = NULL;
-    resetCurWord(&curWordLenCap, &curWord);
-
-    /* construct word count list root */
-    wordCountRoot = initializeWordCountNode(-1, "root", NULL, NULL);
-    wordCountRoot->prev = wordCountRoot;
-    wordCountRoot->next = wordCountRoot;
-
-    for (inputIndex = 0; inputIndex < numImputs; inputIndex++) {
-        if (inputs == NULL)
-            file = stdin;
-        else {
-            fileName = inputs[inputIndex];
-            file = fopen(fileName, "r");
-            if (file == NULL) {
-                fprintf(stderr, "%s: Failed to open file \"%s\"... %s\n", "fw",
-                        fileName, strerror(errno));
-                continue;
-            }
-        }
-        while ((ch = fgetc(file)) != EOF) {
-            /* if in alphabet */
-            if (isgraph(ch)) {
-                /* normalize characters */
-                if (isalpha(ch)) {
-                    ch = tolower(ch);
-                }
-                /* go to next TrieNode */
-                curTrieNode = getNextTrieNode(curTrieNode, ch);
-                /* add character to current word */
-                addToWord(&curWordLenCap, &curWordLen, &curWord, ch);
-            }
-            /* reached end of word */
-            else {
-                /* does not run if the length of the current word is zero
-                 * and therefore the previous char was not a word character */
-                if (curTrieNode != trieRoot && curWord != NULL &&
-                    strlen(curWord) > 0) {
-                    /* check if zero before incrementing total
-                     * to only count unique words */
-                    if (curTrieNode->count == 0) {
-                        total++;
-                    }
-                    /* update count */
-                    curTrieNode->count++;
-                    /* set end of word boolean to true */
-                    curTrieNode->endNode = TRUE;
-                    /* insert the word into the current list of top words
-                     * tryAddToTopWordList will not add it if it is below the
-                     * top n words */
-                    tryAddToTopWordList(&wordCountRoot, curTrieNode->count,
-                                        curWord, n);
-                    /* jump back to the root for next word */
-                    curTrieNode = trieRoot;
-                    /* reset the current word */
-                    resetCurWord(&curWordLenCap, &curWord);
-                    curWordLen = 0;
-                }
-            }
-        }
-        if (!(fclose(file) == 0)) {
-            perror("Failed to close file\n");
+/*
+ * counts the inputs a period at a time printing the top words of the
+ * last numPeriods periods at the end of each one and once more at the
+ * end of the input if anything was read since the last time
+ */
+void countWindowFrequencies(int n, char **inputs, int numImputs,
+                            int emitWords, int emitSeconds, int numPeriods) {
+    WindowCounter counter;
+    Scanner *scanner = constructScanner(countWindowWordCb, &counter);
+    int inputIndex, fd;
+
+    counter.window = constructWindow(numPeriods);
+    counter.n = n;
+    counter.emitWords = emitWords;
+    counter.emitSeconds = emitSeconds;
+    counter.wordsInPeriod = 0;
+    clock_gettime(CLOCK_MONOTONIC, &counter.deadline);
+    counter.deadline.tv_sec += emitSeconds;
+
+    if (inputs == NULL)
+        streamWindow(&counter, scanner, STDIN_FILENO);
+    for (inputIndex = 0; inputs != NULL && inputIndex < numImputs;
+         inputIndex++) {
+        if ((fd = open(inputs[inputIndex], O_RDONLY)) == -1) {
+            fprintf(stderr, "%s: Failed to open file \"%s\"... %s\n", "fw",
+                    inputs[inputIndex], strerror(errno));
+            continue;
         }
+        streamWindow(&counter, scanner, fd);
+        close(fd);
     }
-    free(curWord);
-    curWord = NULL;
-
-    /* printWordList expects a non circularly linked list
-     * who's first node contains the total amount of words considered
-     * therefore:
-     * set the root nodes count to total */
-    sortWordList(&wordCountRoot);
-    wordCountRoot->count = total;
-    /* and:
-     * remove the roots prevs link to the root so it
-     * becomes a non circularly linked list */
-    wordCountRoot->prev->next = NULL;
-    /* return singly linked list of top words with length n */
-    return wordCountRoot;
+    if (counter.wordsInPeriod > 0)
+        emitWindow(&counter);
+    freeScanner(scanner);
+    freeWindow(counter.window);
 }
 
-/* assumes root node contains total as its count */
-void printWordList(const WordCountNode *wordList, int n) {
-    int total = wordList->count;
-    WordCountNode *cur = wordList->next;
-
-    printf("The top %d words (out of %d) are:\n", n, total);
-    while (cur != NULL && cur->word != NULL && cur->count != 0) {
-        printf("%*d %s\n", 9, cur->count, cur->word);
-        cur = cur->next;
-    }
+/* called by the scanner for every word in a stopword file */
+static void addStopwordCb(void *ctx, const char *word, size_t wordLen) {
+    addFilterWord((WordFilter *)ctx, word, wordLen);
 }
 
 /*
- * Below are helper functions I wrote for debugging.
+ * adds every word in the file at path to the filter's stopwords.
+ * they are split and lowercased by a scanner, the same as the words
+ * they will be checked against
  */
-
-int asprintf(char **ptr, const char *template, ...);
-
-char *printList(WordCountNode *w) {
-    WordCountNode *c;
-    char *output = "";
-    if (w == NULL) {
-        perror("cannot print null list");
-        exit(1);
-    }
-
-    c = w;
-    do {
-        if (c != NULL) {
-            if (asprintf(&output, "%s [%d : %s] <p=n>", output, c->count,
-                         c->word) > 0)
-                c = c->next;
-            else
-                return NULL;
-        }
-    } while (c != NULL && c != w);
-    if (asprintf(&output, "%s [%d : %s]\n", output, c->count, c->word) > 0)
-        return output;
-    else
-        return NULL;
+static void readStopwords(WordFilter *filter, const char *path) {
+    Scanner *scanner = constructScanner(addStopwordCb, filter);
+    if (scanFile(scanner, path, 0, -1) == -1)
+        error(1, errno, "Failed to open stopword file \"%s\"", path);
+    /* the last word still needs something after it to end it */
+    scanBytes(scanner, (const unsigned char *)"\n", 1);
+    STATSCLEAR(scanner->stats);
+    freeScanner(scanner);
 }
 
-int lenCircularList(WordCountNode *head) {
-    WordCountNode *current;
-    int count = 0;
-    if (head == NULL) {
-        perror("Cannot calculate the length of a non initialized list");
+/*
+ * parses a non-negative integer argument for option opt
+ * exits with the usage string if it isn't one
+ */
+int parseIntArg(char opt, const char *val, const char *usagestr) {
+    char *tail;
+    int num;
+    errno = 0;
+    num = strtol(val, &tail, 0);
+    /*if errno was set there was an overflow*/
+    if (errno) {
+        error(1, errno,
+              "Overflow. Option `-%c` requires a smaller argument "
+              "value.\n\n%s",
+              opt, usagestr);
     }
-    current = head->next;
-    while (current != NULL && current != head) {
-        count++;
-        current = current->next;
+    /*if tail doesn't point to the end of the string something went wrong
+     * as stated by GNU C library documentation */
+    else if (!(*tail == '\0')) {
+        error(1, errno, "Option -%c requires an integer argument.\n\n%s",
+              opt, usagestr);
     }
-    return count;
+    /*at this point we are confident num is an integer*/
+    else if (num < 0) {
+        error(1, errno,
+              "Option -%c requires a non-negative integer argument.\n\n%s",
+              opt, usagestr);
+    }
+    /* now we're sure num is a valid arg */
+    return num;
 }
 
 int main(int argc, char *argv[]) {
-    const char *options = ":n:";
-    int i, n, c;
-    char *nval, *tail, *fileName;
+    const char *options = ":n:j:b:a:se:t:w:i:o:g:ux:p:v:";
+    int i, n = DEFAULT_N, numThreads = 1, c, backend = AUTOBACKEND;
+    int numCounters = 0, useSketch = FALSE;
+    int emitWords = 0, emitSeconds = 0, numPeriods = 0;
+    int isMerge = FALSE, numSnapshots = 0, gramLen = 1, useUtf8 = FALSE;
+    int showStats = FALSE, isFiltered = FALSE, numStopwordPaths = 0;
+    char **snapshotPaths, **stopwordPaths;
+    WordFilter *filter;
+    const char *outPath = NULL;
+    unsigned char *sample;
+    char *fileName;
     const char *usagestr =
-        "Usage:\n\tfw [-n num] [ files ...]\nOptions:\n\t-n\tSet the number of "
-        "most frequent words to display. Defaults to 10.\n\tfiles\tThe files "
-        "to read words from. Defaults to reading from stdin.";
+        "Usage:\n\tfw [-n num] [-j threads] [-b backend] [-a counters [-s]] "
+        "[-e words | -t seconds [-w periods]] [-i snapshot ...] "
+        "[-o snapshot] [-g words] [-u] [-x stopwords ...] [-p pattern ...] "
+        "[-v pattern ...] [--stats] [ files ...]\n"
+        "\tfw merge [-n num] [-o snapshot] [--stats] snapshots ...\n"
+        "Options:\n\t-n\tSet "
+        "the number of most frequent words to display. Defaults to "
+        "10.\n\t-j\tCount the files, then pick the top words, with this "
+        "many threads. Defaults to 1.\n\t-b\tCount words with a trie, hash "
+        "or auto to pick from the start of the input. Defaults to auto."
+        "\n\t-a\tCount approximately in fixed memory, keeping only this many words. Prints how much "
+        "each count may be over by after it. Always uses one thread."
+        "\n\t-s\tWith -a, only give words a counter once a count-min "
+        "sketch has seen them more often than the lowest counted word."
+        "\n\t-e\tPrint the top words every this many words read, "
+        "counting only the words in the window.\n\t-t\tPrint the top "
+        "words every this many seconds instead.\n\t-w\tWith -e or -t, "
+        "how many periods the window covers. 1 starts over after every "
+        "print, more slides it along a period at a time. Defaults to 1."
+        "\n\t-i\tAdd the counts saved in this snapshot to the counts of "
+        "the files. Can be given more than once.\n\t-o\tSave the counts "
+        "to this snapshot file.\n\t-g\tCount runs of this many words in a "
+        "row instead of single words. Always uses one thread.\n\t-u\t"
+        "Read the input as UTF-8, splitting words on Unicode spaces and "
+        "case folding letters from every script.\n\t-x\tDon't count any of "
+        "the words in this file. Can be given more than once.\n\t-p\tOnly "
+        "count words matching this pattern, or any of them if given more "
+        "than once.\n\t-v\tDon't count words matching this pattern. Can "
+        "be given more than once.\n\t--stats\tPrint what was "
+        "read, the memory used and the time each phase took as JSON to "
+        "stderr at the end.\n\tfiles\tThe files to "
+        "read words from. Defaults to reading from stdin.\n"
+        "Merge:\n\tPrints the top words of the counts in all the snapshots "
+        "added together. Only takes -n, -o and --stats.";
     extern char *optarg;
     extern int optopt, errno, optind;
     char **inputs = NULL;
     int numImputs = 1;
-    WordCountNode *topWordsList = NULL;
+    TopWords *topWordsList = NULL;
+
+    STATSINIT();
 
     /* ARGUMENT HANDLING */
-    c = getopt(argc, argv, options);
-    switch (c) {
-    case 'n':
-        nval = optarg;
-        errno = 0;
-        n = strtol(nval, &tail, 0);
-        /*if errno was set there was an overflow*/
-        if (errno) {
-            error(1, errno,
-                  "Overflow. Option `-n` requires a smaller argument "
-                  "value.\n\n%s",
-                  usagestr);
-            error(1, errno, "Failed to Parse argument for Option `-n`\n\n%s",
-                  usagestr);
-        }
-        /*if tail doesn't point to the end of the string something went wrong
-         * as stated by GNU C library documentation */
-        else if (!(*tail == '\0')) {
-            error(1, errno, "Option -n requires an integer argument.\n\n%s",
-                  usagestr);
-        }
-        /*at this point we are confident n is an integer*/
-        else if (n < 0) {
-            error(1, errno,
-                  "Option -n requires a non-negative integer argument.\n\n%s",
+    snapshotPaths = (char **)malloc(sizeof(char *) * argc);
+    stopwordPaths = (char **)malloc(sizeof(char *) * argc);
+    if (snapshotPaths == NULL || stopwordPaths == NULL)
+        error(1, errno, "Failed to allocate snapshot list");
+    filter = constructWordFilter();
+    /* merge is a subcommand so getopt starts after it */
+    if (argc > 1 && strcmp(argv[1], "merge") == 0) {
+        isMerge = TRUE;
+        argc--;
+        argv++;
+    }
+    /* getopt only does short options so --stats is taken out first */
+    for (i = 1; i < argc && strcmp(argv[i], "--") != 0; i++) {
+        if (strcmp(argv[i], "--stats") != 0)
+            continue;
+        showStats = TRUE;
+        memmove(&argv[i], &argv[i + 1], (argc - i) * sizeof(char *));
+        argc--;
+        i--;
+    }
+    while ((c = getopt(argc, argv, options)) != -1) {
+        switch (c) {
+        case 'n':
+            n = parseIntArg('n', optarg, usagestr);
+            break;
+        case 'j':
+            numThreads = parseIntArg('j', optarg, usagestr);
+            if (numThreads == 0)
+                error(1, 0, "Option -j requires at least one thread.\n\n%s",
+                      usagestr);
+            break;
+        case 'a':
+            numCounters = parseIntArg('a', optarg, usagestr);
+            if (numCounters == 0)
+                error(1, 0, "Option -a requires at least one counter.\n\n%s",
+                      usagestr);
+            break;
+        case 's':
+            useSketch = TRUE;
+            break;
+        case 'e':
+            emitWords = parseIntArg('e', optarg, usagestr);
+            if (emitWords == 0)
+                error(1, 0, "Option -e requires at least one word.\n\n%s",
+                      usagestr);
+            break;
+        case 't':
+            emitSeconds = parseIntArg('t', optarg, usagestr);
+            if (emitSeconds == 0)
+                error(1, 0, "Option -t requires at least one second.\n\n%s",
+                      usagestr);
+            break;
+        case 'w':
+            numPeriods = parseIntArg('w', optarg, usagestr);
+            if (numPeriods == 0)
+                error(1, 0, "Option -w requires at least one period.\n\n%s",
+                      usagestr);
+            break;
+        case 'g':
+            gramLen = parseIntArg('g', optarg, usagestr);
+            if (gramLen == 0)
+                error(1, 0, "Option -g requires at least one word.\n\n%s",
+                      usagestr);
+            break;
+        case 'u':
+            useUtf8 = TRUE;
+            break;
+        case 'x':
+            stopwordPaths[numStopwordPaths++] = optarg;
+            isFiltered = TRUE;
+            break;
+        case 'p':
+        case 'v':
+            addFilterPattern(filter, optarg, c == 'v');
+            isFiltered = TRUE;
+            break;
+        case 'i':
+            snapshotPaths[numSnapshots++] = optarg;
+            break;
+        case 'o':
+            outPath = optarg;
+            break;
+        case 'b':
+            backend = parseCountBackend(optarg);
+            if (backend == -1)
+                error(1, 0, "Unknown backend `%s'.\n\n%s", optarg, usagestr);
+            break;
+        case '?':
+            /* TODO: checking for `--help` */
+            if (optopt == 'h') {
+                printf("%s\n", usagestr);
+                exit(0);
+            }
+            error(1, errno, "Unknown option `-%c'.\n\n%s", optopt, usagestr);
+            break;
+        default:
+            error(1, errno, "Option -%c requires an argument.\n\n%s", optopt,
                   usagestr);
         }
-        /* now we're sure n is a valid arg */
-        break;
-    case '?':
-        // TODO: checking for `--help`
-        if (optopt == 'h') {
-            printf("%s\n", usagestr);
-            exit(0);
-        }
-        error(1, errno, "Unknown option `-%c'.\n\n%s", optopt, usagestr);
-    default:
-        if (optopt == 'n')
-            error(1, errno, "Option -n requires an argument.\n\n%s", usagestr);
-        else
-            n = DEFAULT_N;
     }
     /*no files passed as args*/
     if (argc == optind) {
@@ -502,12 +635,130 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    topWordsList = countWordFrequencies(n, inputs, numImputs);
-    printWordList(topWordsList, n);
+    if (showStats && !STATSBUILT)
+        error(1, 0, "--stats needs fw built with FWSTATS (see the "
+                    "Makefile).\n\n%s",
+              usagestr);
+    if (isMerge && (numThreads != 1 || backend != AUTOBACKEND ||
+                    numCounters > 0 || emitWords > 0 || emitSeconds > 0 ||
+                    numPeriods > 0 || numSnapshots > 0 || gramLen > 1 ||
+                    useUtf8 || isFiltered))
+        error(1, 0, "merge only takes -n, -o and --stats.\n\n%s", usagestr);
+    if (isMerge && inputs == NULL)
+        error(1, 0, "merge needs at least one snapshot.\n\n%s", usagestr);
+    if ((numSnapshots > 0 || outPath != NULL) &&
+        (numCounters > 0 || emitWords > 0 || emitSeconds > 0))
+        error(1, 0, "Options -i and -o can't be used with -a, -e or -t."
+                    "\n\n%s",
+              usagestr);
+    if (gramLen > 1 && (numCounters > 0 || emitWords > 0 || emitSeconds > 0 ||
+                        numSnapshots > 0 || outPath != NULL))
+        error(1, 0, "Option -g can't be used with -a, -e, -t, -i or -o."
+                    "\n\n%s",
+              usagestr);
+    if (emitWords > 0 && emitSeconds > 0)
+        error(1, 0, "Options -e and -t can't be used together.\n\n%s",
+              usagestr);
+    if (numPeriods > 0 && emitWords == 0 && emitSeconds == 0)
+        error(1, 0, "Option -w only works with -e or -t.\n\n%s", usagestr);
+    if (numCounters > 0 && (emitWords > 0 || emitSeconds > 0))
+        error(1, 0, "Option -a can't be used with -e or -t.\n\n%s",
+              usagestr);
+    if (useSketch && numCounters == 0)
+        error(1, 0, "Option -s only works with -a.\n\n%s", usagestr);
+    /* can't show more words than there are counters */
+    if (numCounters > 0 && numCounters < n)
+        error(1, 0, "Option -a needs at least as many counters as -n shows "
+                    "words.\n\n%s",
+              usagestr);
+
+    /* set before any scanner is made, and so any thread is started */
+    if (useUtf8)
+        setScanMode(UTF8SCAN);
+    /* and the stopwords are split the way the input will be */
+    if (isFiltered) {
+        for (i = 0; i < numStopwordPaths; i++)
+            readStopwords(filter, stopwordPaths[i]);
+        compileWordFilter(filter);
+        setScanFilter(filter);
+    }
+
+    /* windows are printed as they go */
+    if (emitWords > 0 || emitSeconds > 0) {
+        countWindowFrequencies(n, inputs, numImputs, emitWords, emitSeconds,
+                               (numPeriods > 0 ? numPeriods : 1));
+        if (showStats)
+            STATSREPORT(stderr);
+        free(inputs);
+        free(snapshotPaths);
+        free(stopwordPaths);
+        freeWordFilter(filter);
+        return 0;
+    }
+    if (isMerge) {
+        topWordsList = countWithSnapshots(n, NULL, 0, 1, backend, FALSE,
+                                          inputs, numImputs, outPath);
+        STATSSET(DISTINCTWORDS, topWordsList->total);
+        STATSSTART(PRINTPHASE);
+        printWordList(topWordsList, n, FALSE);
+        fflush(stdout);
+        STATSEND(PRINTPHASE);
+        STATSMEMORY(TOPWORDSMEMORY, getTopWordsBytes(topWordsList));
+        if (showStats)
+            STATSREPORT(stderr);
+        freeTopWords(topWordsList);
+        free(inputs);
+        free(snapshotPaths);
+        free(stopwordPaths);
+        freeWordFilter(filter);
+        return 0;
+    }
+
+    /* stdin is sampled as it is read, files can be looked at up front */
+    if (backend == AUTOBACKEND && inputs != NULL && numCounters == 0) {
+        sample = (unsigned char *)malloc(SAMPLEBYTES);
+        if (sample == NULL)
+            error(1, errno, "Failed to allocate sample");
+        backend = chooseCountBackend(
+            sample, readInputSample(inputs, numImputs, sample));
+        free(sample);
+    }
+
+    /* stdin can only be read front to back so it always gets one thread */
+    if (gramLen > 1)
+        topWordsList = countGramFrequencies(n, inputs, numImputs, gramLen,
+                                            backend);
+    else if (numSnapshots > 0 || outPath != NULL)
+        topWordsList = countWithSnapshots(n, inputs, numImputs, numThreads,
+                                          backend, TRUE, snapshotPaths,
+                                          numSnapshots, outPath);
+    else if (numCounters > 0)
+        topWordsList = countApproxFrequencies(n, inputs, numImputs,
+                                              numCounters, useSketch);
+    else if (numThreads > 1 && inputs != NULL)
+        topWordsList = countWordFrequenciesParallel(n, inputs, numImputs,
+                                                    numThreads, backend);
+    else
+        topWordsList = countWordFrequencies(n, inputs, numImputs, numThreads,
+                                            backend);
+    /* approximate totals are words read, not different words */
+    if (numCounters == 0)
+        STATSSET(DISTINCTWORDS, topWordsList->total);
+    STATSSTART(PRINTPHASE);
+    printWordList(topWordsList, n, numCounters > 0);
+    fflush(stdout);
+    STATSEND(PRINTPHASE);
+    STATSMEMORY(TOPWORDSMEMORY, getTopWordsBytes(topWordsList));
+    if (showStats)
+        STATSREPORT(stderr);
+    freeTopWords(topWordsList);
     topWordsList = NULL;
 
     /*SHUTDOWN*/
     free(inputs);
     inputs = NULL;
+    free(snapshotPaths);
+    free(stopwordPaths);
+    freeWordFilter(filter);
     return 0;
 }
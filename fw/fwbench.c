@@ -0,0 +1,314 @@
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "allocount.h"
+#include "counts.h"
+#include "scan.h"
+#include "selection.h"
+#include "topwords.h"
+
+/*
+ * benchmarks fw on a corpus (see gencorpus.c) printing one JSON object
+ * per line for each measurement.
+ *
+ * stages times tokenizing, counting and picking the top words one after
+ * another in this process so each can be tracked on its own. counting
+ * has to tokenize too, so its time is reported both as is and with the
+ * tokenize time taken off.
+ *
+ * run times a whole fw run in a child process, fw being built with
+ * allocount.o so it can report its allocations
+ */
+
+#define DEFAULT_N 10
+
+int getopt(int argc, char *const argv[], const char *options);
+
+/* what is known about the corpus */
+struct Corpus {
+    const char *fileName;
+    const char *label;
+    long long bytes;
+    long long words;
+};
+typedef struct Corpus Corpus;
+
+/* a point in time to measure a stage from */
+struct Mark {
+    struct timespec time;
+    AllocCounts allocs;
+};
+typedef struct Mark Mark;
+
+static void setMark(Mark *mark) {
+    clock_gettime(CLOCK_MONOTONIC, &mark->time);
+    getAllocCounts(&mark->allocs);
+}
+
+static double secondsSince(const Mark *mark) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - mark->time.tv_sec) +
+           (now.tv_nsec - mark->time.tv_nsec) / 1e9;
+}
+
+/* peak RSS in KB of this process or, if children, its waited for ones */
+static long peakRss(int children) {
+    struct rusage usage;
+    getrusage(children ? RUSAGE_CHILDREN : RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/* labels come from the command line so they may need escaping */
+static void printJsonString(const char *str) {
+    putchar('"');
+    for (; *str != '\0'; str++) {
+        if (*str == '"' || *str == '\\')
+            putchar('\\');
+        putchar(*str);
+    }
+    putchar('"');
+}
+
+/* the fields every measurement has, leaves the object open */
+static void printMeasurement(const char *bench, const char *name,
+                             const Corpus *corpus, double seconds) {
+    printf("{\"bench\": \"%s\", \"name\": ", bench);
+    printJsonString(name);
+    printf(", \"corpus\": ");
+    printJsonString(corpus->label);
+    printf(", \"bytes\": %lld, \"words\": %lld, \"seconds\": %.6f, "
+           "\"wordsPerSec\": %.0f, \"bytesPerSec\": %.0f",
+           corpus->bytes, corpus->words, seconds,
+           (seconds > 0 ? corpus->words / seconds : 0),
+           (seconds > 0 ? corpus->bytes / seconds : 0));
+}
+
+static void printAllocs(const AllocCounts *allocs) {
+    printf(", \"allocs\": %lu, \"reallocs\": %lu, \"frees\": %lu, "
+           "\"allocBytes\": %lu",
+           (unsigned long)allocs->allocs, (unsigned long)allocs->reallocs,
+           (unsigned long)allocs->frees, (unsigned long)allocs->bytes);
+}
+
+/* prints a stage measured from mark along with what it allocated */
+static double printStage(const char *stage, const Corpus *corpus,
+                         const Mark *mark, const char *backend,
+                         double minusSeconds) {
+    double seconds = secondsSince(mark);
+    AllocCounts allocs;
+
+    getAllocCounts(&allocs);
+    allocs.allocs -= mark->allocs.allocs;
+    allocs.reallocs -= mark->allocs.reallocs;
+    allocs.frees -= mark->allocs.frees;
+    allocs.bytes -= mark->allocs.bytes;
+    printMeasurement("stage", stage, corpus, seconds);
+    printf(", \"backend\": \"%s\"", backend);
+    if (minusSeconds > 0)
+        printf(", \"ownSeconds\": %.6f", seconds - minusSeconds);
+    printf(", \"peakRssKb\": %ld", peakRss(0));
+    printAllocs(&allocs);
+    printf("}\n");
+    fflush(stdout);
+    return seconds;
+}
+
+static void countTokenizedWord(void *ctx, const char *word, size_t wordLen) {
+    (void)word;
+    (void)wordLen;
+    (*(long long *)ctx)++;
+}
+
+static void countStageWord(void *ctx, const char *word, size_t wordLen) {
+    addWordCounts((WordCounts *)ctx, word, wordLen, 1);
+}
+
+/* reads the corpus once through the scanner counting words */
+static void tokenizeCorpus(Corpus *corpus) {
+    Scanner *scanner = constructScanner(countTokenizedWord, &corpus->words);
+    struct stat st;
+
+    if (stat(corpus->fileName, &st) == -1 ||
+        scanFile(scanner, corpus->fileName, 0, -1) == -1)
+        error(1, errno, "Failed to read corpus \"%s\"", corpus->fileName);
+    corpus->bytes = st.st_size;
+    freeScanner(scanner);
+}
+
+static void benchStages(Corpus *corpus, int backend, int n,
+                        int numThreads) {
+    static const char *backendNames[] = {"auto", "trie", "hash"};
+    unsigned char *sample;
+    WordCounts *counts;
+    TopWords *topWords;
+    Scanner *scanner;
+    double tokenizeSeconds;
+    Mark mark;
+
+    setMark(&mark);
+    tokenizeCorpus(corpus);
+    tokenizeSeconds = printStage("tokenize", corpus, &mark, "none", 0);
+
+    if (backend == AUTOBACKEND) {
+        sample = (unsigned char *)malloc(SAMPLEBYTES);
+        if (sample == NULL)
+            error(1, errno, "Failed to allocate sample");
+        backend = chooseCountBackend(
+            sample, readInputSample((char **)&corpus->fileName, 1, sample));
+        free(sample);
+    }
+    setMark(&mark);
+    counts = constructWordCounts(backend);
+    scanner = constructScanner(countStageWord, counts);
+    scanFile(scanner, corpus->fileName, 0, -1);
+    freeScanner(scanner);
+    printStage("count", corpus, &mark, backendNames[backend],
+               tokenizeSeconds);
+
+    setMark(&mark);
+    topWords = selectTopWords(counts, n, numThreads);
+    printStage("topn", corpus, &mark, backendNames[backend], 0);
+
+    freeTopWords(topWords);
+    freeWordCounts(counts);
+}
+
+/* runs command with the corpus as its last argument, output thrown away */
+static void benchRun(Corpus *corpus, const char *name, char **command,
+                     int commandLen) {
+    char allocsPath[] = "/tmp/fwbenchXXXXXX";
+    char **args = (char **)malloc((commandLen + 2) * sizeof(char *));
+    unsigned long counts[4];
+    AllocCounts allocs;
+    FILE *allocsFile;
+    Mark mark;
+    pid_t pid;
+    int status, fd, gotAllocs = 0;
+
+    if (args == NULL)
+        error(1, errno, "Failed to allocate arguments");
+    memcpy(args, command, commandLen * sizeof(char *));
+    args[commandLen] = (char *)corpus->fileName;
+    args[commandLen + 1] = NULL;
+    tokenizeCorpus(corpus);
+    if ((fd = mkstemp(allocsPath)) == -1)
+        error(1, errno, "Failed to make a temporary file");
+    close(fd);
+
+    fflush(stdout);
+    setMark(&mark);
+    if ((pid = fork()) == -1)
+        error(1, errno, "Failed to fork");
+    if (pid == 0) {
+        if ((fd = open("/dev/null", O_WRONLY)) != -1)
+            dup2(fd, STDOUT_FILENO);
+        setenv(ALLOCOUNTENV, allocsPath, 1);
+        execvp(args[0], args);
+        error(127, errno, "Failed to run \"%s\"", args[0]);
+    }
+    if (waitpid(pid, &status, 0) == -1)
+        error(1, errno, "Failed to wait for \"%s\"", args[0]);
+
+    printMeasurement("run", name, corpus, secondsSince(&mark));
+    printf(", \"status\": %d, \"peakRssKb\": %ld",
+           (WIFEXITED(status) ? WEXITSTATUS(status) : -1), peakRss(1));
+    if ((allocsFile = fopen(allocsPath, "r")) != NULL) {
+        gotAllocs = fscanf(allocsFile,
+                           "{\"allocs\": %lu, \"reallocs\": %lu, "
+                           "\"frees\": %lu, \"allocBytes\": %lu}",
+                           &counts[0], &counts[1], &counts[2],
+                           &counts[3]) == 4;
+        fclose(allocsFile);
+        allocs.allocs = counts[0];
+        allocs.reallocs = counts[1];
+        allocs.frees = counts[2];
+        allocs.bytes = counts[3];
+    }
+    /* a command not built with allocount.o doesn't report any */
+    if (gotAllocs)
+        printAllocs(&allocs);
+    printf("}\n");
+    unlink(allocsPath);
+    free(args);
+}
+
+int main(int argc, char *argv[]) {
+    const char *usagestr =
+        "Usage:\n\tfwbench stages [-b backend] [-n num] [-j threads] "
+        "[-l label] corpus\n"
+        "\tfwbench run [-l label] [-m name] corpus command ...\n"
+        "Options:\n\t-b\tBackend to count with. Defaults to auto.\n\t-n\t"
+        "Number of top words to pick. Defaults to 10.\n\t-j\tThreads to pick "
+        "the top words with. Defaults to 1.\n\t-l\tWhat to call "
+        "the corpus in the results. Defaults to its file name.\n\t-m\tWhat "
+        "to call the run in the results. Defaults to the command.\n"
+        "\tcommand\tRun with the corpus added as its last argument.";
+    extern char *optarg;
+    extern int optind, optopt;
+    int c, n = DEFAULT_N, backend = AUTOBACKEND, isRun, numThreads = 1;
+    const char *name = NULL;
+    Corpus corpus;
+
+    if (argc < 2 ||
+        (strcmp(argv[1], "stages") != 0 && strcmp(argv[1], "run") != 0))
+        error(1, 0, "Expected stages or run.\n\n%s", usagestr);
+    isRun = (strcmp(argv[1], "run") == 0);
+    argc--;
+    argv++;
+    corpus.label = NULL;
+    corpus.words = 0;
+    /* + stops at the corpus so the command's options are left alone */
+    while ((c = getopt(argc, argv, "+:b:n:j:l:m:")) != -1) {
+        switch (c) {
+        case 'b':
+            backend = parseCountBackend(optarg);
+            if (backend == -1)
+                error(1, 0, "Unknown backend `%s'.\n\n%s", optarg, usagestr);
+            break;
+        case 'n':
+            n = atoi(optarg);
+            break;
+        case 'j':
+            numThreads = atoi(optarg);
+            if (numThreads < 1)
+                error(1, 0, "Option -j requires at least one thread.\n\n%s",
+                      usagestr);
+            break;
+        case 'l':
+            corpus.label = optarg;
+            break;
+        case 'm':
+            name = optarg;
+            break;
+        case '?':
+            error(1, 0, "Unknown option `-%c'.\n\n%s", optopt, usagestr);
+            break;
+        default:
+            error(1, 0, "Option -%c requires an argument.\n\n%s", optopt,
+                  usagestr);
+        }
+    }
+    if (optind == argc || (isRun && optind + 1 == argc))
+        error(1, 0, "Missing arguments.\n\n%s", usagestr);
+    corpus.fileName = argv[optind];
+    if (corpus.label == NULL)
+        corpus.label = corpus.fileName;
+
+    if (isRun)
+        benchRun(&corpus, (name != NULL ? name : argv[optind + 1]),
+                 argv + optind + 1, argc - optind - 1);
+    else
+        benchStages(&corpus, backend, n, numThreads);
+    return 0;
+}
@@ -0,0 +1,280 @@
+#include <errno.h>
+#include <error.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * writes a synthetic corpus for benchmarking fw to stdout.
+ * word ranks are drawn from a Zipf distribution over a fixed
+ * vocabulary, and everything comes from a seeded generator so the same
+ * arguments always give the same bytes
+ */
+
+#define DEFAULT_SIZE (1 << 20)
+#define DEFAULT_DISTINCT 100000
+#define DEFAULT_EXPONENT 1.0
+#define DEFAULT_WORDLEN 6
+#define DEFAULT_SEED 1
+/* about this many words to a line */
+#define WORDSPERLINE 12
+#define OUTBUFSIZE (1 << 16)
+/* odd and not a multiple of 13 so it shuffles every power of 26 */
+#define RANKSHUFFLE 1000003
+
+int getopt(int argc, char *const argv[], const char *options);
+
+/* splitmix64, small and good enough to not show up in the counts */
+static uint64_t nextRandom(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* uniform in [0, 1) */
+static double nextUniform(uint64_t *state) {
+    return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* every word in the vocabulary one after another, most common first */
+struct Vocabulary {
+    char *strings;
+    size_t *offsets; /* word i is strings[offsets[i]..offsets[i + 1]) */
+    /* Walker's alias table: pick i uniformly then keep it with chance
+     * keep[i] or take alias[i] instead, so every pick is O(1) */
+    double *keep;
+    size_t *alias;
+    size_t numWords;
+};
+typedef struct Vocabulary Vocabulary;
+
+/*
+ * every word starts with its rank written as digits letters long in
+ * base 26 (shuffled so neighbouring ranks don't look alike), which
+ * keeps them all different. they are then padded out with random
+ * letters to a length uniform in 1 to 2 * wordLen - 1
+ */
+static Vocabulary *buildVocabulary(size_t numWords, double exponent,
+                                   int wordLen, uint64_t seed) {
+    Vocabulary *vocab = (Vocabulary *)calloc(1, sizeof(Vocabulary));
+    uint64_t state = seed, code, space = 1;
+    size_t i, len, cap, used = 0, numSmall = 0, numLarge = 0;
+    size_t *small, *large;
+    double sum = 0;
+    int digits = 0, d, padTo;
+
+    if (vocab == NULL)
+        error(1, errno, "Failed to allocate vocabulary");
+    while (space < numWords) {
+        space *= 26;
+        digits++;
+    }
+    if (digits == 0)
+        digits = 1;
+    cap = numWords * (digits + 2 * wordLen);
+    vocab->numWords = numWords;
+    vocab->strings = (char *)malloc(cap);
+    vocab->offsets = (size_t *)malloc((numWords + 1) * sizeof(size_t));
+    vocab->keep = (double *)malloc(numWords * sizeof(double));
+    vocab->alias = (size_t *)malloc(numWords * sizeof(size_t));
+    small = (size_t *)malloc(numWords * sizeof(size_t));
+    large = (size_t *)malloc(numWords * sizeof(size_t));
+    if (vocab->strings == NULL || vocab->offsets == NULL ||
+        vocab->keep == NULL || vocab->alias == NULL || small == NULL ||
+        large == NULL)
+        error(1, errno, "Failed to allocate vocabulary");
+
+    for (i = 0; i < numWords; i++) {
+        vocab->offsets[i] = used;
+        code = (uint64_t)i * RANKSHUFFLE % (space > 1 ? space : 26);
+        for (d = 0; d < digits; d++) {
+            vocab->strings[used++] = 'a' + code % 26;
+            code /= 26;
+        }
+        padTo = 1 + nextRandom(&state) % (2 * wordLen - 1);
+        for (len = digits; len < (size_t)padTo; len++)
+            vocab->strings[used++] = 'a' + nextRandom(&state) % 26;
+
+        vocab->keep[i] = 1.0 / pow((double)(i + 1), exponent);
+        sum += vocab->keep[i];
+    }
+    vocab->offsets[numWords] = used;
+
+    /* scaled so the average is 1, every word under it is topped up
+     * from one over it (Vose) */
+    for (i = 0; i < numWords; i++) {
+        vocab->keep[i] *= numWords / sum;
+        vocab->alias[i] = i;
+        if (vocab->keep[i] < 1)
+            small[numSmall++] = i;
+        else
+            large[numLarge++] = i;
+    }
+    while (numSmall > 0 && numLarge > 0) {
+        i = small[--numSmall];
+        vocab->alias[i] = large[numLarge - 1];
+        vocab->keep[vocab->alias[i]] -= 1 - vocab->keep[i];
+        if (vocab->keep[vocab->alias[i]] < 1) {
+            numLarge--;
+            small[numSmall++] = vocab->alias[i];
+        }
+    }
+    /* whatever is left is 1 give or take rounding */
+    while (numLarge > 0)
+        vocab->keep[large[--numLarge]] = 1;
+    while (numSmall > 0)
+        vocab->keep[small[--numSmall]] = 1;
+    free(small);
+    free(large);
+    return vocab;
+}
+
+/* the rank of a random word */
+static size_t pickWord(const Vocabulary *vocab, uint64_t *state) {
+    double u = nextUniform(state) * vocab->numWords;
+    size_t i = (size_t)u;
+    return (u - i < vocab->keep[i] ? i : vocab->alias[i]);
+}
+
+static void freeVocabulary(Vocabulary *vocab) {
+    free(vocab->strings);
+    free(vocab->offsets);
+    free(vocab->keep);
+    free(vocab->alias);
+    free(vocab);
+}
+
+/*
+ * writes exactly size bytes of words. the end is padded with
+ * newlines so the last word is always followed by one and gets counted
+ */
+static void writeCorpus(const Vocabulary *vocab, uint64_t size,
+                        uint64_t seed) {
+    char *buf = (char *)malloc(OUTBUFSIZE);
+    uint64_t state = seed ^ 0x5bd1e995ULL, written = 0;
+    size_t rank, len, used = 0;
+
+    if (buf == NULL)
+        error(1, errno, "Failed to allocate output buffer");
+    while (1) {
+        rank = pickWord(vocab, &state);
+        len = vocab->offsets[rank + 1] - vocab->offsets[rank];
+        if (written + used + len + 1 > size)
+            break;
+        if (used + len + 1 > OUTBUFSIZE) {
+            if (fwrite(buf, 1, used, stdout) != used)
+                error(1, errno, "Failed to write corpus");
+            written += used;
+            used = 0;
+        }
+        memcpy(buf + used, vocab->strings + vocab->offsets[rank], len);
+        used += len;
+        buf[used++] = (nextRandom(&state) % WORDSPERLINE == 0 ? '\n' : ' ');
+    }
+    while (written + used < size) {
+        if (used == OUTBUFSIZE) {
+            if (fwrite(buf, 1, used, stdout) != used)
+                error(1, errno, "Failed to write corpus");
+            written += used;
+            used = 0;
+        }
+        buf[used++] = '\n';
+    }
+    if (fwrite(buf, 1, used, stdout) != used || fflush(stdout) != 0)
+        error(1, errno, "Failed to write corpus");
+    free(buf);
+}
+
+/* parses a size with an optional K, M or G (powers of 1024) after it */
+static uint64_t parseSize(const char *val, const char *usagestr) {
+    char *tail;
+    double num;
+    errno = 0;
+    num = strtod(val, &tail);
+    if (errno || num < 0)
+        error(1, errno, "Bad size `%s'.\n\n%s", val, usagestr);
+    switch (*tail) {
+    case 'G':
+    case 'g':
+        num *= 1024;
+        /* fall through */
+    case 'M':
+    case 'm':
+        num *= 1024;
+        /* fall through */
+    case 'K':
+    case 'k':
+        num *= 1024;
+        tail++;
+        break;
+    }
+    if (*tail != '\0')
+        error(1, 0, "Bad size `%s'.\n\n%s", val, usagestr);
+    return (uint64_t)num;
+}
+
+int main(int argc, char *argv[]) {
+    const char *usagestr =
+        "Usage:\n\tgencorpus [-s size] [-d distinct] [-z exponent] "
+        "[-l length] [-r seed]\n"
+        "Options:\n\t-s\tBytes to write, K, M or G can follow. Defaults to "
+        "1M.\n\t-d\tNumber of different words. Defaults to 100000.\n\t-z\t"
+        "Zipf exponent, higher makes the common words more common. "
+        "Defaults to 1.\n\t-l\tAverage word length. Defaults to 6, words "
+        "get longer if there are too many to tell apart.\n\t-r\tSeed. "
+        "Defaults to 1.";
+    extern char *optarg;
+    extern int optopt;
+    uint64_t size = DEFAULT_SIZE, seed = DEFAULT_SEED;
+    long distinct = DEFAULT_DISTINCT, wordLen = DEFAULT_WORDLEN;
+    double exponent = DEFAULT_EXPONENT;
+    Vocabulary *vocab;
+    char *tail;
+    int c;
+
+    while ((c = getopt(argc, argv, ":s:d:z:l:r:")) != -1) {
+        errno = 0;
+        switch (c) {
+        case 's':
+            size = parseSize(optarg, usagestr);
+            break;
+        case 'd':
+            distinct = strtol(optarg, &tail, 0);
+            if (errno || *tail != '\0' || distinct < 1)
+                error(1, 0, "Option -d requires a positive integer.\n\n%s",
+                      usagestr);
+            break;
+        case 'z':
+            exponent = strtod(optarg, &tail);
+            if (errno || *tail != '\0' || exponent < 0)
+                error(1, 0, "Option -z requires a non-negative number.\n\n%s",
+                      usagestr);
+            break;
+        case 'l':
+            wordLen = strtol(optarg, &tail, 0);
+            if (errno || *tail != '\0' || wordLen < 1)
+                error(1, 0, "Option -l requires a positive integer.\n\n%s",
+                      usagestr);
+            break;
+        case 'r':
+            seed = strtoul(optarg, &tail, 0);
+            if (errno || *tail != '\0')
+                error(1, 0, "Option -r requires an integer.\n\n%s", usagestr);
+            break;
+        case '?':
+            error(1, 0, "Unknown option `-%c'.\n\n%s", optopt, usagestr);
+            break;
+        default:
+            error(1, 0, "Option -%c requires an argument.\n\n%s", optopt,
+                  usagestr);
+        }
+    }
+
+    vocab = buildVocabulary(distinct, exponent, wordLen, seed);
+    writeCorpus(vocab, size, seed);
+    freeVocabulary(vocab);
+    return 0;
+}
@@ -0,0 +1,348 @@
+#include "hashtable.h"
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASHMUL1 0x9E3779B97F4A7C15ULL
+#define HASHMUL2 0xC2B2AE3D27D4EB4FULL
+
+static uint64_t load64(const char *bytes) {
+    uint64_t v;
+    memcpy(&v, bytes, 8);
+    return v;
+}
+
+static uint64_t load32(const char *bytes) {
+    uint32_t v;
+    memcpy(&v, bytes, 4);
+    return v;
+}
+
+/*
+ * hashes 8 bytes at a time. the last few bytes are loaded as
+ * overlapping pieces rather than one at a time. the result only has
+ * to be the same within a run so byte order doesn't matter
+ */
+uint64_t hashWord(const char *word, size_t wordLen) {
+    const unsigned char *bytes;
+    uint64_t hash = wordLen * HASHMUL1, tail;
+
+    for (; wordLen >= 8; word += 8, wordLen -= 8) {
+        hash = (hash ^ load64(word)) * HASHMUL2;
+        hash ^= hash >> 32;
+    }
+    if (wordLen > 0) {
+        bytes = (const unsigned char *)word;
+        if (wordLen >= 4)
+            tail = load32(word) | load32(word + wordLen - 4) << 32;
+        else
+            tail = (uint64_t)bytes[0] | (uint64_t)bytes[wordLen / 2] << 8 |
+                   (uint64_t)bytes[wordLen - 1] << 16;
+        hash = (hash ^ tail) * HASHMUL2;
+    }
+    hash ^= hash >> 29;
+    hash *= HASHMUL1;
+    return hash ^ (hash >> 32);
+}
+
+/* grows a table of block pointers so it can hold at least one more block */
+static void *growBlockTable(void *blocks, unsigned int *cap, size_t ptrSize) {
+    *cap = (*cap == 0 ? 8 : *cap * 2);
+    blocks = realloc(blocks, *cap * ptrSize);
+    if (blocks == NULL)
+        error(1, errno, "Failed to grow hash table block table");
+    return blocks;
+}
+
+/*
+ * hands out a deleted word if there is one, otherwise the next word
+ * in the arena, starting a new block if needed
+ */
+static HashIndex allocHashWord(HashTable *table) {
+    HashIndex index = table->numWords;
+    unsigned int block = index >> HASHBLOCKBITS;
+    HashWord *entry;
+
+    if (table->freeWord != HASHEMPTY) {
+        index = table->freeWord;
+        entry = getHashWord(table, index);
+        table->freeWord = entry->hash;
+        table->numFree--;
+        entry->count = 0;
+        return index;
+    }
+    if ((index & (HASHBLOCKSIZE - 1)) == 0) {
+        if (block == table->wordBlocksCap)
+            table->wordBlocks = (HashWord **)growBlockTable(
+                table->wordBlocks, &table->wordBlocksCap, sizeof(HashWord *));
+        table->wordBlocks[block] =
+            (HashWord *)malloc(HASHBLOCKSIZE * sizeof(HashWord));
+        if (table->wordBlocks[block] == NULL)
+            error(1, errno, "Failed to allocate hash table words");
+    }
+    table->numWords++;
+
+    entry = getHashWord(table, index);
+    entry->count = 0;
+    return index;
+}
+
+/*
+ * copies a word into the string pool. a word too long for what is
+ * left of the current block gets a new block (of its own if need be)
+ */
+static const char *poolWord(HashTable *table, const char *word,
+                            size_t wordLen) {
+    char *copy;
+    size_t blockSize;
+
+    if (table->numPoolBlocks == 0 ||
+        table->poolUsed + wordLen > HASHPOOLSIZE) {
+        if (table->numPoolBlocks == table->poolBlocksCap)
+            table->poolBlocks = (char **)growBlockTable(
+                table->poolBlocks, &table->poolBlocksCap, sizeof(char *));
+        blockSize = (wordLen > HASHPOOLSIZE ? wordLen : HASHPOOLSIZE);
+        table->poolBlocks[table->numPoolBlocks] = (char *)malloc(blockSize);
+        if (table->poolBlocks[table->numPoolBlocks] == NULL)
+            error(1, errno, "Failed to allocate hash table strings");
+        table->numPoolBlocks++;
+        table->poolUsed = 0;
+    }
+    copy = table->poolBlocks[table->numPoolBlocks - 1] + table->poolUsed;
+    memcpy(copy, word, wordLen);
+    table->poolUsed += wordLen;
+    return copy;
+}
+
+static HashSlot *allocHashSlots(unsigned int numSlots) {
+    HashSlot *slots = (HashSlot *)calloc(numSlots, sizeof(HashSlot));
+    if (slots == NULL)
+        error(1, errno, "Failed to allocate hash table slots");
+    return slots;
+}
+
+HashTable *constructHashTable(void) {
+    HashTable *table = (HashTable *)calloc(1, sizeof(HashTable));
+    if (table == NULL)
+        error(1, errno, "Failed to allocate hash table");
+    table->slots = allocHashSlots(HASHMINSLOTS);
+    table->mask = HASHMINSLOTS - 1;
+    /* word 0 marks empty slots */
+    allocHashWord(table);
+    return table;
+}
+
+/*
+ * puts slot in the table starting at i, a known free or poorer spot
+ * for it, bumping richer slots further along as robin hood does
+ */
+static void placeHashSlot(HashTable *table, HashSlot slot, unsigned int i) {
+    HashSlot *slots = table->slots, bumped;
+    unsigned int mask = table->mask, dist, slotDist;
+
+    dist = (i - slot.hash) & mask;
+    while (slots[i].word != HASHEMPTY) {
+        slotDist = (i - slots[i].hash) & mask;
+        if (slotDist < dist) {
+            bumped = slots[i];
+            slots[i] = slot;
+            slot = bumped;
+            dist = slotDist;
+        }
+        i = (i + 1) & mask;
+        dist++;
+    }
+    slots[i] = slot;
+}
+
+/* doubles the number of slots. the hashes are kept so no word is rehashed */
+static void growHashTable(HashTable *table) {
+    HashSlot *old = table->slots;
+    unsigned int oldSlots = table->mask + 1, i;
+
+    table->slots = allocHashSlots(oldSlots * 2);
+    table->mask = oldSlots * 2 - 1;
+    for (i = 0; i < oldSlots; i++) {
+        if (old[i].word != HASHEMPTY)
+            placeHashSlot(table, old[i], old[i].hash & table->mask);
+    }
+    free(old);
+}
+
+/*
+ * finds or adds the word with the given hash in a single probe.
+ * robin hood keeps every word at most as far from home as anything
+ * it passes, so running into a slot closer to its home than we are
+ * to ours means the word isn't there and this is where it goes
+ */
+static HashIndex insertHashedWord(HashTable *table, uint32_t hash,
+                                  const char *word, size_t wordLen) {
+    HashSlot *slots = table->slots, slot;
+    unsigned int mask = table->mask, i = hash & mask, dist = 0;
+    HashWord *entry;
+
+    while (slots[i].word != HASHEMPTY) {
+        if (slots[i].hash == hash) {
+            entry = getHashWord(table, slots[i].word);
+            if (entry->wordLen == wordLen &&
+                memcmp(entry->word, word, wordLen) == 0)
+                return slots[i].word;
+        }
+        if (((i - slots[i].hash) & mask) < dist)
+            break;
+        i = (i + 1) & mask;
+        dist++;
+    }
+
+    slot.hash = hash;
+    slot.word = allocHashWord(table);
+    entry = getHashWord(table, slot.word);
+    entry->hash = hash;
+    entry->wordLen = wordLen;
+    entry->word = poolWord(table, word, wordLen);
+    table->liveBytes += wordLen;
+    placeHashSlot(table, slot, i);
+
+    /* keep the table at most 7/8 full */
+    if ((size_t)(table->numWords - 1 - table->numFree) * 8 >=
+        (size_t)(table->mask + 1) * 7)
+        growHashTable(table);
+    return slot.word;
+}
+
+HashIndex insertHashWord(HashTable *table, const char *word, size_t wordLen) {
+    return insertHashedWord(table, (uint32_t)(hashWord(word, wordLen) >> 32),
+                            word, wordLen);
+}
+
+/*
+ * copies the strings of the words that are left into new pool blocks
+ * and frees the old ones
+ */
+static void compactHashPool(HashTable *table) {
+    char **old = table->poolBlocks;
+    unsigned int numOld = table->numPoolBlocks, i;
+    HashWord *entry;
+
+    table->poolBlocks = NULL;
+    table->numPoolBlocks = table->poolBlocksCap = 0;
+    table->poolUsed = 0;
+    for (i = 1; i < table->numWords; i++) {
+        entry = getHashWord(table, i);
+        if (entry->word != NULL)
+            entry->word = poolWord(table, entry->word, entry->wordLen);
+    }
+    table->deadBytes = 0;
+    for (i = 0; i < numOld; i++)
+        free(old[i]);
+    free(old);
+}
+
+/*
+ * empties the word's slot and shifts the slots after it back one
+ * until one is home or empty, so no probe ever needs a tombstone
+ */
+void deleteHashWord(HashTable *table, HashIndex index) {
+    HashSlot *slots = table->slots;
+    HashWord *entry = getHashWord(table, index);
+    unsigned int mask = table->mask, i = entry->hash & mask, next;
+
+    while (slots[i].word != index)
+        i = (i + 1) & mask;
+    for (next = (i + 1) & mask;
+         slots[next].word != HASHEMPTY &&
+         ((next - slots[next].hash) & mask) != 0;
+         next = (next + 1) & mask) {
+        slots[i] = slots[next];
+        i = next;
+    }
+    slots[i].word = HASHEMPTY;
+
+    table->liveBytes -= entry->wordLen;
+    table->deadBytes += entry->wordLen;
+    entry->count = 0;
+    entry->word = NULL;
+    entry->hash = table->freeWord;
+    table->freeWord = index;
+    table->numFree++;
+
+    if (table->deadBytes >= HASHPOOLSIZE &&
+        table->deadBytes > table->liveBytes)
+        compactHashPool(table);
+}
+
+HashIndex findHashWord(const HashTable *table, const char *word,
+                       size_t wordLen) {
+    uint32_t hash = (uint32_t)(hashWord(word, wordLen) >> 32);
+    const HashSlot *slots = table->slots;
+    unsigned int mask = table->mask, i = hash & mask, dist = 0;
+    const HashWord *entry;
+
+    /* the same probe as inserting, stopping where it would have gone */
+    while (slots[i].word != HASHEMPTY) {
+        if (slots[i].hash == hash) {
+            entry = getHashWord(table, slots[i].word);
+            if (entry->wordLen == wordLen &&
+                memcmp(entry->word, word, wordLen) == 0)
+                return slots[i].word;
+        }
+        if (((i - slots[i].hash) & mask) < dist)
+            break;
+        i = (i + 1) & mask;
+        dist++;
+    }
+    return HASHEMPTY;
+}
+
+void forEachHashWord(HashTable *table,
+                     void (*visit)(void *ctx, HashIndex index, HashWord *entry,
+                                   const char *word, size_t wordLen),
+                     void *ctx) {
+    HashWord *entry;
+    HashIndex i;
+
+    for (i = 1; i < table->numWords; i++) {
+        entry = getHashWord(table, i);
+        if (entry->count > 0)
+            visit(ctx, i, entry, entry->word, entry->wordLen);
+    }
+}
+
+void mergeHashTable(HashTable *into, HashTable *from) {
+    HashWord *entry;
+    HashIndex i, index;
+
+    for (i = 1; i < from->numWords; i++) {
+        entry = getHashWord(from, i);
+        if (entry->count == 0)
+            continue;
+        index =
+            insertHashedWord(into, entry->hash, entry->word, entry->wordLen);
+        getHashWord(into, index)->count += entry->count;
+    }
+}
+
+size_t getHashTableBytes(const HashTable *table) {
+    size_t wordBlocks =
+        (table->numWords + HASHBLOCKSIZE - 1) >> HASHBLOCKBITS;
+    return sizeof(HashTable) + (table->mask + (size_t)1) * sizeof(HashSlot) +
+           table->wordBlocksCap * sizeof(HashWord *) +
+           table->poolBlocksCap * sizeof(char *) +
+           wordBlocks * HASHBLOCKSIZE * sizeof(HashWord) +
+           table->numPoolBlocks * (size_t)HASHPOOLSIZE;
+}
+
+void freeHashTable(HashTable *table) {
+    unsigned int i;
+    if (table == NULL)
+        return;
+    for (i = 0; i * HASHBLOCKSIZE < table->numWords; i++)
+        free(table->wordBlocks[i]);
+    for (i = 0; i < table->numPoolBlocks; i++)
+        free(table->poolBlocks[i]);
+    free(table->wordBlocks);
+    free(table->poolBlocks);
+    free(table->slots);
+    free(table);
+}
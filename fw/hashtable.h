@@ -0,0 +1,119 @@
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * index of a word in a HashTable's word arena.
+ * word 0 is never handed out so an index of 0 in a slot means
+ * the slot is empty
+ */
+typedef unsigned int HashIndex;
+
+#define HASHEMPTY 0
+/* words are handed out from blocks of 2^bits */
+#define HASHBLOCKBITS 16
+#define HASHBLOCKSIZE (1 << HASHBLOCKBITS)
+/* the word strings are bump allocated from blocks this big */
+#define HASHPOOLSIZE (1 << 20)
+#define HASHMINSLOTS 1024
+
+/*
+ * a distinct word and its count. a word keeps its index until it is
+ * deleted, after which the index is handed out again. its string can
+ * move when the pool is compacted
+ */
+struct HashWord {
+    int count;
+    uint32_t hash;
+    unsigned int wordLen;
+    const char *word; /* in the string pool, not null terminated */
+};
+typedef struct HashWord HashWord;
+
+/*
+ * a slot in the table. the low bits of hash give the slot the word
+ * wants to be in, which is all robin hood needs to work out how far
+ * any slot's word has been pushed from home
+ */
+struct HashSlot {
+    uint32_t hash;
+    HashIndex word;
+};
+typedef struct HashSlot HashSlot;
+
+/*
+ * open addressing (robin hood) hash table of words.
+ * the slots are a flat array of (hash, index) pairs so a probe only
+ * touches one cache line until the hashes match. the words themselves
+ * live in blocks like the trie's nodes and their strings are copied
+ * once into a bump allocated pool
+ */
+struct HashTable {
+    HashSlot *slots;
+    unsigned int mask; /* number of slots - 1 */
+    unsigned int numWords; /* including the unused word 0 */
+    HashWord **wordBlocks;
+    unsigned int wordBlocksCap;
+    HashIndex freeWord; /* deleted words, linked through their hash */
+    unsigned int numFree;
+    char **poolBlocks;
+    unsigned int numPoolBlocks;
+    unsigned int poolBlocksCap;
+    size_t poolUsed; /* bytes used in the last pool block */
+    size_t liveBytes; /* bytes of the pool the words still use */
+    size_t deadBytes; /* and those left behind by deleted words */
+};
+typedef struct HashTable HashTable;
+
+/* looks up a word by index. index must have come from this table */
+#define getHashWord(table, index)                                             \
+    (&(table)->wordBlocks[(index) >> HASHBLOCKBITS]                           \
+                         [(index) & (HASHBLOCKSIZE - 1)])
+
+/*
+ * hashes a word. the top 32 bits are what the table uses
+ * and every bit is mixed well enough to split further
+ */
+uint64_t hashWord(const char *word, size_t wordLen);
+
+/* hash table constructor */
+HashTable *constructHashTable(void);
+
+/* returns the word's index adding it with a count of 0 if it is new */
+HashIndex insertHashWord(HashTable *table, const char *word, size_t wordLen);
+
+/* returns the word's index or HASHEMPTY if it isn't in the table */
+HashIndex findHashWord(const HashTable *table, const char *word,
+                       size_t wordLen);
+
+/*
+ * takes a word out of the table. its index is handed out again and
+ * once the deleted words' strings take up more of the pool than the
+ * rest do the pool is compacted
+ */
+void deleteHashWord(HashTable *table, HashIndex index);
+
+/*
+ * calls visit for every word in the table with a count in the
+ * order they were first added along with its index.
+ * the word is not null terminated and only valid during the call
+ */
+void forEachHashWord(HashTable *table,
+                     void (*visit)(void *ctx, HashIndex index, HashWord *entry,
+                                   const char *word, size_t wordLen),
+                     void *ctx);
+
+/* adds every word and count in from to into. from is left as is */
+void mergeHashTable(HashTable *into, HashTable *from);
+
+/*
+ * how many bytes the table's slots, blocks and pool take up. a word too
+ * long for a pool block got one its own size, which counts as a block
+ */
+size_t getHashTableBytes(const HashTable *table);
+
+/* frees every block the table owns along with the table itself */
+void freeHashTable(HashTable *table);
+
+#endif /* HASHTABLE_H */
@@ -0,0 +1,37 @@
+#!/usr/bin/env python3
+#
+# prints the case folding runs in utf8.c from the Unicode data python
+# was built with: ./mkcasefold.py
+#
+# a code point folds to what casefold() gives if that is a single code
+# point (Unicode's C and S foldings), otherwise to lower() if that is
+# one, otherwise it stays as is. code points that fold by the same
+# amount one or two apart are put in one run
+
+import unicodedata
+
+
+def fold(cp):
+    c = chr(cp)
+    for folded in (c.casefold(), c.lower()):
+        if len(folded) == 1:
+            return ord(folded)
+    return cp
+
+
+runs = []
+for cp in range(0x80, 0x110000):
+    if 0xD800 <= cp < 0xE000 or fold(cp) == cp:
+        continue
+    delta = fold(cp) - cp
+    if runs and runs[-1][2] == delta:
+        first, last, _, stride = runs[-1]
+        if (stride == 0 and cp - last in (1, 2)) or cp - last == stride:
+            runs[-1] = [first, cp, delta, cp - first if stride == 0 else stride]
+            continue
+    runs.append([cp, cp, delta, 0])
+
+print("/* generated by mkcasefold.py from Unicode %s */" %
+      unicodedata.unidata_version)
+for first, last, delta, stride in runs:
+    print("    {0x%04X, 0x%04X, %d, %d}," % (first, last, delta, max(stride, 1)))
@@ -0,0 +1,283 @@
+#include "ngram.h"
+#include "stats.h"
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+#include <string.h>
+
+GramCounts *constructGramCounts(int gramLen) {
+    GramCounts *grams = (GramCounts *)calloc(1, sizeof(GramCounts));
+    if (grams == NULL)
+        error(1, errno, "Failed to allocate gram counts");
+    grams->gramLen = gramLen;
+    grams->slots = (HashSlot *)calloc(GRAMMINSLOTS, sizeof(HashSlot));
+    grams->mask = GRAMMINSLOTS - 1;
+    grams->recent = (WordId *)malloc(gramLen * sizeof(WordId));
+    if (grams->slots == NULL || grams->recent == NULL)
+        error(1, errno, "Failed to allocate gram counts");
+    return grams;
+}
+
+/* doubles the slots once they are 3/4 full, using the kept hashes */
+static void growGramSlots(GramCounts *grams) {
+    unsigned int numSlots = (grams->mask + 1) * 2, i, j;
+    HashSlot *slots;
+
+    if (grams->numGrams < (grams->mask + 1) / 4 * 3)
+        return;
+    slots = (HashSlot *)calloc(numSlots, sizeof(HashSlot));
+    if (slots == NULL)
+        error(1, errno, "Failed to grow gram table");
+    for (i = 0; i <= grams->mask; i++) {
+        if (grams->slots[i].word == HASHEMPTY)
+            continue;
+        j = grams->slots[i].hash & (numSlots - 1);
+        while (slots[j].word != HASHEMPTY)
+            j = (j + 1) & (numSlots - 1);
+        slots[j] = grams->slots[i];
+    }
+    free(grams->slots);
+    grams->slots = slots;
+    grams->mask = numSlots - 1;
+}
+
+/* gives the gram in recent an index, adding it with a count of 0 if new */
+static unsigned int insertGram(GramCounts *grams) {
+    size_t idsLen = grams->gramLen * sizeof(WordId);
+    uint32_t hash = hashWord((const char *)grams->recent, idsLen) >> 32;
+    unsigned int i = hash & grams->mask, gram;
+
+    while (grams->slots[i].word != HASHEMPTY) {
+        gram = grams->slots[i].word - 1;
+        if (grams->slots[i].hash == hash &&
+            memcmp(&grams->ids[(size_t)gram * grams->gramLen], grams->recent,
+                   idsLen) == 0)
+            return gram;
+        i = (i + 1) & grams->mask;
+    }
+
+    if (grams->numGrams == grams->gramsCap) {
+        grams->gramsCap = (grams->gramsCap == 0 ? 1024 : grams->gramsCap * 2);
+        grams->ids = (WordId *)realloc(grams->ids, (size_t)grams->gramsCap *
+                                                       idsLen);
+        grams->counts =
+            (int *)realloc(grams->counts, grams->gramsCap * sizeof(int));
+        if (grams->ids == NULL || grams->counts == NULL)
+            error(1, errno, "Failed to grow gram counts");
+    }
+    gram = grams->numGrams++;
+    memcpy(&grams->ids[(size_t)gram * grams->gramLen], grams->recent, idsLen);
+    grams->counts[gram] = 0;
+    grams->slots[i].hash = hash;
+    grams->slots[i].word = gram + 1;
+    growGramSlots(grams);
+    return gram;
+}
+
+void countGramWord(GramCounts *grams, const char *word, size_t wordLen) {
+    WordId id = addWordId(grams->words, word, wordLen);
+    unsigned int gram;
+
+    if (id > grams->maxId)
+        grams->maxId = id;
+    if (grams->numRecent == grams->gramLen) {
+        memmove(grams->recent, grams->recent + 1,
+                (grams->gramLen - 1) * sizeof(WordId));
+        grams->numRecent--;
+    }
+    grams->recent[grams->numRecent++] = id;
+    /* insertGram can move counts so it has to go first */
+    if (grams->numRecent == grams->gramLen) {
+        gram = insertGram(grams);
+        grams->counts[gram]++;
+    }
+}
+
+/* a word of one of the grams that could make the top */
+struct GramName {
+    WordId id;
+    unsigned int wordLen;
+    size_t offset; /* of the word in the names' strings */
+};
+typedef struct GramName GramName;
+
+/* the words needed to print the grams, found in one walk of the words */
+struct GramNames {
+    unsigned char *wanted; /* bitmap by WordId */
+    GramName *names;
+    size_t numNames;
+    size_t namesCap;
+    char *strings;
+    size_t stringsLen;
+    size_t stringsCap;
+};
+typedef struct GramNames GramNames;
+
+static void visitGramName(void *ctx, WordId id, const char *word,
+                          size_t wordLen) {
+    GramNames *names = (GramNames *)ctx;
+    GramName *name;
+
+    if (!(names->wanted[id / 8] & (1 << id % 8)))
+        return;
+    if (names->numNames == names->namesCap) {
+        names->namesCap = (names->namesCap == 0 ? 64 : names->namesCap * 2);
+        names->names = (GramName *)realloc(
+            names->names, names->namesCap * sizeof(GramName));
+        if (names->names == NULL)
+            error(1, errno, "Failed to grow gram names");
+    }
+    if (names->stringsLen + wordLen > names->stringsCap) {
+        names->stringsCap = (names->stringsLen + wordLen) * 2;
+        names->strings = (char *)realloc(names->strings, names->stringsCap);
+        if (names->strings == NULL)
+            error(1, errno, "Failed to grow gram names");
+    }
+    name = &names->names[names->numNames++];
+    name->id = id;
+    name->wordLen = wordLen;
+    name->offset = names->stringsLen;
+    memcpy(names->strings + names->stringsLen, word, wordLen);
+    names->stringsLen += wordLen;
+}
+
+static int compGramNames(const void *a, const void *b) {
+    WordId aId = ((const GramName *)a)->id, bId = ((const GramName *)b)->id;
+    return (aId > bId) - (aId < bId);
+}
+
+/* the name for id, which has to have been wanted */
+static const GramName *findGramName(const GramNames *names, WordId id) {
+    GramName key;
+    key.id = id;
+    return (const GramName *)bsearch(&key, names->names, names->numNames,
+                                     sizeof(GramName), compGramNames);
+}
+
+/* min heap of counts for finding the nth highest */
+static void siftDownCounts(int *heap, int len, int i) {
+    int kid, lowest, tmp;
+    while (1) {
+        lowest = i;
+        kid = 2 * i + 1;
+        if (kid < len && heap[kid] < heap[lowest])
+            lowest = kid;
+        kid++;
+        if (kid < len && heap[kid] < heap[lowest])
+            lowest = kid;
+        if (lowest == i)
+            break;
+        tmp = heap[i];
+        heap[i] = heap[lowest];
+        heap[lowest] = tmp;
+        i = lowest;
+    }
+}
+
+/*
+ * the count a gram needs to have a chance at the top n. anything
+ * below the nth highest count can't make it and everything at or
+ * above it might, depending on how the ties go
+ */
+static int gramCutoff(const GramCounts *grams, int n) {
+    unsigned int gram;
+    int *heap, cutoff, i;
+
+    if (n == 0)
+        return -1;
+    if (grams->numGrams <= (unsigned int)n)
+        return 0;
+    heap = (int *)malloc(n * sizeof(int));
+    if (heap == NULL)
+        error(1, errno, "Failed to allocate gram cutoff");
+    memcpy(heap, grams->counts, n * sizeof(int));
+    for (i = n / 2 - 1; i >= 0; i--)
+        siftDownCounts(heap, n, i);
+    for (gram = n; gram < grams->numGrams; gram++) {
+        if (grams->counts[gram] > heap[0]) {
+            heap[0] = grams->counts[gram];
+            siftDownCounts(heap, n, 0);
+        }
+    }
+    cutoff = heap[0];
+    free(heap);
+    return cutoff;
+}
+
+TopWords *topGrams(GramCounts *grams, int n) {
+    TopWords *top = constructTopWords(n);
+    const GramName *name;
+    GramNames names;
+    char *text = NULL;
+    size_t textLen, textCap = 0;
+    unsigned int gram;
+    int cutoff = gramCutoff(grams, n), i;
+    WordId *ids;
+
+    memset(&names, 0, sizeof(names));
+    names.wanted = (unsigned char *)calloc(grams->maxId / 8 + 1, 1);
+    if (names.wanted == NULL)
+        error(1, errno, "Failed to allocate gram names");
+    for (gram = 0; cutoff >= 0 && gram < grams->numGrams; gram++) {
+        if (grams->counts[gram] < cutoff)
+            continue;
+        ids = &grams->ids[(size_t)gram * grams->gramLen];
+        for (i = 0; i < grams->gramLen; i++)
+            names.wanted[ids[i] / 8] |= 1 << ids[i] % 8;
+    }
+    forEachWordId(grams->words, visitGramName, &names);
+    if (names.numNames > 0)
+        qsort(names.names, names.numNames, sizeof(GramName), compGramNames);
+
+    for (gram = 0; cutoff >= 0 && gram < grams->numGrams; gram++) {
+        if (grams->counts[gram] < cutoff)
+            continue;
+        ids = &grams->ids[(size_t)gram * grams->gramLen];
+        textLen = 0;
+        for (i = 0; i < grams->gramLen; i++) {
+            name = findGramName(&names, ids[i]);
+            if (textLen + name->wordLen + 1 > textCap) {
+                textCap = (textLen + name->wordLen + 1) * 2;
+                text = (char *)realloc(text, textCap);
+                if (text == NULL)
+                    error(1, errno, "Failed to allocate gram");
+            }
+            if (i > 0)
+                text[textLen++] = GRAMSEPARATOR;
+            memcpy(text + textLen, names.strings + name->offset,
+                   name->wordLen);
+            textLen += name->wordLen;
+        }
+        /* every gram comes once with its final count */
+        updateTopWords(top, grams->counts[gram], NULL, text, textLen);
+    }
+    sortTopWords(top);
+    top->total = grams->numGrams;
+
+    free(text);
+    free(names.wanted);
+    free(names.names);
+    free(names.strings);
+    return top;
+}
+
+void addGramCountsStats(GramCounts *grams) {
+    addWordCountsStats(grams->words);
+    STATSMEMORY(GRAMMEMORY,
+                sizeof(GramCounts) +
+                    (size_t)grams->gramsCap * grams->gramLen * sizeof(WordId) +
+                    grams->gramsCap * sizeof(int) +
+                    (grams->mask + (size_t)1) * sizeof(HashSlot) +
+                    grams->gramLen * sizeof(WordId));
+}
+
+void freeGramCounts(GramCounts *grams) {
+    if (grams == NULL)
+        return;
+    freeWordCounts(grams->words);
+    free(grams->ids);
+    free(grams->counts);
+    free(grams->slots);
+    free(grams->recent);
+    free(grams);
+}
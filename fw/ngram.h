@@ -0,0 +1,66 @@
+#ifndef NGRAM_H
+#define NGRAM_H
+#include "counts.h"
+#include "hashtable.h"
+#include "topwords.h"
+#include <stddef.h>
+
+/* the gram table starts with this many slots */
+#define GRAMMINSLOTS 1024
+/* what the words of a gram are joined with when printed */
+#define GRAMSEPARATOR ' '
+
+/*
+ * counts of every run of gramLen words in a row (n-grams).
+ * the words themselves go in words like always and a gram is only the
+ * ids of its words (see WordId), so a gram costs the same however long
+ * its words are and no string is copied per word read. grams are found
+ * through an open addressing table of HashSlots keyed by a hash of the
+ * ids that, like the HashTable, keeps the hashes so growing it doesn't
+ * need any rehashing.
+ * like words, grams carry on from one file into the next
+ */
+struct GramCounts {
+    WordCounts *words;
+    int gramLen;
+    WordId *ids; /* gram i is the gramLen ids from ids[i * gramLen] */
+    int *counts;
+    unsigned int numGrams;
+    unsigned int gramsCap;
+    HashSlot *slots; /* a slot's word is its gram's index + 1 */
+    unsigned int mask;
+    WordId *recent; /* ids of the last gramLen words read, oldest first */
+    int numRecent;
+    WordId maxId;
+};
+typedef struct GramCounts GramCounts;
+
+/*
+ * gram counts constructor for grams gramLen words long.
+ * words is left NULL for the caller to construct with whichever
+ * backend it picks before the first word is counted
+ */
+GramCounts *constructGramCounts(int gramLen);
+
+/* counts the word and the gram it ends, once there are enough words */
+void countGramWord(GramCounts *grams, const char *word, size_t wordLen);
+
+/*
+ * picks the n highest ranked grams sorted the same way sortTopWords
+ * does, each printed as its words joined by GRAMSEPARATOR, with total
+ * set to the number of different grams.
+ * only the grams that could make it have their words looked up, which
+ * takes one walk of the words
+ */
+TopWords *topGrams(GramCounts *grams, int n);
+
+/*
+ * adds what the grams and their words hold to the --stats totals
+ * (see stats.h). nothing happens in builds without them
+ */
+void addGramCountsStats(GramCounts *grams);
+
+/* frees the grams along with their words */
+void freeGramCounts(GramCounts *grams);
+
+#endif /* NGRAM_H */
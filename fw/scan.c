@@ -0,0 +1,392 @@
+#include "scan.h"
+#include "utf8.h"
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define ctz64(bits) __builtin_ctzll(bits)
+
+/* the same characters isgraph and isupper accept in the C locale */
+#define isWordByte(c) ((c) >= 0x21 && (c) <= 0x7e)
+#define isUpperByte(c) ((c) >= 'A' && (c) <= 'Z')
+
+#define setBit(bitmap, i) ((bitmap)[(i) >> 6] |= (uint64_t)1 << ((i)&63))
+
+static ScanMode scanMode = BYTESCAN;
+static const WordFilter *scanFilter = NULL;
+
+void setScanMode(ScanMode mode) { scanMode = mode; }
+
+ScanMode getScanMode(void) { return scanMode; }
+
+void setScanFilter(const WordFilter *filter) { scanFilter = filter; }
+
+const WordFilter *getScanFilter(void) { return scanFilter; }
+
+Scanner *constructScanner(void (*emit)(void *ctx, const char *word,
+                                       size_t wordLen),
+                          void *ctx) {
+    Scanner *scanner = (Scanner *)calloc(1, sizeof(Scanner));
+    if (scanner == NULL)
+        error(1, errno, "Failed to allocate scanner");
+    scanner->emit = emit;
+    scanner->ctx = ctx;
+    scanner->mode = scanMode;
+    scanner->filter = scanFilter;
+    scanner->window = (unsigned char *)malloc(SCANWINDOW * 2);
+    /* a code point carried over from the last window can add a few
+     * more bytes than the 3/2 folding grows the rest by */
+    scanner->bitmap = (uint64_t *)malloc(SCANWINDOW * 2 / 8 + 8);
+    if (scanner->window == NULL || scanner->bitmap == NULL)
+        error(1, errno, "Failed to allocate scanner");
+    resetScanner(scanner, 0);
+    return scanner;
+}
+
+void resetScanner(Scanner *scanner, int keepHead) {
+    free(scanner->head);
+    scanner->head = NULL;
+    scanner->headLen = 0;
+    scanner->keepHead = keepHead;
+    scanner->sawBreak = 0;
+    scanner->carryLen = 0;
+    scanner->utf8State = UTF8ACCEPT;
+    /* an empty word is "in progress" so a break right at the start
+     * still ends the (empty) head */
+    scanner->inWord = 1;
+}
+
+/*
+ * lowercases len bytes of src into dst and sets bit i of the bitmap
+ * when src[i] is a word character. lowercasing never changes whether
+ * a byte is a word character so both come out of one pass.
+ * returns non zero if any of the bytes were past ASCII
+ */
+static uint64_t foldWindow(const unsigned char *src, unsigned char *dst,
+                           uint64_t *bitmap, size_t len) {
+    size_t i = 0, j;
+    uint64_t bits, high = 0;
+    unsigned char c;
+#if defined(__AVX2__)
+    /* shifting the ranges down to -128 turns both range checks into a
+     * single signed compare */
+    const __m256i upperShift = _mm256_set1_epi8((char)(0x80 - 'A'));
+    const __m256i upperLimit = _mm256_set1_epi8((char)(-128 + 26));
+    const __m256i graphShift = _mm256_set1_epi8((char)(0x80 - 0x21));
+    const __m256i graphLimit = _mm256_set1_epi8((char)(-128 + 0x7e - 0x20));
+    const __m256i caseBit = _mm256_set1_epi8(0x20);
+    __m256i v, upper, graph;
+
+    for (; i + 64 <= len; i += 64) {
+        bits = 0;
+        for (j = 0; j < 64; j += 32) {
+            v = _mm256_loadu_si256((const __m256i *)(src + i + j));
+            upper = _mm256_cmpgt_epi8(upperLimit,
+                                      _mm256_add_epi8(v, upperShift));
+            graph = _mm256_cmpgt_epi8(graphLimit,
+                                      _mm256_add_epi8(v, graphShift));
+            _mm256_storeu_si256(
+                (__m256i *)(dst + i + j),
+                _mm256_or_si256(v, _mm256_and_si256(upper, caseBit)));
+            bits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(graph) << j;
+            high |= (uint32_t)_mm256_movemask_epi8(v);
+        }
+        bitmap[i >> 6] = bits;
+    }
+#elif defined(__SSE2__)
+    const __m128i upperShift = _mm_set1_epi8((char)(0x80 - 'A'));
+    const __m128i upperLimit = _mm_set1_epi8((char)(-128 + 26));
+    const __m128i graphShift = _mm_set1_epi8((char)(0x80 - 0x21));
+    const __m128i graphLimit = _mm_set1_epi8((char)(-128 + 0x7e - 0x20));
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    __m128i v, upper, graph;
+
+    for (; i + 64 <= len; i += 64) {
+        bits = 0;
+        for (j = 0; j < 64; j += 16) {
+            v = _mm_loadu_si128((const __m128i *)(src + i + j));
+            upper = _mm_cmplt_epi8(_mm_add_epi8(v, upperShift), upperLimit);
+            graph = _mm_cmplt_epi8(_mm_add_epi8(v, graphShift), graphLimit);
+            _mm_storeu_si128((__m128i *)(dst + i + j),
+                             _mm_or_si128(v, _mm_and_si128(upper, caseBit)));
+            bits |= (uint64_t)(uint16_t)_mm_movemask_epi8(graph) << j;
+            high |= (uint16_t)_mm_movemask_epi8(v);
+        }
+        bitmap[i >> 6] = bits;
+    }
+#endif
+    /* whatever is left (or everything without SIMD) a byte at a time */
+    for (; i < len; i += 64) {
+        bits = 0;
+        for (j = 0; j < 64 && i + j < len; j++) {
+            c = src[i + j];
+            high |= c & 0x80;
+            if (isUpperByte(c))
+                c |= 0x20;
+            dst[i + j] = c;
+            if (isWordByte(c))
+                bits |= (uint64_t)1 << j;
+        }
+        bitmap[i >> 6] = bits;
+    }
+    return high;
+}
+
+/*
+ * decodes len bytes of src as UTF-8 into the scanner's window, case
+ * folded, setting the bitmap for every byte of every word character.
+ * returns how long the folded text is (less than 2 * len + 64).
+ * a bad sequence becomes a single break, and a byte that couldn't
+ * continue a sequence gets another go at starting one
+ */
+static size_t foldUtf8Window(Scanner *scanner, const unsigned char *src,
+                             size_t len) {
+    unsigned char *dst = scanner->window;
+    uint64_t *bitmap = scanner->bitmap;
+    unsigned int state = scanner->utf8State, cls;
+    uint32_t cp = scanner->codePoint;
+    size_t i = 0, out = 0;
+    unsigned char c;
+    int n, isWord;
+
+    memset(bitmap, 0, (len / 32 + 1) * sizeof(uint64_t));
+    while (i < len) {
+        c = src[i];
+        if (state == UTF8ACCEPT && c < 0x80) {
+            if (isUpperByte(c))
+                c |= 0x20;
+            if (isWordByte(c))
+                setBit(bitmap, out);
+            dst[out++] = c;
+            i++;
+            continue;
+        }
+        cls = utf8ByteClasses[c];
+        cp = (state == UTF8ACCEPT ? c & utf8LeadMasks[cls]
+                                  : cp << 6 | (c & 0x3f));
+        if (utf8Transitions[state][cls] == UTF8REJECT) {
+            dst[out++] = ' ';
+            if (state == UTF8ACCEPT)
+                i++;
+            state = UTF8ACCEPT;
+            continue;
+        }
+        state = utf8Transitions[state][cls];
+        i++;
+        if (state != UTF8ACCEPT)
+            continue;
+        isWord = !isBreakCodePoint(cp);
+        n = encodeUtf8(foldCodePoint(cp), dst + out);
+        for (; isWord && n > 0; n--, out++)
+            setBit(bitmap, out);
+        out += n;
+    }
+    scanner->utf8State = state;
+    scanner->codePoint = cp;
+    return out;
+}
+
+/*
+ * returns the first position at or after i whose bit is set
+ * (or clear if want is 0), or len if there isn't one
+ */
+static size_t findBit(const uint64_t *bitmap, size_t i, size_t len,
+                      int want) {
+    uint64_t bits;
+    while (i < len) {
+        bits = bitmap[i >> 6];
+        if (!want)
+            bits = ~bits;
+        bits >>= (i & 63);
+        if (bits != 0) {
+            i += ctz64(bits);
+            return (i < len ? i : len);
+        }
+        i = (i | 63) + 1;
+    }
+    return len;
+}
+
+static void appendCarry(Scanner *scanner, const unsigned char *piece,
+                        size_t len) {
+    if (len == 0)
+        return;
+    if (scanner->carryLen + len > scanner->carryCap) {
+        scanner->carryCap = (scanner->carryLen + len) * 2;
+        scanner->carry = (char *)realloc(scanner->carry, scanner->carryCap);
+        if (scanner->carry == NULL)
+            error(1, errno, "Failed to grow word");
+    }
+    memcpy(scanner->carry + scanner->carryLen, piece, len);
+    scanner->carryLen += len;
+}
+
+/* a break was found right after piece, so whatever word it ends is done */
+static void finishWord(Scanner *scanner, const unsigned char *piece,
+                       size_t len) {
+    const char *word = (const char *)piece;
+    size_t wordLen = len;
+
+    /* only words that started in an earlier window get copied */
+    if (scanner->carryLen > 0) {
+        appendCarry(scanner, piece, len);
+        word = scanner->carry;
+        wordLen = scanner->carryLen;
+    }
+    if (scanner->keepHead && !scanner->sawBreak) {
+        scanner->head = (char *)malloc(wordLen + 1);
+        if (scanner->head == NULL)
+            error(1, errno, "Failed to copy word");
+        memcpy(scanner->head, word, wordLen);
+        scanner->head[wordLen] = '\0';
+        scanner->headLen = wordLen;
+    } else if (wordLen > 0) {
+        STATSCOUNT(scanner->stats, WORDSREAD, 1);
+        if (scanner->filter == NULL ||
+            keepFilteredWord(scanner->filter, word, wordLen))
+            scanner->emit(scanner->ctx, word, wordLen);
+    }
+    scanner->carryLen = 0;
+    scanner->sawBreak = 1;
+}
+
+/* finds the words in the first len bytes of the folded window */
+static void scanWindow(Scanner *scanner, size_t len) {
+    size_t i = 0, end;
+    while (i < len) {
+        if (scanner->inWord) {
+            end = findBit(scanner->bitmap, i, len, 0);
+            if (end == len) {
+                appendCarry(scanner, scanner->window + i, len - i);
+                return;
+            }
+            finishWord(scanner, scanner->window + i, end - i);
+            scanner->inWord = 0;
+            i = end;
+        } else {
+            i = findBit(scanner->bitmap, i, len, 1);
+            if (i < len)
+                scanner->inWord = 1;
+        }
+    }
+}
+
+void scanBytes(Scanner *scanner, const unsigned char *bytes, size_t len) {
+    size_t n, folded;
+    uint64_t high;
+    STATSCOUNT(scanner->stats, BYTESREAD, len);
+    while (len > 0) {
+        n = (len < SCANWINDOW ? len : SCANWINDOW);
+        STATSMARK(scanner->stats);
+        high = foldWindow(bytes, scanner->window, scanner->bitmap, n);
+        folded = n;
+        /* all ASCII with no code point left over is already done */
+        if (scanner->mode == UTF8SCAN &&
+            (high != 0 || scanner->utf8State != UTF8ACCEPT))
+            folded = foldUtf8Window(scanner, bytes, n);
+        STATSLAP(scanner->stats, TOKENIZEPHASE);
+        scanWindow(scanner, folded);
+        STATSLAP(scanner->stats, INSERTPHASE);
+        bytes += n;
+        len -= n;
+    }
+}
+
+/* reads fd from where it is until EOF or limit bytes, whichever is first */
+static void scanRead(Scanner *scanner, int fd, off_t limit) {
+    unsigned char *buf = (unsigned char *)malloc(SCANWINDOW);
+    ssize_t got;
+    size_t want;
+
+    if (buf == NULL)
+        error(1, errno, "Failed to allocate read buffer");
+    while (limit != 0) {
+        want = SCANWINDOW;
+        if (limit > 0 && (off_t)want > limit)
+            want = limit;
+        STATSMARK(scanner->stats);
+        got = read(fd, buf, want);
+        STATSLAP(scanner->stats, READPHASE);
+        /* same as fgetc, a read error ends the file */
+        if (got <= 0)
+            break;
+        scanBytes(scanner, buf, got);
+        if (limit > 0)
+            limit -= got;
+    }
+    free(buf);
+}
+
+void finishInput(Scanner *scanner) {
+    if (scanner->utf8State == UTF8ACCEPT)
+        return;
+    scanner->utf8State = UTF8ACCEPT;
+    scanner->window[0] = ' ';
+    scanner->bitmap[0] = 0;
+    scanWindow(scanner, 1);
+}
+
+void scanStream(Scanner *scanner, int fd) {
+    scanRead(scanner, fd, -1);
+    finishInput(scanner);
+}
+
+int scanFile(Scanner *scanner, const char *path, off_t start, off_t end) {
+    struct stat st;
+    unsigned char *map;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return -1;
+    /* files in /proc and the like claim to be empty regular files */
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        scanStream(scanner, fd);
+        close(fd);
+        return 0;
+    }
+
+    if (end == -1 || end > st.st_size)
+        end = st.st_size;
+    if (start < end) {
+        STATSMARK(scanner->stats);
+        map = (unsigned char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                                    fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            STATSLAP(scanner->stats, READPHASE);
+            scanBytes(scanner, map + start, end - start);
+            STATSMARK(scanner->stats);
+            munmap(map, st.st_size);
+            STATSLAP(scanner->stats, READPHASE);
+        } else if (lseek(fd, start, SEEK_SET) != -1) {
+            /* some files (e.g. in /proc) can't be mapped */
+            scanRead(scanner, fd, end - start);
+        }
+    }
+    finishInput(scanner);
+    close(fd);
+    return 0;
+}
+
+void freeScanner(Scanner *scanner) {
+    if (scanner == NULL)
+        return;
+    STATSSCANNER(scanner->stats, sizeof(Scanner) + SCANWINDOW * 2 +
+                                     SCANWINDOW * 2 / 8 + 8 +
+                                     scanner->carryCap);
+    free(scanner->head);
+    free(scanner->carry);
+    free(scanner->window);
+    free(scanner->bitmap);
+    free(scanner);
+}
@@ -0,0 +1,124 @@
+#ifndef SCAN_H
+#define SCAN_H
+#include "filter.h"
+#include "stats.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* bytes folded and classified at a time. must be a multiple of 64 */
+#define SCANWINDOW (1 << 16)
+
+/*
+ * how bytes are split into words.
+ * BYTESCAN is fw's original definition below. UTF8SCAN decodes UTF-8
+ * with every code point that isn't a space or control (see utf8.h)
+ * part of a word and case folded. ASCII is split the same way in both
+ * and invalid UTF-8 ends words like bytes past ASCII always have
+ */
+enum ScanMode { BYTESCAN, UTF8SCAN };
+typedef enum ScanMode ScanMode;
+
+/*
+ * splits bytes into words the way fw always has: a word is a run of
+ * isgraph characters with letters lowercased, ended by anything else.
+ *
+ * the bytes are looked at a window at a time. each window is lowercased
+ * into a scratch copy while building a bitmap of which bytes are word
+ * characters, 16 or 32 bytes per instruction where SSE2/AVX2 is there.
+ * words are then found a bitmap word at a time and handed to emit as
+ * spans of the window, so nothing is copied per character.
+ *
+ * a word that runs off the end of a window (or file) is kept in carry
+ * and finished by whatever is scanned next. like the original fgetc
+ * loop a word is only emitted once something that isn't part of a
+ * word follows it, so a word at the very end of the input is dropped
+ * and one at the end of a file continues into the next file. with a
+ * filter, words are checked against it before they are emitted so
+ * the ones it turns away never get any further.
+ *
+ * in UTF8SCAN mode a window that is all ASCII (which the SIMD pass
+ * finds out on the way) is done exactly the same. any other window is
+ * decoded again by the UTF-8 decoder a byte at a time into window,
+ * which is twice SCANWINDOW since folding can make text longer. a code
+ * point split between windows is carried over in the decoder state
+ */
+struct Scanner {
+    /* called for every word. word is only valid during the call */
+    void (*emit)(void *ctx, const char *word, size_t wordLen);
+    void *ctx;
+    /*
+     * if set everything before the first break is kept in head rather
+     * than emitted since it may be the end of a word from before
+     */
+    int keepHead;
+    int sawBreak;
+    int inWord; /* whether the last byte scanned was part of a word */
+    ScanMode mode;
+    /* words it turns away are never emitted. NULL keeps everything */
+    const WordFilter *filter;
+    unsigned char utf8State; /* Utf8State at the end of the last window */
+    uint32_t codePoint;      /* so far if utf8State is in the middle of one */
+    char *head;
+    size_t headLen;
+    char *carry;
+    size_t carryLen;
+    size_t carryCap;
+    unsigned char *window;
+    uint64_t *bitmap;
+    /* only there in builds with FWSTATS (see stats.h) */
+    STATSONLY(ScanStats stats;)
+};
+typedef struct Scanner Scanner;
+
+/*
+ * sets the mode of every scanner constructed after this. fw picks it
+ * once before counting starts so every thread scans the same way
+ */
+void setScanMode(ScanMode mode);
+
+ScanMode getScanMode(void);
+
+/*
+ * sets the filter of every scanner constructed after this, which must
+ * stay around as long as they do. like the mode it is picked once
+ * before counting starts
+ */
+void setScanFilter(const WordFilter *filter);
+
+const WordFilter *getScanFilter(void);
+
+/* scanner constructor. ctx is passed along to every call to emit */
+Scanner *constructScanner(void (*emit)(void *ctx, const char *word,
+                                       size_t wordLen),
+                          void *ctx);
+
+/* forgets any partial word, head and break so the scanner can start over */
+void resetScanner(Scanner *scanner, int keepHead);
+
+/* scans len bytes continuing from wherever the last call left off */
+void scanBytes(Scanner *scanner, const unsigned char *bytes, size_t len);
+
+/*
+ * scans bytes [start, end) of the file at path, or up to the end of
+ * the file if end is -1. regular files are memory mapped, anything else
+ * is read in SCANWINDOW sized pieces from the start (start is ignored).
+ * a read error ends the file like EOF does.
+ * returns -1 with errno set if the file couldn't be opened
+ */
+int scanFile(Scanner *scanner, const char *path, off_t start, off_t end);
+
+/* reads fd until EOF scanning as it goes */
+void scanStream(Scanner *scanner, int fd);
+
+/*
+ * ends an input scanned with scanBytes, which scanFile and scanStream
+ * do themselves. a code point can't carry on into another file (or
+ * shard, which always starts on one) so one cut short is a bad
+ * sequence like any other. nothing happens in BYTESCAN mode
+ */
+void finishInput(Scanner *scanner);
+
+void freeScanner(Scanner *scanner);
+
+#endif /* SCAN_H */
@@ -0,0 +1,331 @@
+#include "selection.h"
+#include <errno.h>
+#include <error.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* a selection thread's slice of the ids and what it found in it */
+struct SelectWorker {
+    pthread_t thread;
+    WordCounts *counts;
+    WordId first;
+    WordId last; /* one past the end of the slice */
+    int n;
+    int *best; /* the highest counts in the slice, n of them at the end */
+    int numBest;
+    int total;
+    int cutoff; /* what a word needs to make the top, once it is known */
+    WordId *ties; /* ids of words with the cutoff count */
+    int numTies; /* how many there were, even past maxTies */
+    int maxTies;
+    int addTies; /* whether to add the tied words rather than note them */
+    TopWords *topWords;
+};
+typedef struct SelectWorker SelectWorker;
+
+static int medianOfThree(int a, int b, int c) {
+    if (a < b)
+        return (b < c ? b : (a < c ? c : a));
+    return (a < c ? a : (b < c ? c : b));
+}
+
+/*
+ * rearranges counts so the k highest come first, in no particular
+ * order, like nth_element with a greater than compare. 0 < k < len
+ */
+static void partitionCounts(int *counts, int len, int k) {
+    int lo = 0, hi = len - 1, i, j, pivot, tmp;
+
+    while (lo < hi) {
+        pivot = medianOfThree(counts[lo], counts[lo + (hi - lo) / 2],
+                              counts[hi]);
+        i = lo;
+        j = hi;
+        while (i <= j) {
+            while (counts[i] > pivot)
+                i++;
+            while (counts[j] < pivot)
+                j--;
+            if (i <= j) {
+                tmp = counts[i];
+                counts[i++] = counts[j];
+                counts[j--] = tmp;
+            }
+        }
+        /* [lo, j] are all >= pivot, [i, hi] all <= pivot and anything
+         * in between is the pivot, so only one side can hold the kth */
+        if (k - 1 <= j)
+            hi = j;
+        else if (k - 1 >= i)
+            lo = i;
+        else
+            break;
+    }
+}
+
+static int lowestCount(const int *counts, int len) {
+    int lowest = INT_MAX, i;
+    for (i = 0; i < len; i++) {
+        if (counts[i] < lowest)
+            lowest = counts[i];
+    }
+    return lowest;
+}
+
+/*
+ * the first pass: counts the words in the slice and finds its n highest
+ * counts. best holds twice n (or a chunk's worth) and is cut back to n
+ * whenever it fills, after which nothing at or below the lowest of
+ * those n can change what the nth highest is
+ */
+static void *findBestCounts(void *arg) {
+    SelectWorker *worker = (SelectWorker *)arg;
+    int cap = (worker->n * 2 > SELECTCHUNK ? worker->n * 2 : SELECTCHUNK);
+    int *chunk = (int *)malloc(SELECTCHUNK * sizeof(int));
+    int floor = (worker->n == 0 ? INT_MAX : 0);
+    size_t num, i;
+    WordId id;
+
+    worker->best = (int *)malloc(cap * sizeof(int));
+    if (chunk == NULL || worker->best == NULL)
+        error(1, errno, "Failed to allocate selection");
+    for (id = worker->first; id < worker->last; id += num) {
+        num = worker->last - id;
+        if (num > SELECTCHUNK)
+            num = SELECTCHUNK;
+        getWordIdCounts(worker->counts, id, num, chunk);
+        for (i = 0; i < num; i++) {
+            if (chunk[i] == 0)
+                continue;
+            worker->total++;
+            if (chunk[i] <= floor)
+                continue;
+            if (worker->numBest == cap) {
+                partitionCounts(worker->best, cap, worker->n);
+                worker->numBest = worker->n;
+                floor = lowestCount(worker->best, worker->n);
+                if (chunk[i] <= floor)
+                    continue;
+            }
+            worker->best[worker->numBest++] = chunk[i];
+        }
+    }
+    if (worker->numBest > worker->n) {
+        partitionCounts(worker->best, worker->numBest, worker->n);
+        worker->numBest = worker->n;
+    }
+    free(chunk);
+    return NULL;
+}
+
+/* adds the word with id and count to top if it ranks high enough */
+static void addSelectedWord(WordCounts *counts, TopWords *top, WordId id,
+                            int count, char **buf, size_t *bufCap) {
+    const char *word;
+    size_t wordLen;
+
+    /* most can be turned away on count before their word is read */
+    if (top->len == top->n && (uint64_t)count < top->heap[0].count)
+        return;
+    word = getWordIdWord(counts, id, &wordLen, buf, bufCap);
+    /* every word comes once with its final count */
+    updateTopWords(top, count, NULL, word, wordLen);
+}
+
+/*
+ * the second pass: keeps the words of the slice above the cutoff count,
+ * of which there are fewer than n, and notes the ids of the ones on it.
+ * there can be any number of those (every word has a count of 1 in some
+ * logs) so past maxTies they are only counted and left for later.
+ * with addTies set it goes over the slice again adding just those
+ */
+static void *pickTopWords(void *arg) {
+    SelectWorker *worker = (SelectWorker *)arg;
+    int *chunk = (int *)malloc(SELECTCHUNK * sizeof(int));
+    char *buf = NULL;
+    size_t num, i, bufCap = 0;
+    WordId id;
+
+    if (worker->topWords == NULL)
+        worker->topWords = constructTopWords(worker->n);
+    if (chunk == NULL)
+        error(1, errno, "Failed to allocate selection");
+    for (id = worker->first; id < worker->last; id += num) {
+        num = worker->last - id;
+        if (num > SELECTCHUNK)
+            num = SELECTCHUNK;
+        getWordIdCounts(worker->counts, id, num, chunk);
+        for (i = 0; i < num; i++) {
+            if (chunk[i] < worker->cutoff ||
+                (worker->addTies && chunk[i] != worker->cutoff))
+                continue;
+            if (chunk[i] == worker->cutoff && !worker->addTies) {
+                if (worker->numTies < worker->maxTies)
+                    worker->ties[worker->numTies] = id + i;
+                worker->numTies++;
+                continue;
+            }
+            addSelectedWord(worker->counts, worker->topWords, id + i,
+                            chunk[i], &buf, &bufCap);
+        }
+    }
+    free(buf);
+    free(chunk);
+    return NULL;
+}
+
+/* what picking the best of the words tied on the cutoff in order needs */
+struct TieWalk {
+    TopWords *topWords;
+    int cutoff;
+    int needed;
+};
+typedef struct TieWalk TieWalk;
+
+/* words come best first so the first needed ones on the cutoff win */
+static int visitTiedWord(void *ctx, WordId id, int count, const char *word,
+                         size_t wordLen) {
+    TieWalk *walk = (TieWalk *)ctx;
+    (void)id;
+    if (count != walk->cutoff)
+        return 0;
+    updateTopWords(walk->topWords, count, NULL, word, wordLen);
+    return --walk->needed == 0;
+}
+
+/* runs every worker at once, or just on this thread if there's one */
+static void runSelectWorkers(SelectWorker *workers, int numWorkers,
+                             void *(*run)(void *)) {
+    int i;
+    if (numWorkers == 1) {
+        run(&workers[0]);
+        return;
+    }
+    for (i = 0; i < numWorkers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, run, &workers[i]) != 0)
+            error(1, errno, "Failed to start selection thread");
+    }
+    for (i = 0; i < numWorkers; i++)
+        pthread_join(workers[i].thread, NULL);
+}
+
+/*
+ * adds the words tied on the cutoff to topWords. if every worker kept
+ * all of theirs that's just looking them up. otherwise, as only the
+ * best of them are needed to fill up the top n, they are taken from a
+ * walk in rank order that stops there. if the counts can't be walked
+ * in order the workers go over their slices again adding every one
+ */
+static void addSelectedTies(WordCounts *counts, TopWords *topWords,
+                            SelectWorker *workers, int numWorkers,
+                            int cutoff) {
+    char *buf = NULL;
+    size_t bufCap = 0;
+    TieWalk walk;
+    int i, j, overflowed = 0;
+
+    walk.topWords = topWords;
+    walk.cutoff = cutoff;
+    walk.needed = topWords->n;
+    for (i = 0; i < numWorkers; i++) {
+        overflowed |= workers[i].numTies > workers[i].maxTies;
+        walk.needed -= workers[i].topWords->len;
+    }
+    if (!overflowed) {
+        for (i = 0; i < numWorkers; i++) {
+            for (j = 0; j < workers[i].numTies; j++)
+                addSelectedWord(counts, topWords, workers[i].ties[j], cutoff,
+                                &buf, &bufCap);
+        }
+        free(buf);
+        return;
+    }
+    if (forEachWordIdDescending(counts, visitTiedWord, &walk))
+        return;
+    for (i = 0; i < numWorkers; i++)
+        workers[i].addTies = 1;
+    runSelectWorkers(workers, numWorkers, pickTopWords);
+}
+
+/*
+ * the count the nth highest ranked word has, out of every slice's n
+ * highest. 1 (every word) if there aren't n words
+ */
+static int findCutoff(SelectWorker *workers, int numWorkers, int n) {
+    int *all, len = 0, cutoff, i;
+
+    for (i = 0; i < numWorkers; i++)
+        len += workers[i].numBest;
+    if (len < n)
+        return 1;
+    all = (int *)malloc(len * sizeof(int));
+    if (all == NULL)
+        error(1, errno, "Failed to allocate selection");
+    len = 0;
+    for (i = 0; i < numWorkers; i++) {
+        memcpy(all + len, workers[i].best, workers[i].numBest * sizeof(int));
+        len += workers[i].numBest;
+    }
+    if (len > n)
+        partitionCounts(all, len, n);
+    cutoff = lowestCount(all, n);
+    free(all);
+    return cutoff;
+}
+
+TopWords *selectTopWords(WordCounts *counts, int n, int numThreads) {
+    TopWords *topWords = constructTopWords(n), *top;
+    WordId limit = getWordIdLimit(counts);
+    SelectWorker *workers;
+    int numWorkers = numThreads, cutoff, i, j;
+
+    /* not worth a thread for less than a chunk each */
+    if ((WordId)numWorkers > limit / SELECTCHUNK)
+        numWorkers = limit / SELECTCHUNK;
+    if (numWorkers < 1)
+        numWorkers = 1;
+    workers = (SelectWorker *)calloc(numWorkers, sizeof(SelectWorker));
+    if (workers == NULL)
+        error(1, errno, "Failed to allocate selection");
+    for (i = 0; i < numWorkers; i++) {
+        workers[i].counts = counts;
+        workers[i].first = (WordId)((size_t)limit * i / numWorkers);
+        workers[i].last =
+            (WordId)((size_t)limit * (i + 1) / numWorkers);
+        workers[i].n = n;
+    }
+
+    runSelectWorkers(workers, numWorkers, findBestCounts);
+    topWords->total = 0;
+    for (i = 0; i < numWorkers; i++)
+        topWords->total += workers[i].total;
+    if (n > 0) {
+        cutoff = findCutoff(workers, numWorkers, n);
+        for (i = 0; i < numWorkers; i++) {
+            workers[i].cutoff = cutoff;
+            workers[i].maxTies = SELECTCHUNK + 2 * n;
+            workers[i].ties =
+                (WordId *)malloc(workers[i].maxTies * sizeof(WordId));
+            if (workers[i].ties == NULL)
+                error(1, errno, "Failed to allocate selection");
+        }
+        runSelectWorkers(workers, numWorkers, pickTopWords);
+        addSelectedTies(counts, topWords, workers, numWorkers, cutoff);
+        for (i = 0; i < numWorkers; i++) {
+            top = workers[i].topWords;
+            for (j = 0; j < top->len; j++)
+                updateTopWords(topWords, top->heap[j].count, NULL,
+                               top->heap[j].word, top->heap[j].wordLen);
+            freeTopWords(top);
+            free(workers[i].ties);
+        }
+    }
+    sortTopWords(topWords);
+
+    for (i = 0; i < numWorkers; i++)
+        free(workers[i].best);
+    free(workers);
+    return topWords;
+}
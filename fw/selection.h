@@ -0,0 +1,25 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+#include "counts.h"
+#include "topwords.h"
+
+/* how many ids a selection thread reads the counts of at a time */
+#define SELECTCHUNK 4096
+
+/*
+ * picks the n highest ranked words out of finished counts, the same
+ * words in the same order as passing every word through updateTopWords
+ * would, with total set to the number of different words.
+ *
+ * the ids are split into numThreads slices. first every thread finds
+ * the n highest counts in its slice by partitioning (nth_element style)
+ * a buffer of counts whenever it fills, and the nth highest of all of
+ * theirs is the count a word needs to make the top. then every thread
+ * looks up the words of its slice at or above that count and keeps its
+ * own top words, and those are merged. only the counts are read for
+ * every word so the time goes on a linear pass over the counts rather
+ * than on the strings
+ */
+TopWords *selectTopWords(WordCounts *counts, int n, int numThreads);
+
+#endif /* SELECTION_H */
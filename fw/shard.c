@@ -0,0 +1,332 @@
+#include "shard.h"
+#include "scan.h"
+#include "selection.h"
+#include "stats.h"
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* shards shared between the workers. next is the next one to hand out */
+struct ShardQueue {
+    Shard *shards;
+    int numShards;
+    int next;
+    pthread_mutex_t lock;
+};
+typedef struct ShardQueue ShardQueue;
+
+/* a counting thread and everything it owns */
+struct ShardWorker {
+    pthread_t thread;
+    ShardQueue *queue;
+    WordCounts *counts;
+    Scanner *scanner;
+};
+typedef struct ShardWorker ShardWorker;
+
+/* two sets of counts to merge in one round of the parallel merge */
+struct CountsMerge {
+    pthread_t thread;
+    WordCounts *into;
+    WordCounts *from;
+};
+typedef struct CountsMerge CountsMerge;
+
+static char *copyFragment(const char *word, size_t wordLen) {
+    char *copy = (char *)malloc(wordLen + 1);
+    if (copy == NULL)
+        error(1, errno, "Failed to copy word");
+    if (wordLen > 0)
+        memcpy(copy, word, wordLen);
+    copy[wordLen] = '\0';
+    return copy;
+}
+
+/* appends a fragment to a growing buffer */
+static void appendFragment(char **buf, size_t *len, size_t *cap,
+                           const char *frag, size_t fragLen) {
+    if (fragLen == 0)
+        return;
+    if (*len + fragLen + 1 > *cap) {
+        *cap = (*len + fragLen + 1) * 2;
+        *buf = (char *)realloc(*buf, *cap);
+        if (*buf == NULL)
+            error(1, errno, "Failed to grow word");
+    }
+    memcpy(*buf + *len, frag, fragLen);
+    *len += fragLen;
+}
+
+/* called by a worker's scanner for every word inside a shard */
+static void countShardWord(void *ctx, const char *word, size_t wordLen) {
+    ShardWorker *worker = (ShardWorker *)ctx;
+    addWordCounts(worker->counts, word, wordLen, 1);
+}
+
+/* counts every word that starts and ends inside the shard */
+static void countShard(ShardWorker *worker, Shard *shard) {
+    Scanner *scanner = worker->scanner;
+
+    /* the head may belong to a word from an earlier shard */
+    resetScanner(scanner, 1);
+    if (scanFile(scanner, shard->fileName, shard->start, shard->end) == -1) {
+        fprintf(stderr, "%s: Failed to open file \"%s\"... %s\n", "fw",
+                shard->fileName, strerror(errno));
+    }
+    shard->hasBreak = scanner->sawBreak;
+    if (scanner->sawBreak) {
+        shard->head = scanner->head;
+        shard->headLen = scanner->headLen;
+        scanner->head = NULL;
+        shard->tail = copyFragment(scanner->carry, scanner->carryLen);
+        shard->tailLen = scanner->carryLen;
+    } else {
+        shard->head = copyFragment(scanner->carry, scanner->carryLen);
+        shard->headLen = scanner->carryLen;
+    }
+}
+
+static void *runShardWorker(void *arg) {
+    ShardWorker *worker = (ShardWorker *)arg;
+    ShardQueue *queue = worker->queue;
+    int next;
+
+    while (1) {
+        pthread_mutex_lock(&queue->lock);
+        next = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (next >= queue->numShards)
+            break;
+        countShard(worker, &queue->shards[next]);
+    }
+    return NULL;
+}
+
+static void *runCountsMerge(void *arg) {
+    CountsMerge *merge = (CountsMerge *)arg;
+    mergeWordCounts(merge->into, merge->from);
+    return NULL;
+}
+
+/*
+ * merges all the counts into counts[0] pairing them up so each round
+ * halves the number left and every merge in a round runs at once
+ */
+static void mergeCountsParallel(WordCounts **counts, int numCounts) {
+    CountsMerge *merges =
+        (CountsMerge *)malloc(numCounts * sizeof(CountsMerge));
+    int step, i, numMerges;
+
+    if (merges == NULL)
+        error(1, errno, "Failed to allocate merges");
+    for (step = 1; step < numCounts; step *= 2) {
+        numMerges = 0;
+        for (i = 0; i + step < numCounts; i += 2 * step) {
+            merges[numMerges].into = counts[i];
+            merges[numMerges].from = counts[i + step];
+            if (pthread_create(&merges[numMerges].thread, NULL, runCountsMerge,
+                               &merges[numMerges]) != 0)
+                error(1, errno, "Failed to start merge thread");
+            numMerges++;
+        }
+        for (i = 0; i < numMerges; i++) {
+            pthread_join(merges[i].thread, NULL);
+            freeWordCounts(merges[i].from);
+        }
+    }
+    free(merges);
+}
+
+/* counts a word that was split between shards, if the filter keeps it */
+static void countFragment(WordCounts *counts, const char *word,
+                          size_t wordLen) {
+    const WordFilter *filter = getScanFilter();
+    if (wordLen == 0)
+        return;
+    STATSADD(WORDSREAD, 1);
+    if (filter == NULL || keepFilteredWord(filter, word, wordLen))
+        addWordCounts(counts, word, wordLen, 1);
+}
+
+/*
+ * glues the words split across shard edges back together in input
+ * order. a shard without any breaks just makes the current word longer
+ * and whatever is left over at the end is dropped, same as the serial
+ * version does with a word that isn't followed by a non word character
+ */
+static void countShardEdges(WordCounts *counts, Shard *shards,
+                            int numShards) {
+    char *carry = NULL;
+    size_t carryLen = 0, carryCap = 0;
+    int i;
+
+    for (i = 0; i < numShards; i++) {
+        appendFragment(&carry, &carryLen, &carryCap, shards[i].head,
+                       shards[i].headLen);
+        if (!shards[i].hasBreak)
+            continue;
+        countFragment(counts, carry, carryLen);
+        carryLen = 0;
+        appendFragment(&carry, &carryLen, &carryCap, shards[i].tail,
+                       shards[i].tailLen);
+    }
+    free(carry);
+}
+
+/*
+ * moves a cut in a file past any UTF-8 continuation bytes so the shard
+ * after it starts on a code point. more than 3 can't be part of one
+ * so it gives up there, they are all bad bytes anyway
+ */
+static off_t alignUtf8Cut(const char *fileName, off_t cut, off_t size) {
+    unsigned char bytes[3];
+    ssize_t got = 0;
+    int fd, i;
+
+    if ((fd = open(fileName, O_RDONLY)) != -1) {
+        got = pread(fd, bytes, sizeof(bytes), cut);
+        close(fd);
+    }
+    for (i = 0; i < got && (bytes[i] & 0xc0) == 0x80; i++)
+        cut++;
+    return (cut < size ? cut : size);
+}
+
+/*
+ * checks every input in order so missing files are reported the same
+ * way as the serial version and cuts them into shards
+ */
+static Shard *makeShards(char **inputs, int numImputs, int numThreads,
+                         int *numShards) {
+    Shard *shards = NULL;
+    struct stat *stats;
+    off_t totalBytes = 0, shardSize, start;
+    int inputIndex, fd, cap = 0, *isOpen;
+
+    stats = (struct stat *)malloc(numImputs * sizeof(struct stat));
+    isOpen = (int *)calloc(numImputs, sizeof(int));
+    if (stats == NULL || isOpen == NULL)
+        error(1, errno, "Failed to allocate shards");
+    for (inputIndex = 0; inputIndex < numImputs; inputIndex++) {
+        fd = open(inputs[inputIndex], O_RDONLY);
+        if (fd == -1 || fstat(fd, &stats[inputIndex]) == -1) {
+            fprintf(stderr, "%s: Failed to open file \"%s\"... %s\n", "fw",
+                    inputs[inputIndex], strerror(errno));
+            if (fd != -1)
+                close(fd);
+            continue;
+        }
+        close(fd);
+        isOpen[inputIndex] = 1;
+        if (S_ISREG(stats[inputIndex].st_mode))
+            totalBytes += stats[inputIndex].st_size;
+    }
+
+    shardSize = totalBytes / (numThreads * SHARDSPERTHREAD);
+    if (shardSize < MINSHARDSIZE)
+        shardSize = MINSHARDSIZE;
+
+    *numShards = 0;
+    for (inputIndex = 0; inputIndex < numImputs; inputIndex++) {
+        if (!isOpen[inputIndex])
+            continue;
+        start = 0;
+        do {
+            if (*numShards == cap) {
+                cap = (cap == 0 ? 16 : cap * 2);
+                shards = (Shard *)realloc(shards, cap * sizeof(Shard));
+                if (shards == NULL)
+                    error(1, errno, "Failed to allocate shards");
+            }
+            memset(&shards[*numShards], 0, sizeof(Shard));
+            shards[*numShards].fileName = inputs[inputIndex];
+            shards[*numShards].start = start;
+            if (!S_ISREG(stats[inputIndex].st_mode)) {
+                shards[*numShards].end = -1;
+            } else {
+                start += shardSize;
+                if (start > stats[inputIndex].st_size)
+                    start = stats[inputIndex].st_size;
+                else if (getScanMode() == UTF8SCAN)
+                    start = alignUtf8Cut(inputs[inputIndex], start,
+                                         stats[inputIndex].st_size);
+                shards[*numShards].end = start;
+            }
+            (*numShards)++;
+        } while (S_ISREG(stats[inputIndex].st_mode) &&
+                 start < stats[inputIndex].st_size);
+    }
+    free(stats);
+    free(isOpen);
+    return shards;
+}
+
+WordCounts *countWordsParallel(char **inputs, int numImputs, int numThreads,
+                               CountBackend backend) {
+    WordCounts *merged;
+    ShardQueue queue;
+    ShardWorker *workers;
+    WordCounts **counts;
+    int i, numWorkers;
+
+    queue.shards = makeShards(inputs, numImputs, numThreads, &queue.numShards);
+    queue.next = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+
+    numWorkers = numThreads;
+    if (numWorkers > queue.numShards)
+        numWorkers = queue.numShards;
+    if (numWorkers < 1)
+        numWorkers = 1;
+    workers = (ShardWorker *)calloc(numWorkers, sizeof(ShardWorker));
+    counts = (WordCounts **)malloc(numWorkers * sizeof(WordCounts *));
+    if (workers == NULL || counts == NULL)
+        error(1, errno, "Failed to allocate workers");
+
+    for (i = 0; i < numWorkers; i++) {
+        workers[i].queue = &queue;
+        workers[i].counts = counts[i] = constructWordCounts(backend);
+        workers[i].scanner = constructScanner(countShardWord, &workers[i]);
+        if (pthread_create(&workers[i].thread, NULL, runShardWorker,
+                           &workers[i]) != 0)
+            error(1, errno, "Failed to start worker thread");
+    }
+    for (i = 0; i < numWorkers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        freeScanner(workers[i].scanner);
+    }
+    pthread_mutex_destroy(&queue.lock);
+
+    mergeCountsParallel(counts, numWorkers);
+    countShardEdges(counts[0], queue.shards, queue.numShards);
+    merged = counts[0];
+
+    for (i = 0; i < queue.numShards; i++) {
+        free(queue.shards[i].head);
+        free(queue.shards[i].tail);
+    }
+    free(queue.shards);
+    free(workers);
+    free(counts);
+    return merged;
+}
+
+TopWords *countWordFrequenciesParallel(int n, char **inputs, int numImputs,
+                                       int numThreads, CountBackend backend) {
+    WordCounts *counts;
+    TopWords *topWords;
+
+    counts = countWordsParallel(inputs, numImputs, numThreads, backend);
+    STATSSTART(SELECTPHASE);
+    topWords = selectTopWords(counts, n, numThreads);
+    STATSEND(SELECTPHASE);
+    addWordCountsStats(counts);
+    freeWordCounts(counts);
+    return topWords;
+}
@@ -0,0 +1,52 @@
+#ifndef SHARD_H
+#define SHARD_H
+#include "counts.h"
+#include "topwords.h"
+#include <sys/types.h>
+
+/* regular files are cut into pieces no smaller than this */
+#define MINSHARDSIZE (1 << 20)
+/* how many pieces per thread to aim for so the work evens out */
+#define SHARDSPERTHREAD 4
+
+/*
+ * a piece of the input for one worker to count.
+ * either a byte range of a regular file or a whole stream (end == -1)
+ * which can only be read front to back.
+ *
+ * shards are cut without looking at the data so the words at either
+ * end may continue into the neighbouring shards. the worker hands
+ * those back as head (everything before the first non word character)
+ * and tail (everything after the last one) and they are glued back
+ * together in order once every worker is done
+ */
+struct Shard {
+    const char *fileName;
+    off_t start;
+    off_t end;
+    int hasBreak; /* whether the shard had any non word characters */
+    char *head;
+    size_t headLen;
+    char *tail;
+    size_t tailLen;
+};
+typedef struct Shard Shard;
+
+/*
+ * counts every word in the inputs with numThreads workers, each with
+ * its own counts, and merges them in parallel. the words are the same
+ * as a serial count would find, including which words stick together
+ * across file boundaries. backend must already be picked
+ */
+WordCounts *countWordsParallel(char **inputs, int numImputs, int numThreads,
+                               CountBackend backend);
+
+/*
+ * same as countWordFrequencies but the counting is done by
+ * countWordsParallel and the top words picked from the result with
+ * the same threads. output is identical to the serial version
+ */
+TopWords *countWordFrequenciesParallel(int n, char **inputs, int numImputs,
+                                       int numThreads, CountBackend backend);
+
+#endif /* SHARD_H */
@@ -0,0 +1,341 @@
+#include "snapshot.h"
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* snapshot order: memcmp order with the shorter word first on a tie */
+static int compSnapshotWords(const char *aWord, size_t aLen,
+                             const char *bWord, size_t bLen) {
+    int comp = memcmp(aWord, bWord, aLen < bLen ? aLen : bLen);
+    if (comp != 0)
+        return comp;
+    return (aLen > bLen) - (aLen < bLen);
+}
+
+static Snapshot *allocSnapshot(void) {
+    Snapshot *snapshot = (Snapshot *)calloc(1, sizeof(Snapshot));
+    if (snapshot == NULL)
+        error(1, errno, "Failed to allocate snapshot");
+    return snapshot;
+}
+
+Snapshot *openSnapshot(const char *path) {
+    Snapshot *snapshot = allocSnapshot();
+    const SnapshotHeader *header;
+    struct stat st;
+    uint64_t size;
+    int fd;
+
+    snapshot->fileName = path;
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+        error(1, errno, "Failed to open snapshot \"%s\"", path);
+    size = st.st_size;
+    if (size < sizeof(SnapshotHeader))
+        error(1, 0, "\"%s\" is not a snapshot", path);
+    snapshot->dataLen = size;
+    snapshot->data = (unsigned char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE,
+                                           fd, 0);
+    if (snapshot->data == MAP_FAILED)
+        error(1, errno, "Failed to map snapshot \"%s\"", path);
+    close(fd);
+    madvise(snapshot->data, size, MADV_SEQUENTIAL);
+
+    /* everything after the header is only checked as it is read */
+    header = (const SnapshotHeader *)snapshot->data;
+    if (memcmp(header->magic, SNAPSHOTMAGIC, sizeof(header->magic)) != 0)
+        error(1, 0, "\"%s\" is not a snapshot", path);
+    if (header->byteOrder != SNAPSHOTBYTEORDER)
+        error(1, 0, "\"%s\" was written on a machine with another byte order",
+              path);
+    if (header->entrySize != sizeof(SnapshotEntry) ||
+        header->stringsOffset > size ||
+        header->stringsLen > size - header->stringsOffset ||
+        header->entriesOffset % 8 != 0 || header->entriesOffset > size ||
+        header->numWords > (size - header->entriesOffset) /
+                               sizeof(SnapshotEntry))
+        error(1, 0, "\"%s\" is corrupt", path);
+    snapshot->header = *header;
+    snapshot->entries =
+        (const SnapshotEntry *)(snapshot->data + header->entriesOffset);
+    snapshot->strings = (const char *)snapshot->data + header->stringsOffset;
+    return snapshot;
+}
+
+/* a snapshot being built in memory */
+struct SnapshotBuilder {
+    SnapshotEntry *entries;
+    size_t numEntries;
+    size_t entriesCap;
+    char *strings;
+    size_t stringsLen;
+    size_t stringsCap;
+};
+typedef struct SnapshotBuilder SnapshotBuilder;
+
+static void addSnapshotWord(SnapshotBuilder *builder, const char *word,
+                            size_t wordLen, int count) {
+    SnapshotEntry *entry;
+
+    if (builder->numEntries == builder->entriesCap) {
+        builder->entriesCap =
+            (builder->entriesCap == 0 ? 1024 : builder->entriesCap * 2);
+        builder->entries = (SnapshotEntry *)realloc(
+            builder->entries, builder->entriesCap * sizeof(SnapshotEntry));
+        if (builder->entries == NULL)
+            error(1, errno, "Failed to grow snapshot");
+    }
+    if (builder->stringsLen + wordLen > builder->stringsCap) {
+        builder->stringsCap = (builder->stringsLen + wordLen) * 2;
+        builder->strings =
+            (char *)realloc(builder->strings, builder->stringsCap);
+        if (builder->strings == NULL)
+            error(1, errno, "Failed to grow snapshot");
+    }
+    entry = &builder->entries[builder->numEntries++];
+    entry->word = builder->stringsLen;
+    entry->wordLen = wordLen;
+    entry->unused = 0;
+    entry->count = count;
+    memcpy(builder->strings + builder->stringsLen, word, wordLen);
+    builder->stringsLen += wordLen;
+}
+
+static void visitSnapshotWord(void *ctx, int count, const char *word,
+                              size_t wordLen) {
+    addSnapshotWord((SnapshotBuilder *)ctx, word, wordLen, count);
+}
+
+/* a word from a hash table waiting to be sorted */
+struct UnsortedWord {
+    const char *word;
+    size_t wordLen;
+    int count;
+};
+typedef struct UnsortedWord UnsortedWord;
+
+/* collects the words of a hash table, which stay put while it's around */
+struct UnsortedWords {
+    UnsortedWord *words;
+    size_t len;
+    size_t cap;
+};
+typedef struct UnsortedWords UnsortedWords;
+
+static void visitUnsortedWord(void *ctx, int count, const char *word,
+                              size_t wordLen) {
+    UnsortedWords *unsorted = (UnsortedWords *)ctx;
+    if (unsorted->len == unsorted->cap) {
+        unsorted->cap = (unsorted->cap == 0 ? 1024 : unsorted->cap * 2);
+        unsorted->words = (UnsortedWord *)realloc(
+            unsorted->words, unsorted->cap * sizeof(UnsortedWord));
+        if (unsorted->words == NULL)
+            error(1, errno, "Failed to sort snapshot");
+    }
+    unsorted->words[unsorted->len].word = word;
+    unsorted->words[unsorted->len].wordLen = wordLen;
+    unsorted->words[unsorted->len].count = count;
+    unsorted->len++;
+}
+
+static int compUnsortedWords(const void *a, const void *b) {
+    const UnsortedWord *aWord = (const UnsortedWord *)a;
+    const UnsortedWord *bWord = (const UnsortedWord *)b;
+    return compSnapshotWords(aWord->word, aWord->wordLen, bWord->word,
+                             bWord->wordLen);
+}
+
+Snapshot *snapshotWordCounts(WordCounts *counts) {
+    Snapshot *snapshot = allocSnapshot();
+    SnapshotBuilder builder;
+    UnsortedWords unsorted;
+    size_t i;
+
+    memset(&builder, 0, sizeof(builder));
+    if (counts->backend == TRIEBACKEND) {
+        /* a trie walk is already in order */
+        forEachWordCount(counts, visitSnapshotWord, &builder);
+    } else {
+        memset(&unsorted, 0, sizeof(unsorted));
+        forEachWordCount(counts, visitUnsortedWord, &unsorted);
+        if (unsorted.len > 0)
+            qsort(unsorted.words, unsorted.len, sizeof(UnsortedWord),
+                  compUnsortedWords);
+        for (i = 0; i < unsorted.len; i++)
+            addSnapshotWord(&builder, unsorted.words[i].word,
+                            unsorted.words[i].wordLen,
+                            unsorted.words[i].count);
+        free(unsorted.words);
+    }
+
+    memcpy(snapshot->header.magic, SNAPSHOTMAGIC, sizeof(SNAPSHOTMAGIC));
+    snapshot->header.byteOrder = SNAPSHOTBYTEORDER;
+    snapshot->header.entrySize = sizeof(SnapshotEntry);
+    snapshot->header.numWords = builder.numEntries;
+    snapshot->header.stringsLen = builder.stringsLen;
+    snapshot->entries = builder.entries;
+    snapshot->strings = builder.strings;
+    return snapshot;
+}
+
+/* the word at a snapshot's pos, checking it is inside the strings */
+static const char *getSnapshotWord(const Snapshot *snapshot,
+                                   const SnapshotEntry *entry) {
+    if (entry->word > snapshot->header.stringsLen ||
+        entry->wordLen > snapshot->header.stringsLen - entry->word)
+        error(1, 0, "\"%s\" is corrupt", snapshot->fileName);
+    return snapshot->strings + entry->word;
+}
+
+/* compares the words two snapshots are at */
+static int compSnapshotPos(Snapshot *a, Snapshot *b) {
+    const SnapshotEntry *aEntry = &a->entries[a->pos];
+    const SnapshotEntry *bEntry = &b->entries[b->pos];
+    return compSnapshotWords(getSnapshotWord(a, aEntry), aEntry->wordLen,
+                             getSnapshotWord(b, bEntry), bEntry->wordLen);
+}
+
+/* min heap of snapshots by the word they are at */
+static void siftDownSnapshots(Snapshot **heap, int len, int i) {
+    Snapshot *tmp;
+    int kid, lowest;
+    while (1) {
+        lowest = i;
+        kid = 2 * i + 1;
+        if (kid < len && compSnapshotPos(heap[kid], heap[lowest]) < 0)
+            lowest = kid;
+        kid++;
+        if (kid < len && compSnapshotPos(heap[kid], heap[lowest]) < 0)
+            lowest = kid;
+        if (lowest == i)
+            break;
+        tmp = heap[i];
+        heap[i] = heap[lowest];
+        heap[lowest] = tmp;
+        i = lowest;
+    }
+}
+
+void forEachMergedWord(Snapshot **snapshots, int numSnapshots,
+                       void (*visit)(void *ctx, const char *word,
+                                     size_t wordLen, uint64_t count),
+                       void *ctx) {
+    Snapshot **heap = (Snapshot **)malloc(numSnapshots * sizeof(Snapshot *));
+    const SnapshotEntry *entry;
+    const char *word;
+    size_t wordLen;
+    uint64_t count;
+    int i, len = 0;
+
+    if (heap == NULL && numSnapshots > 0)
+        error(1, errno, "Failed to allocate merge");
+    for (i = 0; i < numSnapshots; i++) {
+        snapshots[i]->pos = 0;
+        if (snapshots[i]->header.numWords > 0)
+            heap[len++] = snapshots[i];
+    }
+    for (i = len / 2 - 1; i >= 0; i--)
+        siftDownSnapshots(heap, len, i);
+
+    while (len > 0) {
+        entry = &heap[0]->entries[heap[0]->pos];
+        word = getSnapshotWord(heap[0], entry);
+        wordLen = entry->wordLen;
+        count = 0;
+        /* take the word from every snapshot that has it */
+        while (len > 0) {
+            entry = &heap[0]->entries[heap[0]->pos];
+            if (compSnapshotWords(word, wordLen, getSnapshotWord(heap[0], entry),
+                                  entry->wordLen) != 0)
+                break;
+            if (entry->count > UINT64_MAX - count)
+                error(1, 0, "The count of \"%.*s\" is too big to add up",
+                      (int)wordLen, word);
+            count += entry->count;
+            if (++heap[0]->pos == heap[0]->header.numWords)
+                heap[0] = heap[--len];
+            /* word points into a snapshot so moving on doesn't change it */
+            siftDownSnapshots(heap, len, 0);
+        }
+        visit(ctx, word, wordLen, count);
+    }
+    free(heap);
+}
+
+void closeSnapshot(Snapshot *snapshot) {
+    if (snapshot == NULL)
+        return;
+    if (snapshot->fileName != NULL) {
+        munmap(snapshot->data, snapshot->dataLen);
+    } else {
+        free((void *)snapshot->entries);
+        free((void *)snapshot->strings);
+    }
+    free(snapshot);
+}
+
+SnapshotWriter *constructSnapshotWriter(const char *path) {
+    SnapshotWriter *writer = (SnapshotWriter *)calloc(1, sizeof(SnapshotWriter));
+    if (writer == NULL)
+        error(1, errno, "Failed to allocate snapshot writer");
+    writer->fileName = path;
+    writer->tmpName = (char *)malloc(strlen(path) + sizeof(".tmp"));
+    if (writer->tmpName == NULL)
+        error(1, errno, "Failed to allocate snapshot writer");
+    strcpy(writer->tmpName, path);
+    strcat(writer->tmpName, ".tmp");
+    if ((writer->out = fopen(writer->tmpName, "wb")) == NULL)
+        error(1, errno, "Failed to write snapshot \"%s\"", path);
+    if ((writer->entries = tmpfile()) == NULL)
+        error(1, errno, "Failed to write snapshot \"%s\"", path);
+
+    memcpy(writer->header.magic, SNAPSHOTMAGIC, sizeof(SNAPSHOTMAGIC));
+    writer->header.byteOrder = SNAPSHOTBYTEORDER;
+    writer->header.entrySize = sizeof(SnapshotEntry);
+    writer->header.stringsOffset = sizeof(SnapshotHeader);
+    /* the real header goes in once everything else is written */
+    fwrite(&writer->header, sizeof(SnapshotHeader), 1, writer->out);
+    return writer;
+}
+
+void writeSnapshotWord(SnapshotWriter *writer, const char *word,
+                       size_t wordLen, uint64_t count) {
+    SnapshotEntry entry;
+    entry.word = writer->header.stringsLen;
+    entry.wordLen = wordLen;
+    entry.unused = 0;
+    entry.count = count;
+    fwrite(word, 1, wordLen, writer->out);
+    fwrite(&entry, sizeof(SnapshotEntry), 1, writer->entries);
+    writer->header.stringsLen += wordLen;
+    writer->header.numWords++;
+}
+
+void closeSnapshotWriter(SnapshotWriter *writer) {
+    static const char padding[8] = {0};
+    char buf[1 << 16];
+    size_t got;
+    uint64_t end;
+
+    end = writer->header.stringsOffset + writer->header.stringsLen;
+    fwrite(padding, 1, (8 - end % 8) % 8, writer->out);
+    writer->header.entriesOffset = (end + 7) / 8 * 8;
+
+    rewind(writer->entries);
+    while ((got = fread(buf, 1, sizeof(buf), writer->entries)) > 0)
+        fwrite(buf, 1, got, writer->out);
+    rewind(writer->out);
+    fwrite(&writer->header, sizeof(SnapshotHeader), 1, writer->out);
+
+    if (ferror(writer->entries) || ferror(writer->out) ||
+        fclose(writer->out) != 0 ||
+        rename(writer->tmpName, writer->fileName) == -1)
+        error(1, errno, "Failed to write snapshot \"%s\"", writer->fileName);
+    fclose(writer->entries);
+    free(writer->tmpName);
+    free(writer);
+}
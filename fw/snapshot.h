@@ -0,0 +1,106 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include "counts.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* the first 8 bytes of every snapshot file, the digit is the version */
+#define SNAPSHOTMAGIC "fwsnap2"
+/* written as is so a snapshot from a machine with another byte order
+ * can be told apart */
+#define SNAPSHOTBYTEORDER 0x01020304
+
+/*
+ * a snapshot is the final word counts of a run, laid out so it can be
+ * memory mapped and used as is:
+ *
+ *   header | strings | padding to 8 bytes | entries
+ *
+ * every word has an entry and the entries are sorted by word (memcmp
+ * order, shorter first when one is the start of the other), which is
+ * the order a trie walk gives. everything is found by offset from the
+ * start of the file so there is nothing to parse or fix up on load
+ */
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t entrySize;
+    uint64_t numWords;
+    uint64_t stringsOffset;
+    uint64_t stringsLen;
+    uint64_t entriesOffset;
+};
+typedef struct SnapshotHeader SnapshotHeader;
+
+/* counts are 64 bits so a merge of however many snapshots never wraps */
+struct SnapshotEntry {
+    uint64_t word; /* offset of the word in the strings */
+    uint64_t count;
+    uint32_t wordLen;
+    uint32_t unused; /* always 0 */
+};
+typedef struct SnapshotEntry SnapshotEntry;
+
+/*
+ * a snapshot either mapped from a file or built in memory from counts.
+ * pos is how far a merge has got through the entries
+ */
+struct Snapshot {
+    const char *fileName; /* NULL if built in memory */
+    unsigned char *data;
+    size_t dataLen;
+    SnapshotHeader header;
+    const SnapshotEntry *entries;
+    const char *strings;
+    uint64_t pos;
+};
+typedef struct Snapshot Snapshot;
+
+/*
+ * maps the snapshot at path after checking its header.
+ * exits with an error if it can't be opened or isn't a snapshot
+ */
+Snapshot *openSnapshot(const char *path);
+
+/* builds a snapshot in memory of every word in counts */
+Snapshot *snapshotWordCounts(WordCounts *counts);
+
+/*
+ * calls visit for every word in any of the snapshots, in order, with
+ * the sum of its counts in all of them. exits with an error if a sum
+ * doesn't fit in 64 bits.
+ * the word is not null terminated and only valid during the call
+ */
+void forEachMergedWord(Snapshot **snapshots, int numSnapshots,
+                       void (*visit)(void *ctx, const char *word,
+                                     size_t wordLen, uint64_t count),
+                       void *ctx);
+
+void closeSnapshot(Snapshot *snapshot);
+
+/*
+ * writes a snapshot a word at a time. words have to come in snapshot
+ * order. the strings go straight to the file and the entries to a
+ * temporary file that is copied in behind them at the end, so memory
+ * doesn't grow with the number of words
+ */
+struct SnapshotWriter {
+    const char *fileName;
+    char *tmpName; /* written to this then renamed once complete */
+    FILE *out;
+    FILE *entries;
+    SnapshotHeader header;
+};
+typedef struct SnapshotWriter SnapshotWriter;
+
+/* exits with an error if path can't be written */
+SnapshotWriter *constructSnapshotWriter(const char *path);
+
+void writeSnapshotWord(SnapshotWriter *writer, const char *word,
+                       size_t wordLen, uint64_t count);
+
+/* finishes the file and frees the writer */
+void closeSnapshotWriter(SnapshotWriter *writer);
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,83 @@
+#include "stats.h"
+#include <sys/resource.h>
+
+/* the scanners are freed on the workers too so every update is atomic */
+static uint64_t counters[NUMSTATSCOUNTERS];
+static uint64_t nanos[NUMSTATSPHASES];
+static uint64_t memory[NUMSTATSMEMORIES];
+static struct timespec runStart;
+static struct timespec phaseStart;
+
+static const char *phaseNames[NUMSTATSPHASES] = {"read", "tokenize", "insert",
+                                                 "select", "print"};
+static const char *memoryNames[NUMSTATSMEMORIES] = {"scanner", "trie", "hash",
+                                                    "grams", "topWords"};
+
+void startStats(void) { clock_gettime(CLOCK_MONOTONIC, &runStart); }
+
+uint64_t lapStatsMark(struct timespec *mark) {
+    struct timespec now;
+    uint64_t elapsed;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (uint64_t)(now.tv_sec - mark->tv_sec) * 1000000000 +
+              now.tv_nsec - mark->tv_nsec;
+    *mark = now;
+    return elapsed;
+}
+
+void addScanStats(const ScanStats *stats, size_t bytes) {
+    int i;
+    /* cleared, or it never read anything */
+    if (stats->counters[BYTESREAD] == 0)
+        return;
+    for (i = 0; i <= WORDSREAD; i++)
+        __sync_fetch_and_add(&counters[i], stats->counters[i]);
+    for (i = 0; i <= INSERTPHASE; i++)
+        __sync_fetch_and_add(&nanos[i], stats->nanos[i]);
+    addStatsMemory(SCANNERMEMORY, bytes);
+}
+
+void addStatsCounter(StatsCounter counter, uint64_t n) {
+    __sync_fetch_and_add(&counters[counter], n);
+}
+
+void setStatsCounter(StatsCounter counter, uint64_t n) {
+    counters[counter] = n;
+}
+
+void addStatsMemory(StatsMemory which, size_t bytes) {
+    __sync_fetch_and_add(&memory[which], (uint64_t)bytes);
+}
+
+void startStatsPhase(StatsPhase phase) {
+    (void)phase;
+    clock_gettime(CLOCK_MONOTONIC, &phaseStart);
+}
+
+void endStatsPhase(StatsPhase phase) {
+    nanos[phase] += lapStatsMark(&phaseStart);
+}
+
+void printStats(FILE *out) {
+    struct timespec now = runStart;
+    struct rusage usage;
+    int i;
+
+    fprintf(out,
+            "{\"bytesRead\": %lu, \"words\": %lu, \"distinctWords\": %lu, "
+            "\"trieNodes\": %lu, \"memoryBytes\": {",
+            (unsigned long)counters[BYTESREAD],
+            (unsigned long)counters[WORDSREAD],
+            (unsigned long)counters[DISTINCTWORDS],
+            (unsigned long)counters[TRIENODES]);
+    for (i = 0; i < NUMSTATSMEMORIES; i++)
+        fprintf(out, "%s\"%s\": %lu", (i > 0 ? ", " : ""), memoryNames[i],
+                (unsigned long)memory[i]);
+    fprintf(out, "}, \"phaseSeconds\": {");
+    for (i = 0; i < NUMSTATSPHASES; i++)
+        fprintf(out, "%s\"%s\": %.6f", (i > 0 ? ", " : ""), phaseNames[i],
+                nanos[i] / 1e9);
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(out, "}, \"seconds\": %.6f, \"peakRssKb\": %ld}\n",
+            lapStatsMark(&now) / 1e9, usage.ru_maxrss);
+}
@@ -0,0 +1,139 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * what --stats reports on stderr at the end of a run, as one line of
+ * JSON: bytes and words read, distinct words, trie nodes, the bytes
+ * held by each of the main structures, the time spent in each phase
+ * and the peak RSS.
+ *
+ * everything is done through the macros below, which compile to
+ * nothing unless FWSTATS is defined (the Makefile defines it, make
+ * STATS= builds without). a scanner keeps its own ScanStats while it
+ * runs so nothing shared is touched per word or window, and adds them
+ * to the totals when it is freed
+ */
+
+/*
+ * where the time goes. read, tokenize and insert are timed a window at
+ * a time by the scanners and added up over every thread, so they can
+ * come to more than the run took. read is only the read calls and
+ * mapping files, a mapped file's pages are faulted in while it is
+ * tokenized. insert is scanning the folded window for words, which
+ * is nearly all handing them to the counts
+ */
+enum StatsPhase {
+    READPHASE,
+    TOKENIZEPHASE,
+    INSERTPHASE,
+    SELECTPHASE,
+    PRINTPHASE,
+    NUMSTATSPHASES
+};
+typedef enum StatsPhase StatsPhase;
+
+/* the totals that are just counted */
+enum StatsCounter {
+    BYTESREAD,
+    WORDSREAD,
+    DISTINCTWORDS,
+    TRIENODES,
+    NUMSTATSCOUNTERS
+};
+typedef enum StatsCounter StatsCounter;
+
+/* the structures whose memory is reported, what they had at the end */
+enum StatsMemory {
+    SCANNERMEMORY, /* every scanner's buffers added up */
+    TRIEMEMORY,
+    HASHMEMORY,
+    GRAMMEMORY,
+    TOPWORDSMEMORY,
+    NUMSTATSMEMORIES
+};
+typedef enum StatsMemory StatsMemory;
+
+/* a scanner's share of the totals */
+struct ScanStats {
+    uint64_t counters[WORDSREAD + 1];
+    uint64_t nanos[INSERTPHASE + 1];
+    struct timespec mark; /* when whatever is being timed started */
+};
+typedef struct ScanStats ScanStats;
+
+/* notes when the run started, before anything else is done */
+void startStats(void);
+
+/* nanoseconds since *mark, which is moved up to now */
+uint64_t lapStatsMark(struct timespec *mark);
+
+/*
+ * adds a scanner's stats and memory to the totals, unless it didn't
+ * read anything (or had its stats cleared). thread safe
+ */
+void addScanStats(const ScanStats *stats, size_t memory);
+
+/* adds n to a counter. thread safe */
+void addStatsCounter(StatsCounter counter, uint64_t n);
+
+/* sets a counter to what was found at the end */
+void setStatsCounter(StatsCounter counter, uint64_t n);
+
+/* adds to the bytes a structure holds. thread safe */
+void addStatsMemory(StatsMemory memory, size_t bytes);
+
+/*
+ * times a phase on the thread running the show, from start to end.
+ * phases timed this way can't overlap
+ */
+void startStatsPhase(StatsPhase phase);
+void endStatsPhase(StatsPhase phase);
+
+/* prints everything as one line of JSON */
+void printStats(FILE *out);
+
+#ifdef FWSTATS
+
+#define STATSBUILT 1
+
+#define STATSONLY(code) code
+#define STATSINIT() startStats()
+#define STATSMARK(stats) clock_gettime(CLOCK_MONOTONIC, &(stats).mark)
+#define STATSLAP(stats, phase)                                                \
+    ((stats).nanos[phase] += lapStatsMark(&(stats).mark))
+#define STATSCOUNT(stats, counter, n) ((stats).counters[counter] += (n))
+#define STATSSCANNER(stats, memory) addScanStats(&(stats), memory)
+#define STATSCLEAR(stats) memset(&(stats), 0, sizeof(stats))
+#define STATSADD(counter, n) addStatsCounter(counter, n)
+#define STATSSET(counter, n) setStatsCounter(counter, n)
+#define STATSMEMORY(memory, bytes) addStatsMemory(memory, bytes)
+#define STATSSTART(phase) startStatsPhase(phase)
+#define STATSEND(phase) endStatsPhase(phase)
+#define STATSREPORT(out) printStats(out)
+
+#else
+
+#define STATSBUILT 0
+
+#define STATSONLY(code)
+#define STATSINIT() ((void)0)
+#define STATSMARK(stats) ((void)0)
+#define STATSLAP(stats, phase) ((void)0)
+#define STATSCOUNT(stats, counter, n) ((void)0)
+#define STATSSCANNER(stats, memory) ((void)0)
+#define STATSCLEAR(stats) ((void)0)
+#define STATSADD(counter, n) ((void)0)
+#define STATSSET(counter, n) ((void)0)
+#define STATSMEMORY(memory, bytes) ((void)0)
+#define STATSSTART(phase) ((void)0)
+#define STATSEND(phase) ((void)0)
+#define STATSREPORT(out) ((void)0)
+
+#endif /* FWSTATS */
+
+#endif /* STATS_H */
@@ -0,0 +1,173 @@
+#include "topwords.h"
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+#include <string.h>
+
+TopWords *constructTopWords(int n) {
+    TopWords *top = (TopWords *)calloc(1, sizeof(TopWords));
+    if (top == NULL)
+        error(1, errno, "Failed to allocate top words");
+    top->n = n;
+    return top;
+}
+
+int compTopWord(uint64_t aCount, const char *aWord, size_t aLen,
+                uint64_t bCount, const char *bWord, size_t bLen) {
+    int comp;
+    /* the counts settle nearly every comparison so check them first */
+    if (aCount != bCount)
+        return (aCount > bCount ? 1 : -1);
+    /* same as strcmp but without needing the null terminators */
+    comp = memcmp(aWord, bWord, aLen < bLen ? aLen : bLen);
+    if (comp == 0)
+        comp = (aLen > bLen) - (aLen < bLen);
+    if (comp == 0)
+        return 0;
+    return (comp > 0 ? 1 : -1);
+}
+
+static int compHeapEntries(const TopWord *a, const TopWord *b) {
+    return compTopWord(a->count, a->word, a->wordLen, b->count, b->word,
+                       b->wordLen);
+}
+
+/* swaps two heap entries keeping their owners' heap positions in sync */
+static void swapHeapEntries(TopWords *top, int i, int j) {
+    TopWord tmp = top->heap[i];
+    top->heap[i] = top->heap[j];
+    top->heap[j] = tmp;
+    if (top->heap[i].heapPos != NULL)
+        *top->heap[i].heapPos = i;
+    if (top->heap[j].heapPos != NULL)
+        *top->heap[j].heapPos = j;
+}
+
+static void siftUp(TopWords *top, int i) {
+    int parent;
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (compHeapEntries(&top->heap[i], &top->heap[parent]) >= 0)
+            break;
+        swapHeapEntries(top, i, parent);
+        i = parent;
+    }
+}
+
+/* only looks at the first len entries so it can be reused when sorting */
+static void siftDown(TopWords *top, int i, int len) {
+    int kid, lowest;
+    while (1) {
+        lowest = i;
+        kid = 2 * i + 1;
+        if (kid < len &&
+            compHeapEntries(&top->heap[kid], &top->heap[lowest]) < 0)
+            lowest = kid;
+        kid++;
+        if (kid < len &&
+            compHeapEntries(&top->heap[kid], &top->heap[lowest]) < 0)
+            lowest = kid;
+        if (lowest == i)
+            break;
+        swapHeapEntries(top, i, lowest);
+        i = lowest;
+    }
+}
+
+/* copies word into the entry's buffer growing it if necessary */
+static void setHeapEntryWord(TopWord *entry, const char *word,
+                             size_t wordLen) {
+    if (entry->wordCap < wordLen + 1) {
+        entry->wordCap = wordLen + 1;
+        entry->word = (char *)realloc(entry->word, entry->wordCap);
+        if (entry->word == NULL)
+            error(1, errno, "Failed to allocate top word");
+    }
+    memcpy(entry->word, word, wordLen);
+    entry->word[wordLen] = '\0';
+    entry->wordLen = wordLen;
+}
+
+void updateTopWords(TopWords *top, uint64_t count, int *heapPos,
+                    const char *word, size_t wordLen) {
+    TopWord *entry;
+    int i;
+
+    if (heapPos != NULL && *heapPos != NOTINHEAP) {
+        /* counts only go up so it can only move away from the root */
+        top->heap[*heapPos].count = count;
+        siftDown(top, *heapPos, top->len);
+        return;
+    }
+
+    if (top->len < top->n) {
+        if (top->len == top->cap) {
+            top->cap = (top->cap == 0 ? 16 : top->cap * 2);
+            if (top->cap > top->n)
+                top->cap = top->n;
+            top->heap =
+                (TopWord *)realloc(top->heap, top->cap * sizeof(TopWord));
+            if (top->heap == NULL)
+                error(1, errno, "Failed to grow top words");
+        }
+        i = top->len++;
+        entry = &top->heap[i];
+        entry->word = NULL;
+        entry->wordCap = 0;
+        entry->count = count;
+        entry->error = 0;
+        entry->heapPos = heapPos;
+        setHeapEntryWord(entry, word, wordLen);
+        if (heapPos != NULL)
+            *heapPos = i;
+        siftUp(top, i);
+        return;
+    }
+
+    /* full, so it has to beat the lowest ranked word to get in */
+    if (top->len == 0)
+        return;
+    entry = &top->heap[0];
+    if (compTopWord(count, word, wordLen, entry->count, entry->word,
+                    entry->wordLen) <= 0)
+        return;
+    if (entry->heapPos != NULL)
+        *entry->heapPos = NOTINHEAP;
+    entry->count = count;
+    entry->error = 0;
+    entry->heapPos = heapPos;
+    setHeapEntryWord(entry, word, wordLen);
+    if (heapPos != NULL)
+        *heapPos = 0;
+    siftDown(top, 0, top->len);
+}
+
+void sortTopWords(TopWords *top) {
+    int len;
+    /* the owners are about to lose track of their words anyway */
+    for (len = 0; len < top->len; len++)
+        top->heap[len].heapPos = NULL;
+    for (len = top->len; len > 1; len--) {
+        /* the lowest ranked word goes to the back */
+        swapHeapEntries(top, 0, len - 1);
+        siftDown(top, 0, len - 1);
+    }
+}
+
+size_t getTopWordsBytes(const TopWords *top) {
+    size_t bytes = sizeof(TopWords) + top->cap * sizeof(TopWord);
+    int i;
+    for (i = 0; i < top->len; i++)
+        bytes += top->heap[i].wordCap;
+    return bytes;
+}
+
+void freeTopWords(TopWords *top) {
+    int i;
+    if (top == NULL)
+        return;
+    for (i = 0; i < top->len; i++)
+        free(top->heap[i].word);
+    free(top->heap);
+    free(top);
+}
@@ -0,0 +1,79 @@
+#ifndef TOPWORDS_H
+#define TOPWORDS_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* heapPos value for words that are not in the top words heap */
+#define NOTINHEAP -1
+
+/*
+ * one of the current top words.
+ * heapPos points at the int the word's owner (e.g. its trie node)
+ * uses to remember where in the heap the word is, so a repeat hit
+ * can go straight to its entry without comparing any strings.
+ * word is owned by the entry and reused when it gets evicted.
+ * error is how much count might be over by when the counts are
+ * approximate (see approx.h) and 0 otherwise
+ */
+struct TopWord {
+    uint64_t count;
+    uint64_t error;
+    int *heapPos;
+    char *word;
+    size_t wordLen;
+    size_t wordCap;
+};
+typedef struct TopWord TopWord;
+
+/*
+ * bounded indexed min heap of the n highest ranked words seen so far.
+ * heap[0] is always the lowest ranked of them so deciding whether a
+ * word makes the cut is a single comparison and every update is
+ * O(log n)
+ */
+struct TopWords {
+    TopWord *heap;
+    int len;
+    int cap;
+    int n;
+    uint64_t total; /* number of distinct words (or words read) counted */
+};
+typedef struct TopWords TopWords;
+
+/* top words constructor for keeping track of at most n words */
+TopWords *constructTopWords(int n);
+
+/*
+ * compares words how they are ranked in the output
+ * first by count then lexicographically
+ * returns > 0 if a ranks above b and < 0 if it ranks below
+ * returns 0 if both the counts and the words are the same
+ */
+int compTopWord(uint64_t aCount, const char *aWord, size_t aLen,
+                uint64_t bCount, const char *bWord, size_t bLen);
+
+/*
+ * called every time a word's count changes.
+ * if the word is already in the heap (*heapPos != NOTINHEAP)
+ * its entry is updated in place, otherwise it is added if it
+ * ranks above the lowest of the current top words.
+ * heapPos can be NULL for a word that won't be updated again
+ * word does not need to be null terminated
+ */
+void updateTopWords(TopWords *top, uint64_t count, int *heapPos,
+                    const char *word, size_t wordLen);
+
+/*
+ * sorts the heap in place from highest to lowest ranked.
+ * after this the heap property is gone and the entries no longer
+ * point at their owners, so the words are only good for printing
+ * and whatever held the heap positions can be freed
+ */
+void sortTopWords(TopWords *top);
+
+/* how many bytes the heap and the words in it take up */
+size_t getTopWordsBytes(const TopWords *top);
+
+void freeTopWords(TopWords *top);
+
+#endif /* TOPWORDS_H */
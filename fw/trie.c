@@ -0,0 +1,621 @@
+#include "trie.h"
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* grows a table of block pointers so it can hold at least one more block */
+static void *growBlockTable(void *blocks, unsigned int *cap, size_t ptrSize) {
+    *cap = (*cap == 0 ? 8 : *cap * 2);
+    blocks = realloc(blocks, *cap * ptrSize);
+    if (blocks == NULL)
+        error(1, errno, "Failed to grow trie block table");
+    return blocks;
+}
+
+/* hands out the next node in the arena, starting a new block if needed */
+static TrieIndex allocTrieNode(Trie *trie) {
+    TrieIndex index = trie->numNodes;
+    unsigned int block = index >> NODEBLOCKBITS;
+    TrieNode *node;
+
+    if ((index & (NODEBLOCKSIZE - 1)) == 0) {
+        if (block == trie->nodeBlocksCap)
+            trie->nodeBlocks = (TrieNode **)growBlockTable(
+                trie->nodeBlocks, &trie->nodeBlocksCap, sizeof(TrieNode *));
+        trie->nodeBlocks[block] =
+            (TrieNode *)malloc(NODEBLOCKSIZE * sizeof(TrieNode));
+        if (trie->nodeBlocks[block] == NULL)
+            error(1, errno, "Failed to allocate trie nodes");
+    }
+    trie->numNodes++;
+
+    node = getTrieNode(trie, index);
+    node->count = 0;
+    node->parent = TRIEROOT;
+    node->label = 0;
+    node->numKids = 0;
+    node->labelLen = 0;
+    return index;
+}
+
+/* hands out a zeroed DENSEKIDS long child table */
+static TrieIndex *allocTrieTable(Trie *trie, TrieIndex *tableIndex) {
+    unsigned int index = trie->numTables;
+    unsigned int block = index >> TABLEBLOCKBITS;
+    TrieIndex *table;
+
+    if ((index & (TABLEBLOCKSIZE - 1)) == 0) {
+        if (block == trie->tableBlocksCap)
+            trie->tableBlocks = (TrieIndex **)growBlockTable(
+                trie->tableBlocks, &trie->tableBlocksCap, sizeof(TrieIndex *));
+        trie->tableBlocks[block] = (TrieIndex *)malloc(
+            (size_t)TABLEBLOCKSIZE * DENSEKIDS * sizeof(TrieIndex));
+        if (trie->tableBlocks[block] == NULL)
+            error(1, errno, "Failed to allocate trie tables");
+    }
+    trie->numTables++;
+
+    table = trie->tableBlocks[block] +
+            (size_t)(index & (TABLEBLOCKSIZE - 1)) * DENSEKIDS;
+    memset(table, 0, DENSEKIDS * sizeof(TrieIndex));
+    *tableIndex = index;
+    return table;
+}
+
+static TrieIndex *getTrieTable(Trie *trie, TrieIndex tableIndex) {
+    return trie->tableBlocks[tableIndex >> TABLEBLOCKBITS] +
+           (size_t)(tableIndex & (TABLEBLOCKSIZE - 1)) * DENSEKIDS;
+}
+
+Trie *constructTrie(void) {
+    Trie *trie = (Trie *)calloc(1, sizeof(Trie));
+    if (trie == NULL)
+        error(1, errno, "Failed to allocate trie");
+    trie->wordCache =
+        (WordCacheEntry *)calloc(WORDCACHESIZE, sizeof(WordCacheEntry));
+    if (trie->wordCache == NULL)
+        error(1, errno, "Failed to allocate word cache");
+    /* the root */
+    allocTrieNode(trie);
+    return trie;
+}
+
+/*
+ * copies a label into the pool and returns where it went. labels are
+ * never freed or moved, and edges split later just point into them
+ */
+static TrieIndex storeTrieLabel(Trie *trie, const char *label, size_t len) {
+    size_t at = trie->labelBytes;
+    size_t block;
+
+    /* a label never spans two blocks so it can be read straight out */
+    if ((at & (LABELBLOCKSIZE - 1)) + len > LABELBLOCKSIZE)
+        at = (at | (LABELBLOCKSIZE - 1)) + 1;
+    block = at >> LABELBLOCKBITS;
+    if (block >= (size_t)1 << (32 - LABELBLOCKBITS))
+        error(1, 0, "Too many trie labels");
+    if (block == trie->numLabelBlocks) {
+        if (block == trie->labelBlocksCap)
+            trie->labelBlocks = (char **)growBlockTable(
+                trie->labelBlocks, &trie->labelBlocksCap, sizeof(char *));
+        trie->labelBlocks[block] = (char *)malloc(LABELBLOCKSIZE);
+        if (trie->labelBlocks[block] == NULL)
+            error(1, errno, "Failed to allocate trie labels");
+        trie->numLabelBlocks++;
+    }
+    memcpy(getTrieLabel(trie, at), label, len);
+    trie->labelBytes = at + len;
+    return (TrieIndex)at;
+}
+
+/* moves a full sparse node's children into a freshly allocated table */
+static void makeTrieNodeDense(Trie *trie, TrieIndex cur) {
+    TrieIndex tableIndex, *table;
+    TrieNode *node;
+    int i;
+
+    table = allocTrieTable(trie, &tableIndex);
+    node = getTrieNode(trie, cur);
+    for (i = 0; i < node->numKids; i++)
+        table[node->keys[i]] = node->kids[i];
+    node->kids[0] = tableIndex;
+    node->numKids = SPARSEKIDS + 1;
+}
+
+/* adds kid as cur's child for key, which cur must not have yet */
+static void addTrieKid(Trie *trie, TrieIndex cur, unsigned char key,
+                       TrieIndex kid) {
+    TrieNode *node = getTrieNode(trie, cur);
+    int i, j;
+
+    getTrieNode(trie, kid)->parent = cur;
+    if (isDenseTrieNode(node)) {
+        getTrieTable(trie, node->kids[0])[key] = kid;
+        return;
+    }
+    if (node->numKids == SPARSEKIDS) {
+        /* blocks never move once allocated so node stays valid */
+        makeTrieNodeDense(trie, cur);
+        getTrieTable(trie, node->kids[0])[key] = kid;
+        return;
+    }
+    /* shift larger keys over to keep the inline array sorted */
+    for (i = 0; i < node->numKids && node->keys[i] < key; i++)
+        ;
+    for (j = node->numKids; j > i; j--) {
+        node->keys[j] = node->keys[j - 1];
+        node->kids[j] = node->kids[j - 1];
+    }
+    node->keys[i] = key;
+    node->kids[i] = kid;
+    node->numKids++;
+}
+
+/* points cur's child for key, which it must have, at kid instead */
+static void replaceTrieKid(Trie *trie, TrieIndex cur, unsigned char key,
+                           TrieIndex kid) {
+    TrieNode *node = getTrieNode(trie, cur);
+    int i;
+
+    getTrieNode(trie, kid)->parent = cur;
+    if (isDenseTrieNode(node)) {
+        getTrieTable(trie, node->kids[0])[key] = kid;
+        return;
+    }
+    for (i = 0; node->keys[i] != key; i++)
+        ;
+    node->kids[i] = kid;
+}
+
+/*
+ * hangs a chain of new nodes spelling bytes off cur, as few as the
+ * label length allows, and returns the last of them
+ */
+static TrieIndex addTrieLeaves(Trie *trie, TrieIndex cur, const char *bytes,
+                               size_t len) {
+    TrieIndex kid;
+    TrieNode *node;
+    size_t labelLen;
+
+    while (len > 0) {
+        labelLen = (len - 1 > MAXTRIELABEL ? MAXTRIELABEL : len - 1);
+        kid = allocTrieNode(trie);
+        node = getTrieNode(trie, kid);
+        node->labelLen = (unsigned char)labelLen;
+        if (labelLen > 0)
+            node->label = storeTrieLabel(trie, bytes + 1, labelLen);
+        addTrieKid(trie, cur, (unsigned char)bytes[0], kid);
+        cur = kid;
+        bytes += labelLen + 1;
+        len -= labelLen + 1;
+    }
+    return cur;
+}
+
+/*
+ * splits the edge from cur to its child kid (found under key) after
+ * the first split bytes of kid's label, and returns the new node in
+ * the middle. kid keeps its index and count, so it still ends the
+ * same word and anything pointing at it stays right
+ */
+static TrieIndex splitTrieEdge(Trie *trie, TrieIndex cur, unsigned char key,
+                               TrieIndex kid, size_t split) {
+    TrieIndex mid = allocTrieNode(trie);
+    TrieNode *midNode = getTrieNode(trie, mid);
+    TrieNode *kidNode = getTrieNode(trie, kid);
+    unsigned char kidKey =
+        (unsigned char)getTrieLabel(trie, kidNode->label)[split];
+
+    midNode->label = kidNode->label;
+    midNode->labelLen = (unsigned char)split;
+    kidNode->label += split + 1;
+    kidNode->labelLen -= split + 1;
+    replaceTrieKid(trie, cur, key, mid);
+    addTrieKid(trie, mid, kidKey, kid);
+    return mid;
+}
+
+/*
+ * walks down from cur spelling bytes, splitting the edge they leave
+ * (if they do) and adding nodes for whatever is left after that, and
+ * returns the node they end at
+ */
+static TrieIndex walkTrieBytes(Trie *trie, TrieIndex cur, const char *bytes,
+                               size_t len) {
+    TrieIndex kid;
+    TrieNode *node;
+    const char *label;
+    unsigned char key;
+    size_t i = 0, matched, most;
+    int j;
+
+    while (i < len) {
+        node = getTrieNode(trie, cur);
+        key = (unsigned char)bytes[i];
+        /* the lookup is inline since this is where almost all of the
+         * time goes */
+        kid = TRIEROOT;
+        if (isDenseTrieNode(node)) {
+            kid = getTrieTable(trie, node->kids[0])[key];
+        } else {
+            for (j = 0; j < node->numKids; j++) {
+                if (node->keys[j] == key) {
+                    kid = node->kids[j];
+                    break;
+                }
+            }
+        }
+        if (kid == TRIEROOT)
+            return addTrieLeaves(trie, cur, bytes + i, len - i);
+        i++;
+        node = getTrieNode(trie, kid);
+        if (node->labelLen > 0) {
+            label = getTrieLabel(trie, node->label);
+            most = (node->labelLen < len - i ? node->labelLen : len - i);
+            for (matched = 0;
+                 matched < most && label[matched] == bytes[i + matched];
+                 matched++)
+                ;
+            i += matched;
+            if (matched < node->labelLen)
+                kid = splitTrieEdge(trie, cur, key, kid, matched);
+        }
+        cur = kid;
+    }
+    return cur;
+}
+
+/* walks down from the root without looking at the word cache */
+static TrieIndex walkTrieWord(Trie *trie, const char *word, size_t wordLen) {
+    return walkTrieBytes(trie, TRIEROOT, word, wordLen);
+}
+
+/* reads n (4 or 8) bytes as a little endian number */
+static uint64_t loadBytes(const char *bytes, int n) {
+    uint64_t v64;
+    uint32_t v32;
+    if (n == 8) {
+        memcpy(&v64, bytes, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v64 = __builtin_bswap64(v64);
+#endif
+        return v64;
+    }
+    memcpy(&v32, bytes, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v32 = __builtin_bswap32(v32);
+#endif
+    return v32;
+}
+
+/*
+ * packs a 1 to CACHEDWORDLEN byte word into two zero padded numbers
+ * without reading past its end. rather than copying byte by byte
+ * (or calling memcpy with a variable length) it loads the first and
+ * last few bytes, which overlap when the word is short
+ */
+static void padShortWord(uint64_t *padded, const char *word, size_t wordLen) {
+    const unsigned char *bytes = (const unsigned char *)word;
+    padded[1] = 0;
+    if (wordLen >= 8) {
+        padded[0] = loadBytes(word, 8);
+        if (wordLen > 8)
+            padded[1] =
+                loadBytes(word + wordLen - 8, 8) >> ((16 - wordLen) * 8);
+    } else if (wordLen >= 4) {
+        padded[0] = loadBytes(word, 4) |
+                    loadBytes(word + wordLen - 4, 4) << ((wordLen - 4) * 8);
+    } else {
+        padded[0] = (uint64_t)bytes[0] |
+                    (uint64_t)bytes[wordLen / 2] << (wordLen / 2 * 8) |
+                    (uint64_t)bytes[wordLen - 1] << ((wordLen - 1) * 8);
+    }
+}
+
+TrieIndex insertTrieWord(Trie *trie, const char *word, size_t wordLen) {
+    uint64_t padded[CACHEDWORDLEN / 8], hash;
+    WordCacheEntry *entry;
+
+    if (wordLen == 0 || wordLen > CACHEDWORDLEN)
+        return walkTrieWord(trie, word, wordLen);
+
+    padShortWord(padded, word, wordLen);
+    hash = (padded[0] * 0x9E3779B97F4A7C15ULL) ^
+           (padded[1] * 0xC2B2AE3D27D4EB4FULL) ^ wordLen;
+    hash ^= hash >> 29;
+    entry = &trie->wordCache[(hash * 0x9E3779B97F4A7C15ULL) >>
+                             (64 - WORDCACHEBITS)];
+    if (entry->wordLen != wordLen || entry->word[0] != padded[0] ||
+        entry->word[1] != padded[1]) {
+        entry->word[0] = padded[0];
+        entry->word[1] = padded[1];
+        entry->wordLen = wordLen;
+        entry->node = walkTrieWord(trie, word, wordLen);
+    }
+    return entry->node;
+}
+
+/* the char that leads from parent to kid */
+static unsigned char findTrieKey(Trie *trie, TrieNode *parent,
+                                 TrieIndex kid) {
+    TrieIndex *table;
+    int i;
+
+    if (isDenseTrieNode(parent)) {
+        table = getTrieTable(trie, parent->kids[0]);
+        for (i = 0; table[i] != kid; i++)
+            ;
+        return (unsigned char)i;
+    }
+    for (i = 0; parent->kids[i] != kid; i++)
+        ;
+    return parent->keys[i];
+}
+
+size_t getTrieWord(Trie *trie, TrieIndex index, char **buf, size_t *cap) {
+    TrieNode *node, *parent;
+    const char *label;
+    size_t len = 0, i;
+    TrieIndex cur;
+    char tmp;
+
+    /* spelled out backwards then turned around */
+    for (cur = index; cur != TRIEROOT; cur = node->parent) {
+        node = getTrieNode(trie, cur);
+        while (len + node->labelLen + 1 > *cap) {
+            *cap = (*cap == 0 ? 64 : *cap * 2);
+            *buf = (char *)realloc(*buf, *cap);
+            if (*buf == NULL)
+                error(1, errno, "Failed to grow trie word");
+        }
+        if (node->labelLen > 0) {
+            label = getTrieLabel(trie, node->label);
+            for (i = node->labelLen; i > 0; i--)
+                (*buf)[len++] = label[i - 1];
+        }
+        parent = getTrieNode(trie, node->parent);
+        (*buf)[len++] = findTrieKey(trie, parent, cur);
+    }
+    for (i = 0; i < len / 2; i++) {
+        tmp = (*buf)[i];
+        (*buf)[i] = (*buf)[len - 1 - i];
+        (*buf)[len - 1 - i] = tmp;
+    }
+    return len;
+}
+
+size_t getTrieBytes(const Trie *trie) {
+    size_t nodeBlocks = (trie->numNodes + NODEBLOCKSIZE - 1) >> NODEBLOCKBITS;
+    size_t tableBlocks =
+        (trie->numTables + TABLEBLOCKSIZE - 1) >> TABLEBLOCKBITS;
+    return sizeof(Trie) + WORDCACHESIZE * sizeof(WordCacheEntry) +
+           trie->nodeBlocksCap * sizeof(TrieNode *) +
+           trie->tableBlocksCap * sizeof(TrieIndex *) +
+           trie->labelBlocksCap * sizeof(char *) +
+           nodeBlocks * NODEBLOCKSIZE * sizeof(TrieNode) +
+           tableBlocks * TABLEBLOCKSIZE * DENSEKIDS * sizeof(TrieIndex) +
+           (size_t)trie->numLabelBlocks * LABELBLOCKSIZE;
+}
+
+void freeTrie(Trie *trie) {
+    unsigned int i;
+    if (trie == NULL)
+        return;
+    for (i = 0; i * NODEBLOCKSIZE < trie->numNodes; i++)
+        free(trie->nodeBlocks[i]);
+    for (i = 0; i * TABLEBLOCKSIZE < trie->numTables; i++)
+        free(trie->tableBlocks[i]);
+    for (i = 0; i < trie->numLabelBlocks; i++)
+        free(trie->labelBlocks[i]);
+    free(trie->nodeBlocks);
+    free(trie->tableBlocks);
+    free(trie->labelBlocks);
+    free(trie->wordCache);
+    free(trie);
+}
+
+/*
+ * steps through a node's children in char order.
+ * pos is where to resume from and is updated to just past the kid
+ * returned. returns TRIEROOT when there are no kids left
+ */
+static TrieIndex nextTrieKid(Trie *trie, TrieNode *node, int *pos,
+                             unsigned char *key) {
+    TrieIndex *table;
+    if (isDenseTrieNode(node)) {
+        table = getTrieTable(trie, node->kids[0]);
+        for (; *pos < DENSEKIDS; (*pos)++) {
+            if (table[*pos] != TRIEROOT) {
+                *key = (unsigned char)*pos;
+                return table[(*pos)++];
+            }
+        }
+    } else if (*pos < node->numKids) {
+        *key = node->keys[*pos];
+        return node->kids[(*pos)++];
+    }
+    return TRIEROOT;
+}
+
+/* same as nextTrieKid but backwards, pos starts at lastTriePos */
+static TrieIndex prevTrieKid(Trie *trie, TrieNode *node, int *pos,
+                             unsigned char *key) {
+    TrieIndex *table;
+    if (isDenseTrieNode(node)) {
+        table = getTrieTable(trie, node->kids[0]);
+        for (; *pos > 0; (*pos)--) {
+            if (table[*pos - 1] != TRIEROOT) {
+                *key = (unsigned char)(*pos - 1);
+                return table[--(*pos)];
+            }
+        }
+    } else if (*pos > 0) {
+        (*pos)--;
+        *key = node->keys[*pos];
+        return node->kids[*pos];
+    }
+    return TRIEROOT;
+}
+
+/* where prevTrieKid starts from for node */
+static int lastTriePos(TrieNode *node) {
+    return (isDenseTrieNode(node) ? DENSEKIDS : node->numKids);
+}
+
+/* one level of a depth first walk through a trie */
+struct TrieFrame {
+    TrieIndex node;
+    TrieIndex other; /* matching node in the trie being merged into */
+    int pos;
+    size_t wordLen; /* how long the word ending at node is */
+};
+typedef struct TrieFrame TrieFrame;
+
+/* makes room for one more frame */
+static void growTrieWalk(TrieFrame **stack, size_t *cap, size_t depth) {
+    if (depth + 1 < *cap)
+        return;
+    *cap = (*cap == 0 ? 64 : *cap * 2);
+    *stack = (TrieFrame *)realloc(*stack, *cap * sizeof(TrieFrame));
+    if (*stack == NULL)
+        error(1, errno, "Failed to grow trie walk");
+}
+
+/*
+ * pushes kid (found under key) onto the walk, spelling its edge onto
+ * the end of the word in path, and returns the new depth
+ */
+static size_t pushTrieKid(Trie *trie, TrieFrame **stack, size_t *cap,
+                          size_t depth, char **path, size_t *pathCap,
+                          TrieIndex kid, unsigned char key) {
+    TrieNode *node = getTrieNode(trie, kid);
+    size_t wordLen = (*stack)[depth].wordLen;
+
+    growTrieWalk(stack, cap, depth + 1);
+    while (wordLen + node->labelLen + 1 > *pathCap) {
+        *pathCap = (*pathCap == 0 ? 64 : *pathCap * 2);
+        *path = (char *)realloc(*path, *pathCap);
+        if (*path == NULL)
+            error(1, errno, "Failed to grow trie walk");
+    }
+    (*path)[wordLen] = (char)key;
+    /* there may not be a label block at all when no edge has a label */
+    if (node->labelLen > 0)
+        memcpy(*path + wordLen + 1, getTrieLabel(trie, node->label),
+               node->labelLen);
+    depth++;
+    (*stack)[depth].node = kid;
+    (*stack)[depth].wordLen = wordLen + node->labelLen + 1;
+    return depth;
+}
+
+void forEachTrieWord(Trie *trie,
+                     void (*visit)(void *ctx, TrieIndex index, TrieNode *node,
+                                   const char *word, size_t wordLen),
+                     void *ctx) {
+    TrieFrame *stack = NULL;
+    char *path = NULL;
+    size_t cap = 0, pathCap = 0, depth = 0;
+    TrieNode *node;
+    TrieIndex kid;
+    unsigned char key;
+
+    growTrieWalk(&stack, &cap, depth);
+    stack[0].node = TRIEROOT;
+    stack[0].pos = 0;
+    stack[0].wordLen = 0;
+    while (1) {
+        node = getTrieNode(trie, stack[depth].node);
+        kid = nextTrieKid(trie, node, &stack[depth].pos, &key);
+        if (kid == TRIEROOT) {
+            if (depth == 0)
+                break;
+            depth--;
+            continue;
+        }
+        depth = pushTrieKid(trie, &stack, &cap, depth, &path, &pathCap, kid,
+                            key);
+        stack[depth].pos = 0;
+        node = getTrieNode(trie, kid);
+        if (node->count > 0)
+            visit(ctx, kid, node, path, stack[depth].wordLen);
+    }
+    free(stack);
+    free(path);
+}
+
+void forEachTrieWordDescending(Trie *trie,
+                               int (*visit)(void *ctx, TrieIndex index,
+                                            TrieNode *node, const char *word,
+                                            size_t wordLen),
+                               void *ctx) {
+    TrieFrame *stack = NULL;
+    char *path = NULL;
+    size_t cap = 0, pathCap = 0, depth = 0;
+    TrieNode *node;
+    TrieIndex kid;
+    unsigned char key;
+
+    growTrieWalk(&stack, &cap, depth);
+    stack[0].node = TRIEROOT;
+    stack[0].pos = lastTriePos(getTrieNode(trie, TRIEROOT));
+    stack[0].wordLen = 0;
+    while (1) {
+        node = getTrieNode(trie, stack[depth].node);
+        kid = prevTrieKid(trie, node, &stack[depth].pos, &key);
+        if (kid == TRIEROOT) {
+            /* every longer word under it has been visited */
+            if (depth == 0)
+                break;
+            if (node->count > 0 && visit(ctx, stack[depth].node, node, path,
+                                         stack[depth].wordLen))
+                break;
+            depth--;
+            continue;
+        }
+        depth = pushTrieKid(trie, &stack, &cap, depth, &path, &pathCap, kid,
+                            key);
+        stack[depth].pos = lastTriePos(getTrieNode(trie, kid));
+    }
+    free(stack);
+    free(path);
+}
+
+void mergeTrie(Trie *into, Trie *from) {
+    TrieFrame *stack = NULL;
+    char *path = NULL;
+    size_t cap = 0, pathCap = 0, depth = 0, start;
+    TrieNode *node;
+    TrieIndex kid;
+    unsigned char key;
+
+    growTrieWalk(&stack, &cap, depth);
+    stack[0].node = TRIEROOT;
+    stack[0].other = TRIEROOT;
+    stack[0].pos = 0;
+    stack[0].wordLen = 0;
+    while (1) {
+        node = getTrieNode(from, stack[depth].node);
+        kid = nextTrieKid(from, node, &stack[depth].pos, &key);
+        if (kid == TRIEROOT) {
+            if (depth == 0)
+                break;
+            depth--;
+            continue;
+        }
+        /* the edges of the two tries needn't line up, so from's edge is
+         * spelled out from wherever its parent's word ends in into */
+        start = stack[depth].wordLen;
+        depth = pushTrieKid(from, &stack, &cap, depth, &path, &pathCap, kid,
+                            key);
+        stack[depth].pos = 0;
+        stack[depth].other =
+            walkTrieBytes(into, stack[depth - 1].other, path + start,
+                          stack[depth].wordLen - start);
+        getTrieNode(into, stack[depth].other)->count +=
+            getTrieNode(from, kid)->count;
+    }
+    free(stack);
+    free(path);
+}
@@ -0,0 +1,159 @@
+#ifndef TRIE_H
+#define TRIE_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * index of a node in a Trie's node arena.
+ * the root is always node 0 and can never be somebody's child
+ * so a kid index of 0 doubles as "no such child"
+ */
+typedef unsigned int TrieIndex;
+
+#define TRIEROOT 0
+/* number of children stored inline before a node goes dense */
+#define SPARSEKIDS 6
+/* one slot per possible byte once a node is dense */
+#define DENSEKIDS 256
+/* nodes and dense tables are handed out from blocks of 2^bits */
+#define NODEBLOCKBITS 16
+#define NODEBLOCKSIZE (1 << NODEBLOCKBITS)
+#define TABLEBLOCKBITS 8
+#define TABLEBLOCKSIZE (1 << TABLEBLOCKBITS)
+
+/* the most bytes of an edge a node's label holds, longer runs are chained */
+#define MAXTRIELABEL 255
+/* labels are copied into blocks of 2^bits bytes, which they never span */
+#define LABELBLOCKBITS 16
+#define LABELBLOCKSIZE (1 << LABELBLOCKBITS)
+
+/* words up to this long are remembered in the word cache */
+#define CACHEDWORDLEN 16
+#define WORDCACHEBITS 12
+#define WORDCACHESIZE (1 << WORDCACHEBITS)
+
+/*
+ * Used in a Trie data structure that is created
+ * as the inputs are read.
+ * if it is the end of a word count is > 0.
+ * parent lets a word be spelled out from its last node alone
+ *
+ * the trie is a radix trie: a run of nodes that would each have had
+ * one child and no count is a single node instead. the edge from a
+ * node's parent is the key it is found under in the parent followed
+ * by the node's label, labelLen bytes in the trie's label pool. an
+ * edge is only split when a word leaves it part way, so a long word
+ * that nothing else shares is a node or two rather than one per char
+ *
+ * while numKids <= SPARSEKIDS the children live in kids[] with
+ * their characters in the matching slot of keys[], sorted by char.
+ * past that the node is dense, numKids stays at SPARSEKIDS + 1 and
+ * kids[0] is the index of a DENSEKIDS long table indexed directly
+ * by char
+ */
+struct TrieNode {
+    int count;
+    TrieIndex parent; /* TRIEROOT for the root itself */
+    TrieIndex label;  /* where the label starts in the pool */
+    unsigned char numKids;
+    unsigned char labelLen;
+    unsigned char keys[SPARSEKIDS];
+    TrieIndex kids[SPARSEKIDS];
+};
+typedef struct TrieNode TrieNode;
+
+/*
+ * a short word and the node it ends at. the word is stored zero
+ * padded so checking for a hit is two compares rather than a walk
+ * down the trie with a dependent load per character
+ */
+struct WordCacheEntry {
+    uint64_t word[CACHEDWORDLEN / 8];
+    unsigned int wordLen; /* 0 if the entry is empty */
+    TrieIndex node;
+};
+typedef struct WordCacheEntry WordCacheEntry;
+
+/*
+ * owns every node, dense table and label in the trie.
+ * nothing inside is malloced individually so the whole
+ * thing is released with a handful of frees in freeTrie
+ */
+struct Trie {
+    TrieNode **nodeBlocks;
+    TrieIndex **tableBlocks;
+    char **labelBlocks;
+    unsigned int numNodes;
+    unsigned int numTables;
+    unsigned int nodeBlocksCap;
+    unsigned int tableBlocksCap;
+    unsigned int numLabelBlocks;
+    unsigned int labelBlocksCap;
+    size_t labelBytes; /* where the next label goes in the pool */
+    /* direct mapped cache of recently inserted short words */
+    WordCacheEntry *wordCache;
+};
+typedef struct Trie Trie;
+
+/* looks up a node by index. index must have come from this trie */
+#define getTrieNode(trie, index)                                              \
+    (&(trie)->nodeBlocks[(index) >> NODEBLOCKBITS]                            \
+                        [(index) & (NODEBLOCKSIZE - 1)])
+
+#define isDenseTrieNode(node) ((node)->numKids > SPARSEKIDS)
+
+/* the bytes of a node's label. label must have come from this trie */
+#define getTrieLabel(trie, label)                                             \
+    ((trie)->labelBlocks[(label) >> LABELBLOCKBITS] +                         \
+     ((label) & (LABELBLOCKSIZE - 1)))
+
+/* trie constructor. the returned trie already contains the root node */
+Trie *constructTrie(void);
+
+/*
+ * walks (creating as needed) the nodes spelling word and returns the last.
+ * short words are looked up in the word cache first since real text
+ * keeps coming back to the same few words
+ */
+TrieIndex insertTrieWord(Trie *trie, const char *word, size_t wordLen);
+
+/*
+ * calls visit for every word in the trie (every node with a count)
+ * in lexicographic order along with its index and the word itself.
+ * the word is not null terminated and only valid during the call
+ */
+void forEachTrieWord(Trie *trie,
+                     void (*visit)(void *ctx, TrieIndex index, TrieNode *node,
+                                   const char *word, size_t wordLen),
+                     void *ctx);
+
+/*
+ * calls visit for words in the trie in reverse lexicographic order
+ * (a word comes after every word it is the start of) until visit
+ * returns non zero. the order ties on a count are ranked in, so the
+ * best few of a lot of words with the same count are found without
+ * going through all of them
+ */
+void forEachTrieWordDescending(Trie *trie,
+                               int (*visit)(void *ctx, TrieIndex index,
+                                            TrieNode *node, const char *word,
+                                            size_t wordLen),
+                               void *ctx);
+
+/*
+ * spells out the word ending at index by following parents up to the
+ * root, into *buf which is grown to fit (*cap is its size).
+ * returns the word's length, the word is not null terminated
+ */
+size_t getTrieWord(Trie *trie, TrieIndex index, char **buf, size_t *cap);
+
+/* adds every word and count in from to into. from is left as is */
+void mergeTrie(Trie *into, Trie *from);
+
+/* how many bytes the trie's blocks, tables and labels take up */
+size_t getTrieBytes(const Trie *trie);
+
+/* frees every block the trie owns along with the trie itself */
+void freeTrie(Trie *trie);
+
+#endif /* TRIE_H */
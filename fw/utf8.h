@@ -0,0 +1,49 @@
+#ifndef UTF8_H
+#define UTF8_H
+#include <stdint.h>
+
+/*
+ * states of the table driven UTF-8 decoder. a code point is complete
+ * whenever the decoder is back in UTF8ACCEPT and a byte that can't go
+ * where it is puts it in UTF8REJECT. the AFTER states are after the
+ * lead bytes whose next byte has a narrower range than usual (no
+ * overlong forms, surrogates or code points past U+10FFFF)
+ */
+enum Utf8State {
+    UTF8ACCEPT,
+    UTF8REJECT,
+    UTF8NEED1, /* continuation bytes still to come */
+    UTF8NEED2,
+    UTF8NEED3,
+    UTF8AFTERE0,
+    UTF8AFTERED,
+    UTF8AFTERF0,
+    UTF8AFTERF4,
+    UTF8NUMSTATES
+};
+typedef enum Utf8State Utf8State;
+
+/* bytes fall into this many classes as far as the decoder cares */
+#define UTF8NUMCLASSES 12
+
+/* the class of every byte */
+extern const unsigned char utf8ByteClasses[256];
+/* the state after a byte of each class in each state */
+extern const unsigned char utf8Transitions[UTF8NUMSTATES][UTF8NUMCLASSES];
+/* the bits of a lead byte of each class that belong to the code point */
+extern const unsigned char utf8LeadMasks[UTF8NUMCLASSES];
+
+/*
+ * whether a code point past ASCII ends a word, which ASCII leaves to
+ * isgraph. the controls and every kind of space (Unicode's White_Space)
+ * end words, everything else is part of one
+ */
+int isBreakCodePoint(uint32_t cp);
+
+/* simple (one code point to one code point) Unicode case folding */
+uint32_t foldCodePoint(uint32_t cp);
+
+/* writes cp to out as UTF-8 returning how many bytes it took (1 to 4) */
+int encodeUtf8(uint32_t cp, unsigned char *out);
+
+#endif /* UTF8_H */
@@ -0,0 +1,328 @@
+#include "window.h"
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+#include <string.h>
+
+Window *constructWindow(int numPeriods) {
+    Window *window = (Window *)calloc(1, sizeof(Window));
+    if (window == NULL)
+        error(1, errno, "Failed to allocate window");
+    window->table = constructHashTable();
+    window->numPeriods = numPeriods;
+    window->logs = (HashIndex **)calloc(numPeriods, sizeof(HashIndex *));
+    window->logLens = (size_t *)calloc(numPeriods, sizeof(size_t));
+    window->logCaps = (size_t *)calloc(numPeriods, sizeof(size_t));
+    if (window->logs == NULL || window->logLens == NULL ||
+        window->logCaps == NULL)
+        error(1, errno, "Failed to allocate window");
+    window->freeBucket = NOBUCKET;
+    window->highest = NOBUCKET;
+    window->lowest = NOBUCKET;
+    return window;
+}
+
+/* makes sure every word in the table has a link */
+static void growWindowLinks(Window *window) {
+    unsigned int i, numWords = window->table->numWords;
+    if (numWords <= window->linksCap)
+        return;
+    i = window->linksCap;
+    window->linksCap = numWords * 2;
+    window->links = (WindowLink *)realloc(
+        window->links, window->linksCap * sizeof(WindowLink));
+    if (window->links == NULL)
+        error(1, errno, "Failed to grow window");
+    for (; i < window->linksCap; i++)
+        window->links[i].bucket = NOBUCKET;
+}
+
+/*
+ * makes an empty bucket for count and puts it right above bucket to,
+ * or right below it if above is 0. to == NOBUCKET means there are no
+ * buckets yet
+ */
+static int newWindowBucket(Window *window, int count, int to, int above) {
+    WindowBucket *bucket;
+    int b;
+
+    if (window->freeBucket != NOBUCKET) {
+        b = window->freeBucket;
+        window->freeBucket = window->buckets[b].next;
+    } else {
+        if (window->numBuckets == window->bucketsCap) {
+            window->bucketsCap =
+                (window->bucketsCap == 0 ? 64 : window->bucketsCap * 2);
+            window->buckets = (WindowBucket *)realloc(
+                window->buckets, window->bucketsCap * sizeof(WindowBucket));
+            if (window->buckets == NULL)
+                error(1, errno, "Failed to grow window");
+        }
+        b = window->numBuckets++;
+    }
+    bucket = &window->buckets[b];
+    bucket->count = count;
+    bucket->root = HASHEMPTY;
+    if (to == NOBUCKET) {
+        bucket->prev = bucket->next = NOBUCKET;
+        window->lowest = window->highest = b;
+    } else if (above) {
+        bucket->prev = to;
+        bucket->next = window->buckets[to].next;
+        window->buckets[to].next = b;
+        if (bucket->next == NOBUCKET)
+            window->highest = b;
+        else
+            window->buckets[bucket->next].prev = b;
+    } else {
+        bucket->next = to;
+        bucket->prev = window->buckets[to].prev;
+        window->buckets[to].prev = b;
+        if (bucket->prev == NOBUCKET)
+            window->lowest = b;
+        else
+            window->buckets[bucket->prev].next = b;
+    }
+    return b;
+}
+
+/*
+ * > 0 if word a ranks above word b in a bucket, as compTopWord has it.
+ * words never hold a 0 byte so the prefixes settle it unless both
+ * start with the same 8 bytes
+ */
+static int rankWindowWords(Window *window, HashIndex a, HashIndex b) {
+    const WindowLink *aLink = &window->links[a], *bLink = &window->links[b];
+    const HashWord *aEntry, *bEntry;
+
+    if (aLink->prefix != bLink->prefix)
+        return (aLink->prefix > bLink->prefix ? 1 : -1);
+    aEntry = getHashWord(window->table, a);
+    bEntry = getHashWord(window->table, b);
+    return compTopWord(0, aEntry->word, aEntry->wordLen, 0, bEntry->word,
+                       bEntry->wordLen);
+}
+
+#define windowPriority(window, word) ((window)->links[word].priority)
+
+/* adds word to the treap at root and returns its new root */
+static HashIndex insertBucketWord(Window *window, HashIndex root,
+                                  HashIndex word) {
+    WindowLink *links = window->links;
+    HashIndex kid;
+
+    if (root == HASHEMPTY)
+        return word;
+    if (rankWindowWords(window, word, root) > 0) {
+        kid = links[root].above = insertBucketWord(window, links[root].above,
+                                                   word);
+        if (windowPriority(window, kid) > windowPriority(window, root)) {
+            links[root].above = links[kid].below;
+            links[kid].below = root;
+            return kid;
+        }
+    } else {
+        kid = links[root].below = insertBucketWord(window, links[root].below,
+                                                   word);
+        if (windowPriority(window, kid) > windowPriority(window, root)) {
+            links[root].below = links[kid].above;
+            links[kid].above = root;
+            return kid;
+        }
+    }
+    return root;
+}
+
+/* joins two treaps where everything in below ranks below all of above */
+static HashIndex joinBucketWords(Window *window, HashIndex below,
+                                 HashIndex above) {
+    WindowLink *links = window->links;
+
+    if (below == HASHEMPTY)
+        return above;
+    if (above == HASHEMPTY)
+        return below;
+    if (windowPriority(window, below) > windowPriority(window, above)) {
+        links[below].above =
+            joinBucketWords(window, links[below].above, above);
+        return below;
+    }
+    links[above].below = joinBucketWords(window, below, links[above].below);
+    return above;
+}
+
+/* takes word out of the treap at root and returns its new root */
+static HashIndex removeBucketWord(Window *window, HashIndex root,
+                                  HashIndex word) {
+    WindowLink *links = window->links;
+
+    if (root == word)
+        return joinBucketWords(window, links[word].below, links[word].above);
+    if (rankWindowWords(window, word, root) > 0)
+        links[root].above = removeBucketWord(window, links[root].above, word);
+    else
+        links[root].below = removeBucketWord(window, links[root].below, word);
+    return root;
+}
+
+/* takes the word out of its bucket dropping the bucket if it empties */
+static void unlinkWindowWord(Window *window, HashIndex word) {
+    WindowLink *link = &window->links[word];
+    WindowBucket *bucket = &window->buckets[link->bucket];
+    int b = link->bucket;
+
+    bucket->root = removeBucketWord(window, bucket->root, word);
+    link->bucket = NOBUCKET;
+    if (bucket->root != HASHEMPTY)
+        return;
+
+    if (bucket->prev != NOBUCKET)
+        window->buckets[bucket->prev].next = bucket->next;
+    else
+        window->lowest = bucket->next;
+    if (bucket->next != NOBUCKET)
+        window->buckets[bucket->next].prev = bucket->prev;
+    else
+        window->highest = bucket->prev;
+    bucket->next = window->freeBucket;
+    window->freeBucket = b;
+}
+
+static void linkWindowWord(Window *window, HashIndex word, int b) {
+    WindowLink *link = &window->links[word];
+    WindowBucket *bucket = &window->buckets[b];
+
+    link->bucket = b;
+    link->below = link->above = HASHEMPTY;
+    bucket->root = insertBucketWord(window, bucket->root, word);
+}
+
+/* sets what a word coming into the window is ranked and balanced by */
+static void keyWindowWord(Window *window, HashIndex word) {
+    WindowLink *link = &window->links[word];
+    const HashWord *entry = getHashWord(window->table, word);
+    size_t i;
+
+    link->prefix = 0;
+    for (i = 0; i < 8; i++) {
+        link->prefix <<= 8;
+        if (i < entry->wordLen)
+            link->prefix |= (unsigned char)entry->word[i];
+    }
+    link->priority = entry->hash;
+}
+
+/* moves the word to the bucket one count up */
+static void bumpWindowWord(Window *window, HashIndex word) {
+    int b = window->links[word].bucket, to, count;
+
+    if (b == NOBUCKET) {
+        window->numDistinct++;
+        keyWindowWord(window, word);
+        to = window->lowest;
+        if (to == NOBUCKET || window->buckets[to].count != 1)
+            to = newWindowBucket(window, 1, to, 0);
+        linkWindowWord(window, word, to);
+        return;
+    }
+    count = window->buckets[b].count + 1;
+    to = window->buckets[b].next;
+    if (to == NOBUCKET || window->buckets[to].count != count)
+        to = newWindowBucket(window, count, b, 1);
+    unlinkWindowWord(window, word);
+    linkWindowWord(window, word, to);
+}
+
+/* moves the word to the bucket one count down or out of the window */
+static void dropWindowWord(Window *window, HashIndex word) {
+    int b = window->links[word].bucket, to, count;
+
+    count = window->buckets[b].count - 1;
+    if (count == 0) {
+        window->numDistinct--;
+        unlinkWindowWord(window, word);
+        /* nothing logged refers to it any more */
+        deleteHashWord(window->table, word);
+        return;
+    }
+    to = window->buckets[b].prev;
+    if (to == NOBUCKET || window->buckets[to].count != count)
+        to = newWindowBucket(window, count, b, 0);
+    unlinkWindowWord(window, word);
+    linkWindowWord(window, word, to);
+}
+
+void countWindowWord(Window *window, const char *word, size_t wordLen) {
+    HashIndex index = insertHashWord(window->table, word, wordLen);
+    int p = window->period;
+
+    growWindowLinks(window);
+    bumpWindowWord(window, index);
+    if (window->logLens[p] == window->logCaps[p]) {
+        window->logCaps[p] =
+            (window->logCaps[p] == 0 ? 1024 : window->logCaps[p] * 2);
+        window->logs[p] = (HashIndex *)realloc(
+            window->logs[p], window->logCaps[p] * sizeof(HashIndex));
+        if (window->logs[p] == NULL)
+            error(1, errno, "Failed to grow window");
+    }
+    window->logs[p][window->logLens[p]++] = index;
+}
+
+/* adds the words of a bucket's treap best first until top is full */
+static void topBucketWords(Window *window, TopWords *top, int count,
+                           HashIndex root) {
+    const HashWord *entry;
+
+    if (root == HASHEMPTY || top->len == top->n)
+        return;
+    topBucketWords(window, top, count, window->links[root].above);
+    if (top->len == top->n)
+        return;
+    entry = getHashWord(window->table, root);
+    /* they come in rank order so each one just goes in */
+    updateTopWords(top, count, NULL, entry->word, entry->wordLen);
+    topBucketWords(window, top, count, window->links[root].below);
+}
+
+TopWords *topWindowWords(Window *window, int n) {
+    TopWords *top = constructTopWords(n);
+    int b;
+
+    /* a lower bucket can't beat any of n words that are already in */
+    for (b = window->highest; b != NOBUCKET && top->len < n;
+         b = window->buckets[b].prev)
+        topBucketWords(window, top, window->buckets[b].count,
+                       window->buckets[b].root);
+    sortTopWords(top);
+    top->total = window->numDistinct;
+    return top;
+}
+
+void nextWindowPeriod(Window *window) {
+    HashIndex *log;
+    size_t i;
+    int p;
+
+    p = window->period = (window->period + 1) % window->numPeriods;
+    /* whatever was read numPeriods periods ago falls out of the window */
+    log = window->logs[p];
+    for (i = 0; i < window->logLens[p]; i++)
+        dropWindowWord(window, log[i]);
+    window->logLens[p] = 0;
+}
+
+void freeWindow(Window *window) {
+    int p;
+    if (window == NULL)
+        return;
+    for (p = 0; p < window->numPeriods; p++)
+        free(window->logs[p]);
+    free(window->logs);
+    free(window->logLens);
+    free(window->logCaps);
+    free(window->buckets);
+    free(window->links);
+    freeHashTable(window->table);
+    free(window);
+}
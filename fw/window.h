@@ -0,0 +1,91 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+#include "hashtable.h"
+#include "topwords.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* bucket index meaning there isn't one */
+#define NOBUCKET -1
+
+/*
+ * every word with the same count is in the same bucket and the buckets
+ * are kept in order of count, so a word's count changing by one only
+ * ever moves it to the next bucket over (Stream-Summary). the words in
+ * a bucket are a treap in the order they rank in (their priority is
+ * their hash) so the best of a bucket can be had without looking at
+ * the rest, which matters for the count 1 bucket
+ */
+struct WindowBucket {
+    int count;
+    int prev; /* bucket with the next lower count */
+    int next; /* bucket with the next higher count (or next free bucket) */
+    HashIndex root; /* words in the bucket, linked through WindowLink */
+};
+typedef struct WindowBucket WindowBucket;
+
+/* what the window keeps for each word in its hash table */
+struct WindowLink {
+    uint64_t prefix; /* the first 8 bytes big endian, to rank by */
+    uint32_t priority;
+    int bucket; /* NOBUCKET while the word isn't in the window */
+    HashIndex below; /* words in the bucket ranked below this one */
+    HashIndex above;
+};
+typedef struct WindowLink WindowLink;
+
+/*
+ * counts of the words in the last numPeriods periods.
+ * the words are kept in a HashTable (whose counts aren't used) for their
+ * strings and every word read is logged with the period it was read in.
+ * once a period falls out of the window its log is played back taking
+ * one off each word, so nothing is ever recounted and a period costs
+ * the same to forget as it did to count. a word that falls out of the
+ * window altogether is deleted from the table so it only ever holds
+ * the words in the window.
+ * a window one period long starts over every period (tumbling),
+ * otherwise it slides along by a period at a time
+ */
+struct Window {
+    HashTable *table;
+    WindowLink *links; /* indexed by HashIndex */
+    unsigned int linksCap;
+    WindowBucket *buckets;
+    int bucketsCap;
+    int numBuckets;
+    int freeBucket; /* first unused bucket in buckets, NOBUCKET if none */
+    int highest;    /* bucket with the highest count */
+    int lowest;     /* bucket with the lowest count */
+    int numDistinct;
+    HashIndex **logs; /* words read in each period */
+    size_t *logLens;
+    size_t *logCaps;
+    int numPeriods;
+    int period; /* the one being read */
+};
+typedef struct Window Window;
+
+/* window constructor for a window numPeriods periods long */
+Window *constructWindow(int numPeriods);
+
+/* counts a word in the current period */
+void countWindowWord(Window *window, const char *word, size_t wordLen);
+
+/*
+ * picks the n highest ranked words in the window sorted the same way
+ * sortTopWords does, with total set to the number of different words.
+ * the buckets are walked from the highest count down, each in rank
+ * order, so only the n words picked (and the treap paths down to
+ * them) are looked at however many words the window holds
+ */
+TopWords *topWindowWords(Window *window, int n);
+
+/*
+ * starts the next period, forgetting the oldest one if the window
+ * is already full
+ */
+void nextWindowPeriod(Window *window);
+
+void freeWindow(Window *window);
+
+#endif /* WINDOW_H */
@@ -1,8 +1,10 @@
 #include "huffman.h"
+#include "libhuffman.h"
 #include <arpa/inet.h>
 #include <errno.h>
 #include <error.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,115 +15,1032 @@
 #include "printfuncs.h"
 #endif /* PRINTFUNCS_H */
 
-unsigned int *decodeHeaderToFreqTable(int filedes, int *hnodetablelen) {
-    uint8_t numchars = 0;
-    unsigned char ch[1] = {'\0'};
-    uint32_t count = 0;
-    int i;
+/*
+ * reads the header of the original format. the first gotlen bytes of
+ * it have already been read (looking for the block format's magic)
+ * and are in got
+ */
+unsigned int *decodeHeaderToFreqTable(int filedes, int *hnodetablelen,
+                                      const unsigned char *got,
+                                      int gotlen) {
+    /* numchars - 1 | [ char  count ] * numchars */
+    unsigned char header[1 + 5 * 256];
+    int numchars, headerlen, i;
+    ssize_t rest;
+    unsigned char *entry;
     unsigned int *charFreqTable =
         (unsigned int *)calloc(CHARFREQTABLESIZE, sizeof(unsigned int));
     if (charFreqTable == NULL) {
         return NULL;
     }
-    if (read(filedes, &numchars, 1) < 0) {
+    memcpy(header, got, gotlen);
+    if (gotlen == 0 && (gotlen = readAll(filedes, header, 1)) <= 0) {
+        /* an empty file */
+        *hnodetablelen = 0;
+        return (gotlen == 0 ? charFreqTable : NULL);
+    }
+    numchars = header[0] + 1;
+    headerlen = 1 + 5 * numchars;
+    rest = readAll(filedes, header + gotlen, headerlen - gotlen);
+    if (rest == -1) {
         return NULL;
     }
-    *hnodetablelen = numchars + 1;
-    /* printf("count: %d\n", numchars); */
-    for (i = 0; i <= numchars; i++) {
-        if (read(filedes, ch, 1) < 0) {
-            return NULL;
-        }
-        if (read(filedes, &count, 4) < 0) {
+    if (rest < headerlen - gotlen) {
+        errno = EINVAL;
+        return NULL;
+    }
+    *hnodetablelen = numchars;
+    for (i = 0; i < numchars; i++) {
+        entry = header + 1 + 5 * i;
+        /* every char has to come once with a count, the tree is built
+         * from exactly numchars of them */
+        if (charFreqTable[entry[0]] != 0 || getBigEndian(entry + 1, 4) == 0) {
+            free(charFreqTable);
+            errno = EINVAL;
             return NULL;
         }
-        count = ntohl(count);
-        /* printf("%*s : %u\n", 4, printCh(*ch), ntohl(count)); */
-        charFreqTable[*ch] = count;
+        charFreqTable[entry[0]] = (unsigned int)getBigEndian(entry + 1, 4);
     }
     return charFreqTable;
 }
 
+/*
+ * the decoder looks codes up in tables rather than walking the tree a
+ * bit at a time. the first table has an entry for every value of the
+ * next DECODEBITS bits of input giving every symbol whose code is
+ * wholly inside them (up to MAXDECODESYMS), so one load usually
+ * decodes a few symbols. codes longer than DECODEBITS go on to a sub
+ * table for the node the first DECODEBITS bits lead to, indexed by
+ * the bits after that, and so on for however long the code is
+ */
+#define DECODEBITS 11
+#define MAXDECODESYMS 4
+/* table lookups per refill of the bit buffer. a refill leaves at
+ * least 56 bits in it and every lookup takes at most DECODEBITS */
+#define DECODESTEPS (56 / DECODEBITS)
+/* messages of fewer chars than this are decoded by the canonical
+ * codes a bit at a time, which costs less than filling the table */
+#define SMALLDECODE (1 << DECODEBITS)
+/* bytes of encoded input read at a time */
+#define DECODEBUFSIZE (1 << 16)
+/* bytes kept in front of each input buffer for what was left of the
+ * one before, which is always less than a load of the bit buffer */
+#define DECODEHEADROOM 8
+/* bytes of decoded output written at a time */
+#define DECODEOUTSIZE (1 << 18)
+
+typedef struct DecodeEntry {
+    union {
+        unsigned char syms[MAXDECODESYMS];
+        uint32_t subtable; /* where the sub table starts in entries */
+    } u;
+    /* symbols the index starts with, 0 if the first code is longer
+     * than the index and goes on in the sub table */
+    unsigned char numsyms;
+    /* bits the symbols take up, 0 for a sub table so a lookup that
+     * lands on one takes no input and lands on it again */
+    unsigned char bits;
+    unsigned char firstbits; /* bits the first symbol takes up alone */
+    unsigned char subbits;   /* bits the sub table is indexed by */
+} DecodeEntry;
+
+typedef struct DecodeTable {
+    /* the first table followed by every sub table */
+    DecodeEntry *entries;
+    unsigned int numentries;
+    unsigned int cap;
+} DecodeTable;
+
+/*
+ * two buffers handed back and forth between the decoder and a thread
+ * reading its input or writing its output, so the thread can be busy
+ * with one while the decoder is busy with the other. buffers are
+ * used in turn, full[i] says whose turn it is with buffer i
+ */
+typedef struct BufferPair {
+    int fd;
+    char *bufs[2];
+    size_t lens[2];
+    int full[2];
+    int stopped; /* set by either side to make the other give up */
+    int err;     /* errno from the thread's read or write */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+} BufferPair;
+
+/*
+ * encoded input being read MSB first. bits holds the next count bits
+ * left aligned (the rest are 0) and in is the next byte not in bits.
+ * input comes from buffer cur of the reading thread's pair
+ */
+typedef struct BitReader {
+    BufferPair *input;
+    int cur;
+    const unsigned char *in;
+    const unsigned char *end;
+    uint64_t bits;
+    int count;
+    int eof;
+} BitReader;
+
+static int getHuffmanTreeHeight(HuffmanNode *hnode) {
+    int left, right;
+    if (hnode->left == NULL && hnode->right == NULL) {
+        return 0;
+    }
+    left = getHuffmanTreeHeight(hnode->left);
+    right = getHuffmanTreeHeight(hnode->right);
+    return 1 + (left > right ? left : right);
+}
+
+/*
+ * adds a table of 2^tablebits entries, setting *base to where it
+ * starts. returns 0 with errno ENOMEM if there's no room for it, the
+ * table being left as it was
+ */
+static int addDecodeTable(DecodeTable *dtable, int tablebits,
+                          unsigned int *base) {
+    unsigned int len = 1u << tablebits, cap = dtable->cap;
+    DecodeEntry *entries;
+    *base = dtable->numentries;
+    if (*base + len > cap) {
+        while (*base + len > cap) {
+            cap = (cap == 0 ? 1u << DECODEBITS : cap * 2);
+        }
+        entries = (DecodeEntry *)realloc(dtable->entries,
+                                         cap * sizeof(DecodeEntry));
+        if (entries == NULL) {
+            errno = ENOMEM;
+            return 0;
+        }
+        dtable->entries = entries;
+        dtable->cap = cap;
+    }
+    dtable->numentries += len;
+    return 1;
+}
+
+/*
+ * fills in the table at base, indexed by the tablebits bits of input
+ * after the path to start, by following every index down the tree.
+ * multi lets an entry go on from the root for more symbols once the
+ * first is done, which is only worth it in the first table. returns 0
+ * if there's no memory for a sub table
+ */
+static int fillDecodeTable(DecodeTable *dtable, unsigned int base,
+                           int tablebits, HuffmanNode *start,
+                           HuffmanNode *htree, int multi) {
+    unsigned int i, sub;
+    int bit, used, numsyms, symbits, firstbits, subbits, height;
+    unsigned char syms[MAXDECODESYMS];
+    HuffmanNode *cur;
+    DecodeEntry *entry;
+
+    for (i = 0; i < (1u << tablebits); i++) {
+        cur = start;
+        numsyms = symbits = firstbits = 0;
+        for (used = 1, bit = tablebits - 1; bit >= 0; used++, bit--) {
+            cur = ((i >> bit) & 1 ? cur->right : cur->left);
+            if (cur->left != NULL || cur->right != NULL) {
+                continue;
+            }
+            syms[numsyms++] = cur->ch;
+            symbits = used;
+            if (numsyms == 1) {
+                firstbits = used;
+            }
+            if (!multi || numsyms == MAXDECODESYMS) {
+                break;
+            }
+            cur = htree;
+        }
+        if (numsyms == 0) {
+            /* the code goes on past the index so cur is where */
+            height = getHuffmanTreeHeight(cur);
+            subbits = (height < DECODEBITS ? height : DECODEBITS);
+            if (!addDecodeTable(dtable, subbits, &sub) ||
+                !fillDecodeTable(dtable, sub, subbits, cur, htree, FALSE)) {
+                return 0;
+            }
+            /* entries may have moved while adding the sub table */
+            entry = &dtable->entries[base + i];
+            entry->u.subtable = sub;
+            entry->bits = 0;
+            entry->subbits = (unsigned char)subbits;
+        } else {
+            entry = &dtable->entries[base + i];
+            memcpy(entry->u.syms, syms, MAXDECODESYMS);
+            entry->bits = (unsigned char)symbits;
+            entry->firstbits = (unsigned char)firstbits;
+            entry->subbits = 0;
+        }
+        entry->numsyms = (unsigned char)numsyms;
+    }
+    return 1;
+}
+
+/*
+ * htree must have at least two leaves. the table's entries are reused
+ * if it already has some. returns 0 with errno ENOMEM if there's no
+ * memory for it
+ */
+static int buildDecodeTable(DecodeTable *dtable, HuffmanNode *htree) {
+    unsigned int base;
+    dtable->numentries = 0;
+    return addDecodeTable(dtable, DECODEBITS, &base) &&
+           fillDecodeTable(dtable, base, DECODEBITS, htree, htree, TRUE);
+}
+
+/*
+ * waits for buffer i to be full (or empty) and returns 1, or 0 if
+ * the other side stopped first
+ */
+static int waitForBuffer(BufferPair *pair, int i, int full) {
+    int ok;
+    pthread_mutex_lock(&pair->lock);
+    while (pair->full[i] != full && !pair->stopped) {
+        pthread_cond_wait(&pair->cond, &pair->lock);
+    }
+    ok = !pair->stopped;
+    pthread_mutex_unlock(&pair->lock);
+    return ok;
+}
+
+/* hands buffer i, holding len bytes if it is full, to the other side */
+static void passBuffer(BufferPair *pair, int i, int full, size_t len) {
+    pthread_mutex_lock(&pair->lock);
+    pair->full[i] = full;
+    pair->lens[i] = len;
+    pthread_cond_broadcast(&pair->cond);
+    pthread_mutex_unlock(&pair->lock);
+}
+
+/* makes whichever side is waiting on the other give up */
+static void stopBufferPair(BufferPair *pair, int err) {
+    pthread_mutex_lock(&pair->lock);
+    pair->stopped = TRUE;
+    if (err != 0) {
+        pair->err = err;
+    }
+    pthread_cond_broadcast(&pair->cond);
+    pthread_mutex_unlock(&pair->lock);
+}
+
+/*
+ * reads into the input buffers in turn, handing each over with
+ * whatever one read got, until a read gets nothing at the end of the
+ * input. it can only be cancelled while it is waiting in read, which
+ * may be forever on a pipe nobody closes
+ */
+static void *readDecodeBuffers(void *arg) {
+    BufferPair *pair = (BufferPair *)arg;
+    ssize_t got;
+    int i, state;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    for (i = 0; waitForBuffer(pair, i, FALSE); i ^= 1) {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
+        got = read(pair->fd, pair->bufs[i] + DECODEHEADROOM, DECODEBUFSIZE);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+        if (got < 0) {
+            stopBufferPair(pair, errno);
+            break;
+        }
+        passBuffer(pair, i, TRUE, got);
+        if (got == 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* writes out the output buffers in turn until one comes empty */
+static void *writeDecodeBuffers(void *arg) {
+    BufferPair *pair = (BufferPair *)arg;
+    size_t len;
+    ssize_t put;
+    int i;
+
+    for (i = 0; waitForBuffer(pair, i, TRUE) && pair->lens[i] != 0;
+         i ^= 1) {
+        for (len = 0; len < pair->lens[i]; len += put) {
+            put = write(pair->fd, pair->bufs[i] + len, pair->lens[i] - len);
+            if (put < 0) {
+                stopBufferPair(pair, errno);
+                return NULL;
+            }
+        }
+        passBuffer(pair, i, FALSE, 0);
+    }
+    return NULL;
+}
+
+/*
+ * sets up a pair of buffers of bufsize bytes and starts run on them.
+ * input buffers start out empty for the thread to fill and output
+ * buffers start out empty for the decoder to fill
+ */
+static int startBufferPair(BufferPair *pair, int fd, size_t bufsize,
+                           void *(*run)(void *)) {
+    pair->fd = fd;
+    pair->full[0] = pair->full[1] = FALSE;
+    pair->stopped = FALSE;
+    pair->err = 0;
+    pair->bufs[0] = (char *)malloc(bufsize);
+    pair->bufs[1] = (char *)malloc(bufsize);
+    if (pair->bufs[0] == NULL || pair->bufs[1] == NULL) {
+        free(pair->bufs[0]);
+        free(pair->bufs[1]);
+        return 0;
+    }
+    pthread_mutex_init(&pair->lock, NULL);
+    pthread_cond_init(&pair->cond, NULL);
+    if ((errno = pthread_create(&pair->thread, NULL, run, pair)) != 0) {
+        pthread_mutex_destroy(&pair->lock);
+        pthread_cond_destroy(&pair->cond);
+        free(pair->bufs[0]);
+        free(pair->bufs[1]);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * waits for the thread to finish, or cancels it if cancel is set, and
+ * frees the buffers. returns 0 and sets errno if its reads or writes
+ * failed
+ */
+static int finishBufferPair(BufferPair *pair, int cancel) {
+    if (cancel) {
+        stopBufferPair(pair, 0);
+        pthread_cancel(pair->thread);
+    }
+    pthread_join(pair->thread, NULL);
+    pthread_mutex_destroy(&pair->lock);
+    pthread_cond_destroy(&pair->cond);
+    free(pair->bufs[0]);
+    free(pair->bufs[1]);
+    if (pair->err != 0) {
+        errno = pair->err;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * moves on to the next input buffer, carrying over what's left of the
+ * current one into the room in front of it, and hands the current one
+ * back to be read into again
+ */
+static int readDecodeInput(BitReader *reader) {
+    BufferPair *input = reader->input;
+    int next = (reader->cur == -1 ? 0 : reader->cur ^ 1);
+    size_t left = reader->end - reader->in;
+    unsigned char *buf;
+
+    /* no code is that long unless the header is broken */
+    if (left > DECODEHEADROOM) {
+        errno = EINVAL;
+        return 0;
+    }
+    if (!waitForBuffer(input, next, TRUE)) {
+        return 0;
+    }
+    buf = (unsigned char *)input->bufs[next];
+    if (reader->cur != -1) {
+        memcpy(buf + DECODEHEADROOM - left, reader->in, left);
+        passBuffer(input, reader->cur, FALSE, 0);
+    }
+    reader->cur = next;
+    reader->in = buf + DECODEHEADROOM - left;
+    reader->end = buf + DECODEHEADROOM + input->lens[next];
+    reader->eof = (input->lens[next] == 0);
+    return 1;
+}
+
+/* loads 8 bytes as a big endian number, which gcc makes one load */
+static uint64_t loadBigEndian64(const unsigned char *bytes) {
+    return (uint64_t)bytes[0] << 56 | (uint64_t)bytes[1] << 48 |
+           (uint64_t)bytes[2] << 40 | (uint64_t)bytes[3] << 32 |
+           (uint64_t)bytes[4] << 24 | (uint64_t)bytes[5] << 16 |
+           (uint64_t)bytes[6] << 8 | (uint64_t)bytes[7];
+}
+
+/* tops the bit buffer up a byte at a time from what has been read */
+static void refillBitsCarefully(BitReader *reader) {
+    while (reader->count <= 56 && reader->in < reader->end) {
+        reader->bits |= (uint64_t)*reader->in++ << (56 - reader->count);
+        reader->count += 8;
+    }
+}
+
+/*
+ * decodes one symbol without reading past what has been read. used
+ * near the end of the input and for codes that need a sub table.
+ * returns 0, leaving the reader as it was, if what has been read ends
+ * in the middle of the code
+ */
+static int decodeSymbolCarefully(const DecodeTable *dtable,
+                                 BitReader *reader, char *out) {
+    const DecodeEntry *entry;
+    const unsigned char *in = reader->in;
+    uint64_t bits = reader->bits;
+    int count = reader->count, tablebits = DECODEBITS;
+
+    refillBitsCarefully(reader);
+    entry = &dtable->entries[reader->bits >> (64 - DECODEBITS)];
+    while (entry->numsyms == 0 && tablebits <= reader->count) {
+        reader->bits <<= tablebits;
+        reader->count -= tablebits;
+        refillBitsCarefully(reader);
+        tablebits = entry->subbits;
+        entry = &dtable->entries[entry->u.subtable +
+                                 (reader->bits >> (64 - tablebits))];
+    }
+    if (entry->numsyms == 0 || entry->firstbits > reader->count) {
+        reader->in = in;
+        reader->bits = bits;
+        reader->count = count;
+        return 0;
+    }
+    *out = entry->u.syms[0];
+    reader->bits <<= entry->firstbits;
+    reader->count -= entry->firstbits;
+    return 1;
+}
+
+/*
+ * decodes numchars symbols to out. while there are at least 8 bytes of
+ * input ahead and room for a full batch of symbols the bit buffer is
+ * refilled with a single load and decoded DECODESTEPS lookups at a
+ * time. each lookup writes MAXDECODESYMS bytes whatever it decodes, so
+ * nothing is written past out + numchars. the lookups don't stop for a
+ * code that goes on to a sub table, which is rare enough for the
+ * branch to cost more than the lookups wasted on it, and the code is
+ * decoded carefully after the batch
+ */
+static int decodeSymbols(const DecodeTable *dtable, BitReader *reader,
+                         char *out, size_t numchars) {
+    const DecodeEntry *entries = dtable->entries, *entry;
+    char *outend = out + numchars;
+    const unsigned char *in, *inend;
+    uint64_t bits;
+    int count, step;
+
+    while (out < outend) {
+        /* kept in locals since the compiler can't tell writes to out
+         * don't change them */
+        in = reader->in;
+        bits = reader->bits;
+        count = reader->count;
+        inend = reader->end;
+        while (inend - in >= 8 &&
+               outend - out >= DECODESTEPS * MAXDECODESYMS) {
+            /* takes in as many whole bytes as fit */
+            bits |= loadBigEndian64(in) >> count;
+            in += (63 - count) >> 3;
+            count |= 56;
+            for (step = 0; step < DECODESTEPS; step++) {
+                entry = &entries[bits >> (64 - DECODEBITS)];
+                memcpy(out, entry->u.syms, MAXDECODESYMS);
+                out += entry->numsyms;
+                bits <<= entry->bits;
+                count -= entry->bits;
+            }
+            /* a sub table entry is the last one looked up once one
+             * is reached, as it takes nothing */
+            if (entry->numsyms == 0) {
+                break;
+            }
+        }
+        reader->in = in;
+        reader->bits = bits;
+        reader->count = count;
+        if (out == outend) {
+            break;
+        }
+        if (decodeSymbolCarefully(dtable, reader, out)) {
+            out++;
+            continue;
+        }
+        /* only waits for more input once what it has runs out, which
+         * may never come on a pipe left open past the message */
+        if (reader->eof) {
+            errno = EINVAL;
+            return 0;
+        }
+        if (!readDecodeInput(reader)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 /*
  * assumes infiles current index is the end of the header and the start
  * of the encoded message and that the htree is not a leaf node
- * writes message to output
+ * writes message to output a DECODEOUTSIZE chunk at a time as it is
+ * decoded, while a thread reads ahead and another writes behind
  */
 int decodeInfileMessageToOutfile(int infd, int outfd, HuffmanNode *htree) {
-    char encodingschunk[CHUNKSIZE];
     /* root htree node will always contain total count of chars
      * (or be null)*/
-    int totalnumchars = (htree != NULL ? htree->count : 0);
-    char *messagechunk = (char *)malloc(sizeof(char) * totalnumchars);
-    HuffmanNode *cur = htree;
-    int i, iscurrentbit1, isleafnode, bitindex = 7, index = 0, status = -1,
-                                      flag = 1;
+    size_t numcharsleft = (htree != NULL ? htree->count : 0), len;
+    BufferPair input, output;
+    BitReader reader;
+    DecodeTable dtable;
+    int i, status = 1, reading = FALSE;
+
     /* Edge case: empty file */
-    if (totalnumchars == 0) {
-        goto write;
+    if (numcharsleft == 0) {
+        return 1;
+    }
+    dtable.entries = NULL;
+    dtable.cap = 0;
+    reader.input = &input;
+    reader.cur = -1;
+    reader.in = reader.end = NULL;
+    reader.bits = 0;
+    reader.count = 0;
+    reader.eof = FALSE;
+    if (!startBufferPair(&output, outfd, DECODEOUTSIZE,
+                         writeDecodeBuffers)) {
+        return 0;
+    }
+    /* Edge case: single character, all there is is the header */
+    if (htree->left != NULL || htree->right != NULL) {
+        if (!buildDecodeTable(&dtable, htree) ||
+            !startBufferPair(&input, infd, DECODEHEADROOM + DECODEBUFSIZE,
+                             readDecodeBuffers)) {
+            stopBufferPair(&output, 0);
+            finishBufferPair(&output, FALSE);
+            free(dtable.entries);
+            return 0;
+        }
+        reading = TRUE;
     }
 
-    isleafnode = (cur->left == NULL && cur->right == NULL);
-    /* Edge case: single character */
-    if (isleafnode) {
-        memset(messagechunk, htree->ch, totalnumchars);
-        goto write;
+    for (i = 0; numcharsleft > 0; i ^= 1) {
+        len = (numcharsleft < DECODEOUTSIZE ? numcharsleft : DECODEOUTSIZE);
+        if (!waitForBuffer(&output, i, FALSE)) {
+            status = 0;
+            break;
+        }
+        if (!reading) {
+            memset(output.bufs[i], htree->ch, len);
+        } else if (!decodeSymbols(&dtable, &reader, output.bufs[i], len)) {
+            status = 0;
+            break;
+        }
+        passBuffer(&output, i, TRUE, len);
+        numcharsleft -= len;
+    }
+    /* an empty buffer tells the writer it's done */
+    if (status && waitForBuffer(&output, i, FALSE)) {
+        passBuffer(&output, i, TRUE, 0);
+    } else {
+        stopBufferPair(&output, 0);
+    }
+    /* the input can go on past the message, no need to wait for it */
+    if (reading && !finishBufferPair(&input, TRUE)) {
+        status = 0;
+    }
+    if (!finishBufferPair(&output, FALSE)) {
+        status = 0;
+    }
+    free(dtable.entries);
+    return status;
+}
+
+/* a block of the block format and what it decodes to, for one thread */
+typedef struct DecodeBlock {
+    size_t numchars;
+    int numsyms;
+    unsigned char lens[2 * 256]; /* symbol and code length pairs */
+    const unsigned char *codes; /* in, or wherever they were parsed */
+    size_t inlen;
+    unsigned char *in; /* the codes, read from a file */
+    size_t incap;
+    char *out; /* BLOCKSIZE bytes */
+    HuffmanNode nodes[2 * 256 - 1];
+    DecodeTable dtable;
+    int status;
+    int err;
+} DecodeBlock;
+
+/* takes in a block's header, checking it could be one */
+static int parseBlockHeader(DecodeBlock *block, const unsigned char *header) {
+    block->numchars = getBigEndian(header, 4);
+    block->inlen = getBigEndian(header + 4, 4);
+    block->numsyms = header[8] + 1;
+    /* no block has more chars or longer codes than that */
+    if (block->numchars > BLOCKSIZE ||
+        block->inlen > block->numchars / 8 * MAXCODELEN + MAXCODELEN) {
+        errno = EINVAL;
+        return 0;
     }
+    return 1;
+}
 
-    while ((status = read(infd, encodingschunk, CHUNKSIZE)) != 0) {
-        if (status < 0) {
+/*
+ * reads the next block, or sets end if it gets to the end marker
+ * instead. offset is moved past what was read
+ */
+static int readDecodeBlock(int infd, DecodeBlock *block, int *end,
+                           uint64_t *offset) {
+    unsigned char header[BLOCKHEADERLEN];
+    ssize_t got;
+
+    if ((got = readAll(infd, header, 4)) != 4) {
+        goto short_read;
+    }
+    *offset += 4;
+    if (getBigEndian(header, 4) == 0) {
+        *end = TRUE;
+        return 1;
+    }
+    if ((got = readAll(infd, header + 4, BLOCKHEADERLEN - 4)) !=
+        BLOCKHEADERLEN - 4) {
+        goto short_read;
+    }
+    if (!parseBlockHeader(block, header)) {
+        return 0;
+    }
+    if (block->inlen > block->incap) {
+        free(block->in);
+        block->incap = block->inlen;
+        if ((block->in = (unsigned char *)malloc(block->incap)) == NULL) {
+            block->incap = 0;
             return 0;
         }
-        for (i = 0; i < status; i++) {
-            /* ternary operator ensures bitindex is not decremented
-             * if previous node was leaf node and we did not step through code
-             */
-            for (bitindex = 7; bitindex >= 0; bitindex--) {
-                if (!isleafnode) {
-                    /* will be true if bit at bitindex is 1 */
-                    iscurrentbit1 = ((encodingschunk[i] >> bitindex) & flag);
-                    /* step in correct direction based on if current bit is one
-                     */
-                    cur = (iscurrentbit1 ? cur->right : cur->left);
-                }
-                isleafnode = (cur->left == NULL && cur->right == NULL);
-
-                /* (assuming file is properly encoded) */
-                if (isleafnode) {
-                    messagechunk[index++] = cur->ch;
-                    if (index == totalnumchars) {
-                        goto write;
-                    }
-                    cur = htree;
-                    /* update isleafnode for subsequent loop */
-                    isleafnode = FALSE;
+    }
+    if ((got = readAll(infd, block->lens, 2 * block->numsyms)) !=
+        2 * block->numsyms) {
+        goto short_read;
+    }
+    if ((got = readAll(infd, block->in, block->inlen)) !=
+        (ssize_t)block->inlen) {
+        goto short_read;
+    }
+    block->codes = block->in;
+    *offset += BLOCKHEADERLEN - 4 + 2 * block->numsyms + block->inlen;
+    return 1;
+
+short_read:
+    if (got != -1) {
+        errno = EINVAL;
+    }
+    return 0;
+}
+
+/*
+ * finds how long the block (or end marker, which has no chars) at the
+ * start of the len bytes at in is. returns -1 if it can't be a block
+ * and 0 if it goes on past len, with *blocklen the bytes it takes to
+ * tell more. once the whole block is there it returns 1 and the block
+ * is set up to be decoded from where it is
+ */
+static int parseDecodeBlock(DecodeBlock *block, const unsigned char *in,
+                            size_t len, size_t *blocklen) {
+    *blocklen = 4;
+    if (len < 4) {
+        return 0;
+    }
+    if (getBigEndian(in, 4) == 0) {
+        block->numchars = 0;
+        return 1;
+    }
+    *blocklen = BLOCKHEADERLEN;
+    if (len < BLOCKHEADERLEN) {
+        return 0;
+    }
+    if (!parseBlockHeader(block, in)) {
+        return -1;
+    }
+    *blocklen = BLOCKHEADERLEN + 2 * block->numsyms + block->inlen;
+    if (len < *blocklen) {
+        return 0;
+    }
+    memcpy(block->lens, in + BLOCKHEADERLEN, 2 * block->numsyms);
+    block->codes = in + BLOCKHEADERLEN + 2 * block->numsyms;
+    return 1;
+}
+
+/*
+ * builds the tree of the codes out of nodes. the codes have to have
+ * passed checkCodeLengths, so every node on the way to a code has two
+ * children
+ */
+static HuffmanNode *buildTreeFromCodes(HuffmanCode *codes,
+                                       HuffmanNode *nodes) {
+    HuffmanNode *cur, **next;
+    int numnodes = 1, i, bit;
+
+    memset(nodes, 0, sizeof(HuffmanNode));
+    for (i = 0; i < CHARFREQTABLESIZE; i++) {
+        cur = nodes;
+        for (bit = codes[i].len - 1; bit >= 0; bit--) {
+            next = ((codes[i].bits >> bit) & 1 ? &cur->right : &cur->left);
+            if (*next == NULL) {
+                *next = &nodes[numnodes++];
+                memset(*next, 0, sizeof(HuffmanNode));
+            }
+            cur = *next;
+        }
+        cur->ch = (unsigned char)i;
+    }
+    return nodes;
+}
+
+/* decodes a block from its code lengths, which it checks first */
+static void *decodeBlock(void *arg) {
+    DecodeBlock *block = (DecodeBlock *)arg;
+    HuffmanCode codes[256];
+    BitReader reader;
+    int i, sym, last = -1;
+
+    block->status = 0;
+    block->err = EINVAL;
+    memset(codes, 0, sizeof(codes));
+    for (i = 0; i < block->numsyms; i++) {
+        sym = block->lens[2 * i];
+        if (sym <= last) {
+            return NULL;
+        }
+        codes[sym].len = block->lens[2 * i + 1];
+        last = sym;
+    }
+    if (block->numsyms == 1) {
+        if (codes[last].len != 0 || block->inlen != 0) {
+            return NULL;
+        }
+        memset(block->out, last, block->numchars);
+        block->status = 1;
+        return NULL;
+    }
+    if (!checkCodeLengths(codes)) {
+        return NULL;
+    }
+    assignCanonicalCodes(codes);
+    if (!buildDecodeTable(&block->dtable,
+                          buildTreeFromCodes(codes, block->nodes))) {
+        block->err = ENOMEM;
+        return NULL;
+    }
+
+    /* the whole block has been read */
+    reader.input = NULL;
+    reader.cur = -1;
+    reader.in = block->codes;
+    reader.end = block->codes + block->inlen;
+    reader.bits = 0;
+    reader.count = 0;
+    reader.eof = TRUE;
+    if (!decodeSymbols(&block->dtable, &reader, block->out,
+                       block->numchars)) {
+        return NULL;
+    }
+    block->status = 1;
+    return NULL;
+}
+
+/*
+ * decodes the block format in infd (after the magic) to outfd. blocks
+ * are read numthreads at a time, decoded at once on a thread each and
+ * written out in order. the index at the end has to agree with where
+ * the blocks were
+ */
+int decodeBlocksToOutfile(int infd, int outfd, int numthreads) {
+    DecodeBlock *blocks;
+    uint64_t *offsets = NULL, offset = BLOCKMAGICLEN;
+    size_t numblocks = 0, offsetscap = 0, i;
+    unsigned char *index = NULL;
+    size_t indexlen;
+    int n, end = FALSE, status = 0;
+
+    blocks = (DecodeBlock *)calloc(numthreads, sizeof(DecodeBlock));
+    if (blocks == NULL) {
+        return 0;
+    }
+    for (n = 0; n < numthreads; n++) {
+        blocks[n].out = (char *)malloc(BLOCKSIZE);
+        if (blocks[n].out == NULL) {
+            goto done;
+        }
+    }
+    while (!end) {
+        for (n = 0; n < numthreads; n++) {
+            if (numblocks + n >= offsetscap) {
+                offsetscap = (offsetscap == 0 ? 64 : offsetscap * 2);
+                offsets = (uint64_t *)realloc(offsets,
+                                              offsetscap * sizeof(uint64_t));
+                if (offsets == NULL) {
+                    goto done;
                 }
             }
+            offsets[numblocks + n] = offset;
+            if (!readDecodeBlock(infd, &blocks[n], &end, &offset)) {
+                goto done;
+            }
+            if (end) {
+                break;
+            }
         }
-        flag = 1;
+        if (n > 0 &&
+            !runThreads(blocks, sizeof(DecodeBlock), n, decodeBlock)) {
+            goto done;
+        }
+        for (i = 0; i < (size_t)n; i++) {
+            if (!blocks[i].status) {
+                errno = blocks[i].err;
+                goto done;
+            }
+            if (!writeAll(outfd, blocks[i].out, blocks[i].numchars)) {
+                goto done;
+            }
+        }
+        numblocks += n;
     }
-write:
-    status = write(outfd, messagechunk, totalnumchars);
-    if (status == -1) {
-        status = 0;
-    } else {
-        status = 1;
+
+    indexlen = 4 + 8 * numblocks + 8;
+    if ((index = (unsigned char *)malloc(indexlen)) == NULL) {
+        goto done;
+    }
+    if (readAll(infd, index, indexlen) != (ssize_t)indexlen) {
+        errno = EINVAL;
+        goto done;
     }
+    if (getBigEndian(index, 4) != numblocks ||
+        getBigEndian(index + 4 + 8 * numblocks, 8) != offset) {
+        errno = EINVAL;
+        goto done;
+    }
+    for (i = 0; i < numblocks; i++) {
+        if (getBigEndian(index + 4 + 8 * i, 8) != offsets[i]) {
+            errno = EINVAL;
+            goto done;
+        }
+    }
+    status = 1;
+
+done:
+    for (n = 0; n < numthreads; n++) {
+        free(blocks[n].in);
+        free(blocks[n].out);
+        free(blocks[n].dtable.entries);
+    }
+    free(blocks);
+    free(offsets);
+    free(index);
     return status;
 }
 
 int fileno(FILE *stream);
 
-int hdecode(int infd, int outfd) {
+/* where a header is read from: fd, or the bytes from in to end when fd
+ * is -1 */
+typedef struct HeaderSource {
+    int fd;
+    const unsigned char *in;
+    const unsigned char *end;
+} HeaderSource;
+
+/* reads len bytes of header, of which there have to be that many */
+static int readHeader(HeaderSource *src, unsigned char *buf, size_t len) {
+    ssize_t got;
+    if (src->fd != -1) {
+        if ((got = readAll(src->fd, buf, len)) == (ssize_t)len) {
+            return 1;
+        }
+        if (got != -1) {
+            errno = EINVAL;
+        }
+        return 0;
+    }
+    if ((size_t)(src->end - src->in) < len) {
+        errno = EINVAL;
+        return 0;
+    }
+    memcpy(buf, src->in, len);
+    src->in += len;
+    return 1;
+}
+
+/* gets the next nibble of the packed lengths, reading a byte of them
+ * every other time */
+static int getNibble(HeaderSource *src, unsigned char *byte,
+                     int *numnibbles) {
+    if ((*numnibbles)++ % 2 != 0) {
+        return *byte & 0xF;
+    }
+    if (!readHeader(src, byte, 1)) {
+        return -1;
+    }
+    return *byte >> 4;
+}
+
+/*
+ * reads the rest of the canonical format's header into codes and
+ * builds the tree of the canonical codes out of nodes. the tree is a
+ * single leaf for a message of one symbol
+ */
+static HuffmanNode *decodeCanonicalHeader(HeaderSource *src,
+                                          HuffmanNode *nodes,
+                                          HuffmanCode *codes) {
+    unsigned char count[4], byte = 0;
+    int numnibbles = 0, numcodes = 0, i = 0, nibble, hi, lo, last = 0;
+    HuffmanNode *htree;
+
+    if (!readHeader(src, count, 4)) {
+        return NULL;
+    }
+    memset(codes, 0, CHARFREQTABLESIZE * sizeof(HuffmanCode));
+    while (i < CHARFREQTABLESIZE) {
+        if ((nibble = getNibble(src, &byte, &numnibbles)) == -1) {
+            return NULL;
+        }
+        if (nibble == 0 || nibble == 15) {
+            if ((hi = getNibble(src, &byte, &numnibbles)) == -1 ||
+                (lo = getNibble(src, &byte, &numnibbles)) == -1) {
+                return NULL;
+            }
+            if (nibble == 0) {
+                i += hi * 16 + lo + 1;
+                continue;
+            }
+            nibble = hi * 16 + lo;
+        }
+        codes[i].len = nibble;
+        last = i++;
+        numcodes++;
+    }
+    errno = EINVAL;
+    if (i > CHARFREQTABLESIZE || numcodes == 0) {
+        return NULL;
+    }
+    if (numcodes == 1) {
+        if (codes[last].len != 1) {
+            return NULL;
+        }
+        memset(nodes, 0, sizeof(HuffmanNode));
+        htree = nodes;
+        htree->ch = (unsigned char)last;
+    } else {
+        if (!checkCodeLengths(codes)) {
+            return NULL;
+        }
+        assignCanonicalCodes(codes);
+        htree = buildTreeFromCodes(codes, nodes);
+    }
+    /* the root holds the number of chars, as a tree from counts does */
+    htree->count = (unsigned int)getBigEndian(count, 4);
+    return htree;
+}
+
+/*
+ * decodes any of the formats. the original one starts with the number
+ * of chars, so its header is too long for reading a magic to ever read
+ * past it when it starts the same
+ */
+int hdecode(int infd, int outfd, int numthreads) {
+    unsigned char magic[BLOCKMAGICLEN];
+    ssize_t got;
     unsigned int *charFreqTable = NULL;
     HuffmanNode **hnodetable = NULL;
     int hnodetablelen = 0, status;
     HuffmanNode *htree = NULL;
+    HuffmanNode nodes[2 * 256 - 1];
+    HuffmanCode codes[256];
+    HeaderSource src;
+
+    if ((got = readAll(infd, magic, 1)) == -1) {
+        goto err;
+    }
+    if (got == 1 && magic[0] == BLOCKMAGIC[0]) {
+        if ((got = readAll(infd, magic + 1, BLOCKMAGICLEN - 1)) == -1) {
+            goto err;
+        }
+        got++;
+        if (got == BLOCKMAGICLEN &&
+            memcmp(magic, BLOCKMAGIC, BLOCKMAGICLEN) == 0) {
+            status = decodeBlocksToOutfile(infd, outfd, numthreads);
+            goto close;
+        }
+        if (got == BLOCKMAGICLEN &&
+            memcmp(magic, CANONMAGIC, BLOCKMAGICLEN) == 0) {
+            src.fd = infd;
+            if ((htree = decodeCanonicalHeader(&src, nodes, codes)) == NULL) {
+                goto err;
+            }
+            goto write;
+        }
+    }
     /*
      * STEP 1:
      * parse charFreqTable from inputfile header
      */
-    charFreqTable = decodeHeaderToFreqTable(infd, &hnodetablelen);
+    charFreqTable = decodeHeaderToFreqTable(infd, &hnodetablelen, magic, got);
     if (charFreqTable == NULL) {
         goto err;
     }
@@ -173,6 +1092,7 @@ int hdecode(int infd, int outfd) {
      */
 write:
     status = decodeInfileMessageToOutfile(infd, outfd, htree);
+close:
     if (!status) {
         goto err;
     }
@@ -187,21 +1107,429 @@ err:
     return 0;
 }
 
+/* what a decoder's stream expects next */
+enum DecodeStreamState {
+    STREAMMAGIC,
+    STREAMBLOCKS,
+    STREAMINDEX,
+    STREAMDONE
+};
+
+struct HuffmanDecoder {
+    DecodeBlock block; /* its out is BLOCKSIZE bytes */
+    HuffmanWriter writer;
+    void *ctx;
+    enum DecodeStreamState state;
+    /* an item (the magic, a block or the index) cut short by the end of
+     * what was written, kept until the rest of it comes */
+    unsigned char *stage;
+    size_t stagelen;
+    size_t stagecap;
+    uint64_t offset;   /* where the next item starts */
+    uint64_t *offsets; /* where each block started */
+    size_t numblocks;
+    size_t offsetscap;
+};
+
+HuffmanDecoder *constructHuffmanDecoder(void) {
+    HuffmanDecoder *dec = (HuffmanDecoder *)calloc(1, sizeof(HuffmanDecoder));
+    unsigned int base;
+    if (dec == NULL) {
+        return NULL;
+    }
+    dec->stagecap = MAXENCODEDBLOCK;
+    dec->block.out = (char *)malloc(BLOCKSIZE);
+    dec->stage = (unsigned char *)malloc(dec->stagecap);
+    /* with room for a first table and a few sub tables */
+    if (dec->block.out == NULL || dec->stage == NULL ||
+        !addDecodeTable(&dec->block.dtable, DECODEBITS + 2, &base)) {
+        freeHuffmanDecoder(dec);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return dec;
+}
+
+void freeHuffmanDecoder(HuffmanDecoder *dec) {
+    if (dec == NULL) {
+        return;
+    }
+    free(dec->block.out);
+    free(dec->block.dtable.entries);
+    free(dec->stage);
+    free(dec->offsets);
+    free(dec);
+}
+
+/*
+ * decodes numchars symbols to out a bit at a time straight from the
+ * code lengths. the canonical codes of each length count up from the
+ * first one, so a code is found once it is less than that many past
+ * the first of its length. it only needs the lengths sorted, rather
+ * than every entry of the decode table filled in, so it is quicker
+ * for a message much shorter than the table
+ */
+static int decodeCanonicalSymbols(const HuffmanCode *codes,
+                                  BitReader *reader, char *out,
+                                  size_t numchars) {
+    int numcodes[MAXCODELEN + 1], offsets[MAXCODELEN + 1];
+    int next[MAXCODELEN + 1];
+    uint64_t first[MAXCODELEN + 1], code;
+    unsigned char syms[256];
+    int i, len;
+    size_t n;
+
+    memset(numcodes, 0, sizeof(numcodes));
+    for (i = 0; i < CHARFREQTABLESIZE; i++) {
+        numcodes[codes[i].len]++;
+    }
+    /* as assignCanonicalCodes has them, with the symbols of each
+     * length in order after those of the lengths before */
+    numcodes[0] = 0;
+    first[0] = 0;
+    offsets[0] = 0;
+    for (len = 1; len <= MAXCODELEN; len++) {
+        first[len] = (first[len - 1] + numcodes[len - 1]) << 1;
+        offsets[len] = offsets[len - 1] + numcodes[len - 1];
+        next[len] = offsets[len];
+    }
+    for (i = 0; i < CHARFREQTABLESIZE; i++) {
+        if (codes[i].len > 0) {
+            syms[next[codes[i].len]++] = (unsigned char)i;
+        }
+    }
+    /* the code is complete, so every run of bits ends in one of them
+     * by MAXCODELEN */
+    for (n = 0; n < numchars; n++) {
+        code = 0;
+        len = 0;
+        do {
+            if (reader->count == 0) {
+                refillBitsCarefully(reader);
+                if (reader->count == 0) {
+                    errno = EINVAL;
+                    return 0;
+                }
+            }
+            code = code << 1 | reader->bits >> 63;
+            reader->bits <<= 1;
+            reader->count--;
+            len++;
+        } while (code - first[len] >= (uint64_t)numcodes[len]);
+        out[n] = syms[offsets[len] + (int)(code - first[len])];
+    }
+    return 1;
+}
+
+/* decodes the canonical format after the magic */
+static int decodeCanonicalBuffer(HuffmanDecoder *dec,
+                                 const unsigned char *in,
+                                 const unsigned char *end, char *out,
+                                 size_t outcap, size_t *outlen) {
+    HeaderSource src;
+    BitReader reader;
+    HuffmanNode *htree;
+    HuffmanCode codes[256];
+
+    src.fd = -1;
+    src.in = in;
+    src.end = end;
+    if ((htree = decodeCanonicalHeader(&src, dec->block.nodes, codes)) ==
+        NULL) {
+        return 0;
+    }
+    if (htree->count > outcap) {
+        errno = ENOSPC;
+        return 0;
+    }
+    *outlen = htree->count;
+    if (htree->left == NULL && htree->right == NULL) {
+        memset(out, htree->ch, htree->count);
+        return 1;
+    }
+    reader.input = NULL;
+    reader.cur = -1;
+    reader.in = src.in;
+    reader.end = end;
+    reader.bits = 0;
+    reader.count = 0;
+    reader.eof = TRUE;
+    if (htree->count < SMALLDECODE) {
+        return decodeCanonicalSymbols(codes, &reader, out, htree->count);
+    }
+    if (!buildDecodeTable(&dec->block.dtable, htree)) {
+        return 0;
+    }
+    return decodeSymbols(&dec->block.dtable, &reader, out, htree->count);
+}
+
+/*
+ * decodes the block format after the magic straight to out, then goes
+ * over the blocks again to check the index has them where they were
+ */
+static int decodeBlockBuffer(HuffmanDecoder *dec, const unsigned char *in,
+                             size_t len, char *out, size_t outcap,
+                             size_t *outlen) {
+    DecodeBlock *block = &dec->block;
+    char *blockout = block->out;
+    size_t pos = BLOCKMAGICLEN, numblocks = 0, blocklen, i;
+
+    errno = EINVAL;
+    *outlen = 0;
+    for (;;) {
+        if (parseDecodeBlock(block, in + pos, len - pos, &blocklen) != 1) {
+            return 0;
+        }
+        pos += blocklen;
+        if (block->numchars == 0) {
+            break;
+        }
+        if (block->numchars > outcap - *outlen) {
+            errno = ENOSPC;
+            return 0;
+        }
+        block->out = out + *outlen;
+        decodeBlock(block);
+        block->out = blockout;
+        if (!block->status) {
+            errno = block->err;
+            return 0;
+        }
+        *outlen += block->numchars;
+        numblocks++;
+    }
+    errno = EINVAL;
+    if (len - pos != 4 + 8 * numblocks + 8 ||
+        getBigEndian(in + pos, 4) != numblocks ||
+        getBigEndian(in + len - 8, 8) != pos) {
+        return 0;
+    }
+    for (i = 0, pos = BLOCKMAGICLEN; i < numblocks; i++) {
+        if (getBigEndian(in + len - 8 * (numblocks + 1) + 8 * i, 8) != pos) {
+            return 0;
+        }
+        parseDecodeBlock(block, in + pos, len - pos, &blocklen);
+        pos += blocklen;
+    }
+    return 1;
+}
+
+int huffmanDecodeBuffer(HuffmanDecoder *dec, const void *in, size_t len,
+                        void *out, size_t outcap, size_t *outlen) {
+    const unsigned char *bytes = (const unsigned char *)in;
+
+    *outlen = 0;
+    /* an empty message */
+    if (len == 0) {
+        return 1;
+    }
+    if (len >= BLOCKMAGICLEN &&
+        memcmp(bytes, CANONMAGIC, BLOCKMAGICLEN) == 0) {
+        return decodeCanonicalBuffer(dec, bytes + BLOCKMAGICLEN, bytes + len,
+                                     (char *)out, outcap, outlen);
+    }
+    if (len >= BLOCKMAGICLEN &&
+        memcmp(bytes, BLOCKMAGIC, BLOCKMAGICLEN) == 0) {
+        return decodeBlockBuffer(dec, bytes, len, (char *)out, outcap,
+                                 outlen);
+    }
+    errno = EINVAL;
+    return 0;
+}
+
+int startHuffmanDecodeStream(HuffmanDecoder *dec, HuffmanWriter writer,
+                             void *ctx) {
+    dec->writer = writer;
+    dec->ctx = ctx;
+    dec->state = STREAMMAGIC;
+    dec->stagelen = 0;
+    dec->offset = 0;
+    dec->numblocks = 0;
+    return 1;
+}
+
+/*
+ * finds how long the next item of the stream is, like parseDecodeBlock
+ * does for a block
+ */
+static int parseStreamItem(HuffmanDecoder *dec, const unsigned char *in,
+                           size_t len, size_t *itemlen) {
+    switch (dec->state) {
+    case STREAMMAGIC:
+        *itemlen = BLOCKMAGICLEN;
+        break;
+    case STREAMBLOCKS:
+        return parseDecodeBlock(&dec->block, in, len, itemlen);
+    case STREAMINDEX:
+        *itemlen = 4;
+        if (len < 4) {
+            return 0;
+        }
+        if (getBigEndian(in, 4) != dec->numblocks) {
+            return -1;
+        }
+        *itemlen = 4 + 8 * dec->numblocks + 8;
+        break;
+    default:
+        /* nothing comes after the index */
+        return -1;
+    }
+    return len >= *itemlen;
+}
+
+/*
+ * takes in the whole item at in, which parseStreamItem has just found
+ * to be itemlen long
+ */
+static int takeStreamItem(HuffmanDecoder *dec, const unsigned char *in,
+                          size_t itemlen) {
+    DecodeBlock *block = &dec->block;
+    uint64_t *offsets;
+    size_t i;
+
+    errno = EINVAL;
+    switch (dec->state) {
+    case STREAMMAGIC:
+        if (memcmp(in, BLOCKMAGIC, BLOCKMAGICLEN) != 0) {
+            return 0;
+        }
+        dec->state = STREAMBLOCKS;
+        break;
+    case STREAMBLOCKS:
+        if (block->numchars == 0) {
+            dec->state = STREAMINDEX;
+            break;
+        }
+        if (dec->numblocks == dec->offsetscap) {
+            offsets = (uint64_t *)realloc(
+                dec->offsets, 2 * (dec->offsetscap + 32) * sizeof(uint64_t));
+            if (offsets == NULL) {
+                return 0;
+            }
+            dec->offsets = offsets;
+            dec->offsetscap = 2 * (dec->offsetscap + 32);
+        }
+        dec->offsets[dec->numblocks++] = dec->offset;
+        decodeBlock(block);
+        if (!block->status) {
+            errno = block->err;
+            return 0;
+        }
+        if (!dec->writer(dec->ctx, (unsigned char *)block->out,
+                         block->numchars)) {
+            return 0;
+        }
+        break;
+    default:
+        for (i = 0; i < dec->numblocks; i++) {
+            if (getBigEndian(in + 4 + 8 * i, 8) != dec->offsets[i]) {
+                return 0;
+            }
+        }
+        if (getBigEndian(in + itemlen - 8, 8) != dec->offset) {
+            return 0;
+        }
+        dec->state = STREAMDONE;
+        break;
+    }
+    dec->offset += itemlen;
+    return 1;
+}
+
+/*
+ * whole items are taken in from where they were written, only what is
+ * cut short is kept until the rest of it comes
+ */
+int writeHuffmanDecodeStream(HuffmanDecoder *dec, const void *bytes,
+                             size_t len) {
+    const unsigned char *in = (const unsigned char *)bytes;
+    size_t itemlen, take;
+    unsigned char *bigger;
+    int whole;
+
+    for (;;) {
+        if (dec->stagelen > 0) {
+            whole = parseStreamItem(dec, dec->stage, dec->stagelen, &itemlen);
+            if (whole == 1) {
+                dec->stagelen = 0;
+                if (!takeStreamItem(dec, dec->stage, itemlen)) {
+                    return 0;
+                }
+                continue;
+            }
+        } else if (len == 0) {
+            break;
+        } else if ((whole = parseStreamItem(dec, in, len, &itemlen)) == 1) {
+            if (!takeStreamItem(dec, in, itemlen)) {
+                return 0;
+            }
+            in += itemlen;
+            len -= itemlen;
+            continue;
+        }
+        if (whole == -1) {
+            errno = EINVAL;
+            return 0;
+        }
+        if (len == 0) {
+            break;
+        }
+        if (itemlen > dec->stagecap) {
+            bigger = (unsigned char *)realloc(dec->stage, itemlen);
+            if (bigger == NULL) {
+                return 0;
+            }
+            dec->stage = bigger;
+            dec->stagecap = itemlen;
+        }
+        take = itemlen - dec->stagelen;
+        take = (take < len ? take : len);
+        memcpy(dec->stage + dec->stagelen, in, take);
+        dec->stagelen += take;
+        in += take;
+        len -= take;
+    }
+    return 1;
+}
+
+int finishHuffmanDecodeStream(HuffmanDecoder *dec) {
+    if (dec->state != STREAMDONE) {
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+#ifndef LIBHUFFMAN
+/* not declared with -ansi */
+int getopt(int argc, char *const argv[], const char *optstring);
+extern char *optarg;
+extern int optind;
+
 int main(int argc, char *argv[]) {
     char *infile, *outfile;
-    int infd, outfd;
-    switch (argc) {
-    case 1:
+    int infd, outfd, opt;
+    /* only the block format is decoded on more than one thread */
+    int numthreads = 1;
+
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        if (opt != 'j' || (numthreads = atoi(optarg)) < 1) {
+            error(0, EINVAL, "Usage: %s", hdecodeusage);
+            return -1;
+        }
+    }
+    switch (argc - optind) {
+    case 0:
         infile = NULL;
         outfile = NULL;
         break;
-    case 2:
-        infile = argv[1];
+    case 1:
+        infile = argv[optind];
         outfile = NULL;
         break;
-    case 3:
-        infile = argv[1];
-        outfile = argv[2];
+    case 2:
+        infile = argv[optind];
+        outfile = argv[optind + 1];
         break;
     default:
         errno = E2BIG;
@@ -213,5 +1541,6 @@ int main(int argc, char *argv[]) {
         return 0;
     }
     /* hdecode uses normal true/false so return inverse */
-    return !hdecode(infd, outfd);
+    return !hdecode(infd, outfd, numthreads);
 }
+#endif /* LIBHUFFMAN */
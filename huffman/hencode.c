@@ -9,39 +9,128 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 /* defines a huffman node */
 #include "huffman.h"
+#include "libhuffman.h"
 #ifdef DEBUG
 #include "printfuncs.h"
 #endif
 #include <string.h>
 
-/* takes a file descriptor and reads the file byte by byte
+/* bytes of message read, and of encoded message written, at a time */
+#define ENCODEBUFSIZE (1 << 16)
+
+/* a slice of a mapped file whose chars are counted on a thread */
+typedef struct CountJob {
+    const unsigned char *bytes;
+    size_t len;
+    unsigned int charFreqTable[256];
+} CountJob;
+
+static void *countJobChars(void *arg) {
+    CountJob *job = (CountJob *)arg;
+    countChars(job->bytes, job->len, job->charFreqTable);
+    return NULL;
+}
+
+/*
+ * counts the chars of fd from start on, if it is a regular file, by
+ * mapping it and splitting it into a slice for each of numthreads
+ * threads. returns 0 if it isn't or anything fails, leaving
+ * charFreqTable as it was for the file to be read instead
+ */
+static int countMappedChars(int fd, off_t start, int numthreads,
+                            unsigned int *charFreqTable) {
+    struct stat st;
+    unsigned char *map, *bytes;
+    CountJob *jobs;
+    size_t size, maplen;
+    off_t mapstart;
+    int n, c, status = 0;
+
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+        st.st_size <= start) {
+        return 0;
+    }
+    /* mappings have to start on a page */
+    mapstart = start - start % sysconf(_SC_PAGESIZE);
+    size = st.st_size - start;
+    maplen = st.st_size - mapstart;
+    map = (unsigned char *)mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, fd,
+                                mapstart);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    bytes = map + (start - mapstart);
+    /* not worth a thread for less than a chunk each */
+    if ((size_t)numthreads > size / ENCODEBUFSIZE) {
+        numthreads = size / ENCODEBUFSIZE;
+    }
+    if (numthreads < 1) {
+        numthreads = 1;
+    }
+    jobs = (CountJob *)calloc(numthreads, sizeof(CountJob));
+    if (jobs != NULL) {
+        for (n = 0; n < numthreads; n++) {
+            jobs[n].bytes = bytes + size / numthreads * n;
+            jobs[n].len = (n == numthreads - 1 ? size - size / numthreads * n
+                                               : size / numthreads);
+        }
+        if (runThreads(jobs, sizeof(CountJob), numthreads, countJobChars)) {
+            for (n = 0; n < numthreads; n++) {
+                for (c = 0; c < CHARFREQTABLESIZE; c++) {
+                    charFreqTable[c] += jobs[n].charFreqTable[c];
+                }
+            }
+            status = 1;
+        }
+        free(jobs);
+    }
+    munmap(map, maplen);
+    return status;
+}
+
+/* takes a file descriptor and reads the file a chunk at a time
  * recording the frequencies in an int[] of length CHARFREQTABLESIZE
  * the byte value corresponds to its index in the array
+ * a regular file is mapped from start, where fd is at, instead of
+ * read and counted on numthreads threads. if spoolfd isn't -1
+ * everything read is also written to it, for input that can't be
+ * read a second time
  * throws error if the read fails and promises to return a table
  * with non present bytes (characters) counts being 0 */
-unsigned int *getCharFreqTableFromFile(int fd, int *hnodetablelen) {
+unsigned int *getCharFreqTableFromFile(int fd, off_t start,
+                                       int *hnodetablelen, int spoolfd,
+                                       int numthreads) {
     ssize_t actualbufsize = 0;
-    unsigned char chunk[CHUNKSIZE];
-    unsigned char index = 0;
+    unsigned char chunk[ENCODEBUFSIZE];
     /* one slot for each character */
     unsigned int *charFreqTable =
         (unsigned int *)calloc(CHARFREQTABLESIZE, sizeof(unsigned int));
     int numchars = 0, i;
 
-    while ((actualbufsize = read(fd, chunk, CHUNKSIZE)) != 0) {
-        if (actualbufsize == -1) {
-            return NULL;
-        }
-        for (i = 0; i < actualbufsize; ++i) {
-            index = (unsigned char)chunk[i];
-            if (charFreqTable[index] == 0) {
-                numchars++;
+    if (charFreqTable == NULL) {
+        return NULL;
+    }
+    if (spoolfd != -1 ||
+        !countMappedChars(fd, start, numthreads, charFreqTable)) {
+        while ((actualbufsize = read(fd, chunk, ENCODEBUFSIZE)) != 0) {
+            if (actualbufsize == -1) {
+                return NULL;
+            }
+            if (spoolfd != -1 && !writeAll(spoolfd, chunk, actualbufsize)) {
+                return NULL;
             }
-            charFreqTable[index]++;
+            countChars(chunk, actualbufsize, charFreqTable);
+        }
+    }
+    for (i = 0; i < CHARFREQTABLESIZE; i++) {
+        if (charFreqTable[i] != 0) {
+            numchars++;
         }
     }
     *hnodetablelen = numchars;
@@ -77,92 +166,60 @@ int prepareHeaderInfo(unsigned int *charFreqTable, HuffmanNode **hnodetable,
 
 /*
  * recursive function to dfs htree finding leaf nodes
- * while keeping track of current path, updating encodingstable
- * based on index of leaf node character found with indextable
+ * while keeping track of current path, setting the code of
+ * each leaf node character found in codes (indexed by character)
+ * the path is kept as an integer, the first step being the highest
+ * of its pathlen bits
  * assumes htree is not NULL
  */
-int findPathsToLeafNodes(HuffmanNode *htree, unsigned int *indextable,
-                         char **encodingstable, char *currentpath,
-                         int pathlen) {
-    int tableindex, status = 1;
+int findPathsToLeafNodes(HuffmanNode *htree, HuffmanCode *codes,
+                         uint64_t path, int pathlen) {
     /* bools for repeated use and clarity */
     int hasleftchild = (htree != NULL ? htree->left != NULL : -1);
     int hasrightchild = (htree != NULL ? htree->right != NULL : -1);
     int isleafnode = !(hasleftchild && hasrightchild);
-    unsigned char ch;
-    char *finalpath;
     /* null htree */
     if (hasleftchild == -1 || hasrightchild == -1) {
         return 0;
     }
-    if (currentpath == NULL) {
-        /* max depth is 255 with 256 chars + 1 for null terminator */
-        currentpath = (char *)malloc(CHARFREQTABLESIZE);
-        if (currentpath == NULL) {
-            return 0;
-        }
-        currentpath[0] = '\0';
-    }
     if (isleafnode) {
-        ch = htree->ch;
-        tableindex = indextable[ch];
-        /* pathlen + 1 is safe because we check if pathlen+1 < CHARFREQTABLESIZE
-         */
-        if ((finalpath = (char *)malloc(pathlen + 1)) == NULL) {
-            return 0;
-        }
-        if (strcpy(finalpath, currentpath) == NULL) {
-            status = 0;
-        }
-        encodingstable[tableindex] = finalpath;
-    } else {
-        /* increment pathlen before writing 0 or 1
-         * to reinforce pathlen only modified once */
-        if ((++pathlen) < CHARFREQTABLESIZE) {
-            if (hasleftchild) {
-                /* appends 0 to new path */
-                currentpath[pathlen - 1] = '0';
-                currentpath[pathlen] = '\0';
-                status =
-                    findPathsToLeafNodes(htree->left, indextable,
-                                         encodingstable, currentpath, pathlen);
-                if (!status)
-                    return status;
-            }
-            if (hasrightchild) {
-                currentpath[pathlen - 1] = '1';
-                currentpath[pathlen] = '\0';
-                status =
-                    findPathsToLeafNodes(htree->right, indextable,
-                                         encodingstable, currentpath, pathlen);
-                if (!status) {
-                    return 0;
-                }
-            }
-        } else {
-            fprintf(stderr, "Maximum depth (255) of tree exceeded.\n"
-                            "Failure to correctly construct tree is likely.\n");
-            status = 0;
-        }
+        codes[htree->ch].bits = path;
+        codes[htree->ch].len = pathlen;
+        return 1;
     }
-    return status;
+    /* increment pathlen before adding 0 or 1
+     * to reinforce pathlen only modified once */
+    if ((++pathlen) > MAXCODELEN) {
+        fprintf(stderr, "Maximum depth (%d) of tree exceeded.\n"
+                        "Failure to correctly construct tree is likely.\n",
+                MAXCODELEN);
+        return 0;
+    }
+    /* appends 0 to new path */
+    if (!findPathsToLeafNodes(htree->left, codes, path << 1, pathlen)) {
+        return 0;
+    }
+    /* appends 1 to new path */
+    return findPathsToLeafNodes(htree->right, codes, (path << 1) | 1,
+                                pathlen);
 }
 
 /*
- * assumes the hnodetable is in the order the resulting char
- * table should be in, and that hnodetable is null terminated
+ * returns every character's code as an integer and a length,
+ * indexed by the character itself. characters not in the tree
+ * get a length of 0
  */
-char **generateCharacterEncodings(HuffmanNode **hnodetable,
-                                  const int hnodetablelen, HuffmanNode *htree,
-                                  unsigned int *indextable) {
-    char **encodingstable =
-        (char **)malloc((hnodetablelen + 1) * sizeof(char *));
-    int status =
-        findPathsToLeafNodes(htree, indextable, encodingstable, NULL, 0);
-    if (!status) {
+HuffmanCode *generateCharacterEncodings(HuffmanNode *htree) {
+    HuffmanCode *codes =
+        (HuffmanCode *)calloc(CHARFREQTABLESIZE, sizeof(HuffmanCode));
+    if (codes == NULL) {
+        return NULL;
+    }
+    if (!findPathsToLeafNodes(htree, codes, 0, 0)) {
+        free(codes);
         return NULL;
     }
-    return encodingstable;
+    return codes;
 }
 
 /*
@@ -212,91 +269,654 @@ int encodeHeaderToFile(HuffmanNode **hnodetable, const int hnodetablelen,
     return 1;
 }
 
-int encodeMessageToFile(HuffmanNode **hnodetable, const int hnodetablelen,
-                        char **encodingstable, HuffmanNode *htree,
-                        unsigned int *indextable, int infd, int outfd) {
-    char codeschunk[CHUNKSIZE];
-    char messagechunk[CHUNKSIZE];
-    unsigned char ch, codechar;
-    char *code;
-    int index = 0, bitindex = 7, readsize = 0, i, j = 0, flag = 1;
+/* adds a nibble to the packed lengths */
+static void putNibble(unsigned char *bytes, int *numnibbles, int nibble) {
+    if (*numnibbles % 2 == 0) {
+        bytes[*numnibbles / 2] = (unsigned char)(nibble << 4);
+    } else {
+        bytes[*numnibbles / 2] |= (unsigned char)nibble;
+    }
+    (*numnibbles)++;
+}
+
+/*
+ * packs the code length of every symbol into bytes (which needs
+ * MAXCODELENGTHSLEN of room) as the canonical format has them and
+ * returns how many bytes that took
+ */
+static int packCodeLengths(const int *lens, unsigned char *bytes) {
+    int numnibbles = 0, i = 0, run;
+
+    while (i < CHARFREQTABLESIZE) {
+        if (lens[i] == 0) {
+            for (run = 0; i + run < CHARFREQTABLESIZE && lens[i + run] == 0;
+                 run++) {
+            }
+            putNibble(bytes, &numnibbles, 0);
+            putNibble(bytes, &numnibbles, (run - 1) >> 4);
+            putNibble(bytes, &numnibbles, (run - 1) & 0xF);
+            i += run;
+            continue;
+        }
+        if (lens[i] < 15) {
+            putNibble(bytes, &numnibbles, lens[i]);
+        } else {
+            putNibble(bytes, &numnibbles, 15);
+            putNibble(bytes, &numnibbles, lens[i] >> 4);
+            putNibble(bytes, &numnibbles, lens[i] & 0xF);
+        }
+        i++;
+    }
+    return (numnibbles + 1) / 2;
+}
+
+/* the most the canonical format's header can come to */
+#define MAXCANONHEADERLEN (BLOCKMAGICLEN + 4 + MAXCODELENGTHSLEN)
+
+/*
+ * puts the canonical format's header in header: the number of chars
+ * and the length of each one's code, which is all it takes to make
+ * canonical codes again. ch is the only char when codes is NULL.
+ * returns how long it is
+ */
+static int formatCanonicalHeader(unsigned int numchars, HuffmanCode *codes,
+                                 int ch, unsigned char *header) {
+    int lens[256];
+    int i;
+
+    for (i = 0; i < CHARFREQTABLESIZE; i++) {
+        lens[i] = (codes != NULL ? codes[i].len : 0);
+    }
+    if (codes == NULL) {
+        lens[ch] = 1;
+    }
+    memcpy(header, CANONMAGIC, BLOCKMAGICLEN);
+    putBigEndian(header + BLOCKMAGICLEN, numchars, 4);
+    return BLOCKMAGICLEN + 4 +
+           packCodeLengths(lens, header + BLOCKMAGICLEN + 4);
+}
+
+/* writes the canonical format's header. codes is NULL when htree is a
+ * single leaf */
+int encodeCanonicalHeaderToFile(HuffmanNode *htree, HuffmanCode *codes,
+                                int outfd) {
+    unsigned char header[MAXCANONHEADERLEN];
+    return writeAll(outfd, header,
+                    formatCanonicalHeader(htree->count, codes, htree->ch,
+                                          header));
+}
+
+/* stores a 64 bit number big endian, which gcc makes one store */
+static void storeBigEndian64(unsigned char *bytes, uint64_t word) {
+    int i;
+    for (i = 7; i >= 0; i--) {
+        bytes[i] = (unsigned char)word;
+        word >>= 8;
+    }
+}
+
+/*
+ * codes are packed into a 64 bit word from the top down, room being
+ * the bits of it not used yet, and the word is stored whole each time
+ * it fills up
+ */
+typedef struct BitWriter {
+    uint64_t word;
+    int room;
+} BitWriter;
+
+/*
+ * packs the codes of the len chars of msg into out, returning where
+ * the next word goes. out has to have room for len * MAXCODELEN / 8
+ * bytes, though codes never get that long in practice
+ */
+static unsigned char *packCodes(BitWriter *writer, HuffmanCode *codes,
+                                const unsigned char *msg, size_t len,
+                                unsigned char *out) {
+    const unsigned char *msgend = msg + len;
+    HuffmanCode *code;
+    uint64_t word = writer->word;
+    int room = writer->room, spill;
+
+    for (; msg < msgend; msg++) {
+        code = &codes[*msg];
+        if (code->len < room) {
+            room -= code->len;
+            word |= code->bits << room;
+            continue;
+        }
+        /* the word fills up, what doesn't fit starts the next */
+        spill = code->len - room;
+        word |= code->bits >> spill;
+        storeBigEndian64(out, word);
+        out += 8;
+        room = 64 - spill;
+        word = (spill == 0 ? 0 : code->bits << room);
+    }
+    writer->word = word;
+    writer->room = room;
+    return out;
+}
+
+/*
+ * stores the last word, which needs 8 bytes of room, and returns the
+ * end of the bytes of it that have been written to. the last byte is
+ * padded with 0s
+ */
+static unsigned char *flushBitWriter(BitWriter *writer, unsigned char *out) {
+    storeBigEndian64(out, writer->word);
+    return out + (64 - writer->room + 7) / 8;
+}
+
+/*
+ * encodes the message in infd, from start on, to outfd with codes
+ * (indexed by character), a chunk of it at a time
+ */
+int encodeMessageToFile(const int hnodetablelen, HuffmanCode *codes,
+                        int infd, off_t start, int outfd) {
+    unsigned char messagechunk[ENCODEBUFSIZE];
+    unsigned char *codeschunk, *end;
+    BitWriter writer;
+    int readsize = 0, status = 0;
     /* 1 or 0 chars write nothing.
      * all info for one char is included in header */
     if (hnodetablelen == 0 || hnodetablelen == 1) {
-        goto write;
+        return 1;
     }
-    /* sanity seek to beginning of file */
-    if (lseek(infd, 0, SEEK_SET) == -1) {
+    /* back to where the message starts */
+    if (lseek(infd, start, SEEK_SET) == -1) {
         return 0;
     }
-    /* set first code char to zero */
-    codeschunk[0] = 0;
-    /* while there is still message left to decode  */
-    while ((readsize = read(infd, messagechunk, CHUNKSIZE)) != 0) {
+    /* room for a chunk of the longest codes and the last word */
+    codeschunk =
+        (unsigned char *)malloc(ENCODEBUFSIZE / 8 * MAXCODELEN + 8);
+    if (codeschunk == NULL) {
+        return 0;
+    }
+    writer.word = 0;
+    writer.room = 64;
+    /* while there is still message left to encode */
+    while ((readsize = read(infd, messagechunk, ENCODEBUFSIZE)) != 0) {
         if (readsize == -1) {
+            goto done;
+        }
+        end = packCodes(&writer, codes, messagechunk, readsize, codeschunk);
+        if (!writeAll(outfd, codeschunk, end - codeschunk)) {
+            goto done;
+        }
+    }
+    /* this will not write anything if nothing is left */
+    end = flushBitWriter(&writer, codeschunk);
+    status = writeAll(outfd, codeschunk, end - codeschunk);
+done:
+    free(codeschunk);
+    return status;
+}
+
+/* what hencode -s reports */
+typedef struct EncodeStats {
+    uint64_t chars;
+    uint64_t bits;        /* what the codes came to */
+    uint64_t huffmanbits; /* what they would have without a limit */
+    int longest;          /* the longest code */
+} EncodeStats;
+
+/* the bits the codes of the chars of hnodetable come to */
+static uint64_t countCodeBits(HuffmanNode **hnodetable, int hnodetablelen,
+                              HuffmanCode *codes) {
+    uint64_t bits = 0;
+    int i;
+    for (i = 0; i < hnodetablelen && codes != NULL; i++) {
+        bits += (uint64_t)hnodetable[i]->count * codes[hnodetable[i]->ch].len;
+    }
+    return bits;
+}
+
+/*
+ * makes the codes no longer than maxcodelen (0 being no limit), adding
+ * what they come to before and after to stats. codes is NULL for a
+ * single char
+ */
+static int limitCodes(HuffmanNode **hnodetable, int hnodetablelen,
+                      HuffmanCode *codes, int maxcodelen,
+                      HuffmanScratch *scratch, EncodeStats *stats) {
+    int i;
+    stats->huffmanbits += countCodeBits(hnodetable, hnodetablelen, codes);
+    if (maxcodelen > 0 && hnodetablelen > 1 &&
+        !limitCodeLengths(hnodetable, hnodetablelen, codes, maxcodelen,
+                          scratch)) {
+        return 0;
+    }
+    stats->bits += countCodeBits(hnodetable, hnodetablelen, codes);
+    for (i = 0; i < hnodetablelen; i++) {
+        stats->chars += hnodetable[i]->count;
+        if (codes != NULL && codes[hnodetable[i]->ch].len > stats->longest) {
+            stats->longest = codes[hnodetable[i]->ch].len;
+        }
+    }
+    return 1;
+}
+
+#ifndef LIBHUFFMAN
+static void printEncodeStats(EncodeStats *stats, int maxcodelen) {
+    double chars = (stats->chars > 0 ? (double)stats->chars : 1);
+    fprintf(stderr,
+            "{\"chars\": %lu, \"maxCodeLength\": %d, \"longestCode\": %d, "
+            "\"bitsPerChar\": %.4f, \"huffmanBitsPerChar\": %.4f, "
+            "\"ratioLossPercent\": %.4f}\n",
+            (unsigned long)stats->chars, maxcodelen, stats->longest,
+            stats->bits / chars, stats->huffmanbits / chars,
+            (stats->huffmanbits > 0
+                 ? 100.0 * (stats->bits - stats->huffmanbits) /
+                       stats->huffmanbits
+                 : 0.0));
+}
+#endif /* LIBHUFFMAN */
+
+/* a block of the message and what it encodes to, for one thread */
+typedef struct EncodeBlock {
+    unsigned char *msg; /* BLOCKSIZE bytes */
+    size_t msglen;
+    int maxcodelen;
+    unsigned char *out; /* the block's header and codes */
+    size_t outlen;
+    HuffmanNode leaves[256];
+    HuffmanNode *hnodetable[256];
+    HuffmanScratch *scratch;
+    EncodeStats stats;
+    int status;
+    int err;
+} EncodeBlock;
+
+/* allocates everything a block needs, once for every block it does */
+static int startEncodeBlock(EncodeBlock *block, int maxcodelen) {
+    block->maxcodelen = maxcodelen;
+    block->msg = (unsigned char *)malloc(BLOCKSIZE);
+    /* and the last word is stored whole */
+    block->out = (unsigned char *)malloc(MAXENCODEDBLOCK + 8);
+    block->scratch = (HuffmanScratch *)malloc(sizeof(HuffmanScratch));
+    return block->msg != NULL && block->out != NULL &&
+           block->scratch != NULL;
+}
+
+static void freeEncodeBlock(EncodeBlock *block) {
+    free(block->msg);
+    free(block->out);
+    free(block->scratch);
+}
+
+/*
+ * gives the chars counted in charFreqTable canonical codes no longer
+ * than maxcodelen (if it isn't 0), building the tree out of the
+ * block's own nodes. returns the number of chars
+ */
+static int makeCanonicalCodes(EncodeBlock *block,
+                              unsigned int *charFreqTable,
+                              HuffmanCode *codes) {
+    HuffmanNode *htree;
+    int numchars = 0, c;
+
+    memset(codes, 0, CHARFREQTABLESIZE * sizeof(HuffmanCode));
+    for (c = 0; c < CHARFREQTABLESIZE; c++) {
+        if (charFreqTable[c] != 0) {
+            block->leaves[numchars].ch = (unsigned char)c;
+            block->leaves[numchars].count = charFreqTable[c];
+            block->leaves[numchars].newcombinednode = FALSE;
+            block->leaves[numchars].left = NULL;
+            block->leaves[numchars].right = NULL;
+            block->hnodetable[numchars] = &block->leaves[numchars];
+            numchars++;
+        }
+    }
+    htree = buildHuffmanTree(block->hnodetable, numchars, block->scratch);
+    if (htree != NULL) {
+        findPathsToLeafNodes(htree, codes, 0, 0);
+    }
+    /* the scratch has room for any limit so this can't fail */
+    limitCodes(block->hnodetable, numchars, codes, block->maxcodelen,
+               block->scratch, &block->stats);
+    assignCanonicalCodes(codes);
+    return numchars;
+}
+
+/*
+ * encodes a block with codes made for it: the tree gives the length of
+ * each char's code and the codes themselves are the canonical ones
+ * with those lengths, so only the lengths need to go in its header
+ */
+static void *encodeBlock(void *arg) {
+    EncodeBlock *block = (EncodeBlock *)arg;
+    unsigned int charFreqTable[256];
+    HuffmanCode codes[256];
+    size_t codeslen;
+    int numchars, c;
+    unsigned char *out;
+    BitWriter writer;
+
+    memset(charFreqTable, 0, sizeof(charFreqTable));
+    countChars(block->msg, block->msglen, charFreqTable);
+    numchars = makeCanonicalCodes(block, charFreqTable, codes);
+
+    codeslen = (block->stats.bits + 7) / 8;
+    block->outlen = BLOCKHEADERLEN + 2 * numchars + codeslen;
+    out = block->out;
+    putBigEndian(out, block->msglen, 4);
+    putBigEndian(out + 4, codeslen, 4);
+    out[8] = (unsigned char)(numchars - 1);
+    out += BLOCKHEADERLEN;
+    for (c = 0; c < CHARFREQTABLESIZE; c++) {
+        if (charFreqTable[c] != 0) {
+            *out++ = (unsigned char)c;
+            *out++ = (unsigned char)codes[c].len;
+        }
+    }
+    /* a block of one char has no codes */
+    if (numchars > 1) {
+        writer.word = 0;
+        writer.room = 64;
+        out = packCodes(&writer, codes, block->msg, block->msglen, out);
+        flushBitWriter(&writer, out);
+    }
+    block->status = 1;
+    return NULL;
+}
+
+/*
+ * notes where block number numblocks starts in the index, which is
+ * kept as it will be written with room for the rest of it. returns 0
+ * if there's no memory for it
+ */
+static int addBlockOffset(unsigned char **index, size_t *indexcap,
+                          size_t numblocks, uint64_t offset) {
+    size_t len = 8 + 8 * (numblocks + 1) + 8;
+    unsigned char *bigger;
+    if (len > *indexcap) {
+        bigger = (unsigned char *)realloc(*index, 2 * len);
+        if (bigger == NULL) {
             return 0;
         }
+        *index = bigger;
+        *indexcap = 2 * len;
+    }
+    putBigEndian(*index + 8 + 8 * numblocks, offset, 8);
+    return 1;
+}
 
-        /* for character in message */
-        for (i = 0; i < readsize; i++) {
-            ch = messagechunk[i];
-            code = encodingstable[indextable[ch]];
+/*
+ * fills in the end marker and the rest of the index in front of and
+ * after the offsets, offset being where the end marker goes. returns
+ * the length of it all
+ */
+static size_t finishBlockIndex(unsigned char *index, size_t numblocks,
+                               uint64_t offset) {
+    putBigEndian(index, 0, 4);
+    putBigEndian(index + 4, numblocks, 4);
+    putBigEndian(index + 8 + 8 * numblocks, offset + 4, 8);
+    return 8 + 8 * numblocks + 8;
+}
 
-            /* encode into bit in messagechunk for character in encoding */
-            for (j = 0; (codechar = code[j]) != '\0'; j++) {
-                /* encode to current bit */
-                if (codechar == '1') {
-                    codeschunk[index] |= (flag << bitindex);
-                }
-                if (bitindex == 0) {
-                    index++;
-                    if (index == CHUNKSIZE) {
-                        /* don't "goto write;" here because
-                         * need to keep reading */
-                        if (write(outfd, codeschunk, index) == -1) {
-                            return 0;
-                        }
-                        index = 0;
-                    }
-
-                    codeschunk[index] = '\0';
-                    bitindex = 7;
-                } else {
-                    bitindex--;
-                }
+/*
+ * encodes infd to outfd in the block format. the message is read
+ * numthreads blocks at a time, which are encoded at once on a thread
+ * each and written out in order. as it is only read once it can come
+ * from a pipe without being spooled. what every block's codes came to
+ * is added to stats
+ */
+int hencodeBlocks(int infd, int outfd, int numthreads, int maxcodelen,
+                  EncodeStats *stats) {
+    EncodeBlock *blocks;
+    uint64_t offset = BLOCKMAGICLEN;
+    size_t numblocks = 0, indexcap = 0, i;
+    unsigned char *index = NULL;
+    ssize_t got;
+    int n = 0, last = FALSE, status = 0;
+
+    blocks = (EncodeBlock *)calloc(numthreads, sizeof(EncodeBlock));
+    if (blocks == NULL) {
+        goto err;
+    }
+    for (n = 0; n < numthreads; n++) {
+        if (!startEncodeBlock(&blocks[n], maxcodelen)) {
+            goto done;
+        }
+    }
+    if (!addBlockOffset(&index, &indexcap, 0, 0) ||
+        !writeAll(outfd, BLOCKMAGIC, BLOCKMAGICLEN)) {
+        goto done;
+    }
+    while (!last) {
+        for (n = 0; n < numthreads && !last; n++) {
+            if ((got = readAll(infd, blocks[n].msg, BLOCKSIZE)) == -1) {
+                goto done;
             }
+            blocks[n].msglen = got;
+            memset(&blocks[n].stats, 0, sizeof(EncodeStats));
+            last = (got < BLOCKSIZE);
+        }
+        /* a block is never empty */
+        if (blocks[n - 1].msglen == 0) {
+            n--;
+        }
+        if (n == 0) {
+            continue;
+        }
+        if (!runThreads(blocks, sizeof(EncodeBlock), n, encodeBlock)) {
+            goto done;
+        }
+        for (i = 0; i < (size_t)n; i++) {
+            stats->chars += blocks[i].stats.chars;
+            stats->bits += blocks[i].stats.bits;
+            stats->huffmanbits += blocks[i].stats.huffmanbits;
+            if (blocks[i].stats.longest > stats->longest) {
+                stats->longest = blocks[i].stats.longest;
+            }
+            if (!addBlockOffset(&index, &indexcap, numblocks++, offset) ||
+                !writeAll(outfd, blocks[i].out, blocks[i].outlen)) {
+                goto done;
+            }
+            offset += blocks[i].outlen;
         }
     }
-    /*
-     * this checks that we are not on a new, unwritten too byte
-     * because if the msb has been written too bitindex != 7
-     * will automatically be padded since chars are set to 0
-     * before being written too
-     */
-    if (bitindex != 7)
-        index++;
-write:
-    /* this will not write anything if index is 0 */
-    if (write(outfd, codeschunk, index) == -1) {
+    status = writeAll(outfd, index, finishBlockIndex(index, numblocks, offset));
+
+done:
+    for (n = 0; n < numthreads; n++) {
+        freeEncodeBlock(&blocks[n]);
+    }
+    free(blocks);
+    free(index);
+    if (status && close(infd) != -1) {
+        close(outfd);
+        return 1;
+    }
+err:
+    perror("hencode");
+    return 0;
+}
+
+struct HuffmanEncoder {
+    EncodeBlock block;
+    HuffmanWriter writer;
+    void *ctx;
+    uint64_t offset; /* where the next block starts */
+    size_t numblocks;
+    unsigned char *index;
+    size_t indexcap;
+};
+
+HuffmanEncoder *constructHuffmanEncoder(int maxcodelen) {
+    HuffmanEncoder *enc;
+    if (maxcodelen != 0 && (maxcodelen < 8 || maxcodelen > MAXCODELEN)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((enc = (HuffmanEncoder *)calloc(1, sizeof(HuffmanEncoder))) == NULL) {
+        return NULL;
+    }
+    if (!startEncodeBlock(&enc->block, maxcodelen) ||
+        !addBlockOffset(&enc->index, &enc->indexcap, 0, 0)) {
+        freeHuffmanEncoder(enc);
+        return NULL;
+    }
+    return enc;
+}
+
+void freeHuffmanEncoder(HuffmanEncoder *enc) {
+    if (enc == NULL) {
+        return;
+    }
+    freeEncodeBlock(&enc->block);
+    free(enc->index);
+    free(enc);
+}
+
+size_t huffmanEncodeBound(size_t len) { return MAXCANONHEADERLEN + len; }
+
+/*
+ * the codes go straight to out, all but the last word of them, which
+ * is stored whole so has to go somewhere with room for it first
+ */
+int huffmanEncodeBuffer(HuffmanEncoder *enc, const void *msg, size_t len,
+                        void *out, size_t outcap, size_t *outlen) {
+    EncodeBlock *block = &enc->block;
+    const unsigned char *bytes = (const unsigned char *)msg;
+    unsigned int charFreqTable[256];
+    HuffmanCode codes[256];
+    unsigned char header[MAXCANONHEADERLEN], last[8], *end;
+    BitWriter writer;
+    size_t headerlen, codeslen;
+    int numchars;
+
+    *outlen = 0;
+    /* an empty message is an empty file */
+    if (len == 0) {
+        return 1;
+    }
+    if (len > 0xFFFFFFFFu) {
+        errno = EFBIG;
         return 0;
     }
+    memset(charFreqTable, 0, sizeof(charFreqTable));
+    countChars(bytes, len, charFreqTable);
+    memset(&block->stats, 0, sizeof(EncodeStats));
+    numchars = makeCanonicalCodes(block, charFreqTable, codes);
+    headerlen = formatCanonicalHeader(len, (numchars > 1 ? codes : NULL),
+                                      block->leaves[0].ch, header);
+    codeslen = (block->stats.bits + 7) / 8;
+    if (headerlen + codeslen > outcap) {
+        errno = ENOSPC;
+        return 0;
+    }
+    memcpy(out, header, headerlen);
+    *outlen = headerlen + codeslen;
+    if (numchars > 1) {
+        writer.word = 0;
+        writer.room = 64;
+        end = packCodes(&writer, codes, bytes, len,
+                        (unsigned char *)out + headerlen);
+        flushBitWriter(&writer, last);
+        memcpy(end, last, (unsigned char *)out + *outlen - end);
+    }
     return 1;
 }
 
-int hencode(int infd, int outfd) {
+int startHuffmanEncodeStream(HuffmanEncoder *enc, HuffmanWriter writer,
+                             void *ctx) {
+    enc->writer = writer;
+    enc->ctx = ctx;
+    enc->offset = BLOCKMAGICLEN;
+    enc->numblocks = 0;
+    enc->block.msglen = 0;
+    return writer(ctx, BLOCKMAGIC, BLOCKMAGICLEN);
+}
+
+/* encodes the block written so far and hands it to the writer */
+static int flushEncodeStream(HuffmanEncoder *enc) {
+    EncodeBlock *block = &enc->block;
+    memset(&block->stats, 0, sizeof(EncodeStats));
+    encodeBlock(block);
+    if (!addBlockOffset(&enc->index, &enc->indexcap, enc->numblocks,
+                        enc->offset) ||
+        !enc->writer(enc->ctx, block->out, block->outlen)) {
+        return 0;
+    }
+    enc->numblocks++;
+    enc->offset += block->outlen;
+    block->msglen = 0;
+    return 1;
+}
+
+int writeHuffmanEncodeStream(HuffmanEncoder *enc, const void *bytes,
+                             size_t len) {
+    EncodeBlock *block = &enc->block;
+    const unsigned char *in = (const unsigned char *)bytes;
+    size_t take;
+
+    while (len > 0) {
+        take = BLOCKSIZE - block->msglen;
+        take = (take < len ? take : len);
+        memcpy(block->msg + block->msglen, in, take);
+        block->msglen += take;
+        in += take;
+        len -= take;
+        if (block->msglen == BLOCKSIZE && !flushEncodeStream(enc)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int finishHuffmanEncodeStream(HuffmanEncoder *enc) {
+    if (enc->block.msglen > 0 && !flushEncodeStream(enc)) {
+        return 0;
+    }
+    return enc->writer(enc->ctx, enc->index,
+                       finishBlockIndex(enc->index, enc->numblocks,
+                                        enc->offset));
+}
+
+int fileno(FILE *stream);
+
+/*
+ * encodes infd to outfd in the original format, or with canonical set
+ * the canonical format, which only differs in the header and codes.
+ * only the canonical format can have its codes limited to maxcodelen
+ * and what they came to is added to stats. the chars of a regular file
+ * are counted on numthreads threads
+ */
+int hencode(int infd, int outfd, int canonical, int maxcodelen,
+            int numthreads, EncodeStats *stats) {
     unsigned int *charFreqTable = NULL;
     /* charFreqTable will become index table. simple name change for clarity */
     unsigned int *indextable = NULL;
-    char **encodingstable = NULL;
+    HuffmanCode *codes = NULL;
     HuffmanNode **hnodetable = NULL;
     int hnodetablelen = 0, status = 0;
     HuffmanNode *htree = NULL;
+    /* where the message is read from the second time, and from where */
+    int msgfd = infd;
+    off_t start;
+    FILE *spool = NULL;
 
     /*
      * STEP 1:
      * generate character frequency table
+     * input that can't be seeked back to the start of (a pipe or a
+     * terminal) is copied to an unlinked temporary file as it is
+     * read, and the message is encoded from that instead. a file
+     * that was already part read (stdin) is only encoded from where
+     * it was left
      */
-    charFreqTable = getCharFreqTableFromFile(infd, &hnodetablelen);
+    if ((start = lseek(infd, 0, SEEK_CUR)) == -1) {
+        if ((spool = tmpfile()) == NULL) {
+            goto err;
+        }
+        msgfd = fileno(spool);
+        start = 0;
+    }
+    charFreqTable = getCharFreqTableFromFile(
+        infd, start, &hnodetablelen, (spool != NULL ? msgfd : -1),
+        numthreads);
     if (charFreqTable == NULL) {
         goto err;
     }
@@ -334,6 +954,7 @@ int hencode(int infd, int outfd) {
     if (hnodetablelen == 1) {
         /* do not have to worry about encoding message afterwards
          * as it will just write nothing because hnodetablelen is 1 */
+        limitCodes(hnodetable, hnodetablelen, NULL, 0, NULL, stats);
         goto encodeheader;
     }
 #ifdef DEBUG
@@ -361,18 +982,31 @@ int hencode(int infd, int outfd) {
     /*
      * STEP 5:
      * now use all previously gathered information to generate
-     * encodings table
-     * encodings table stores paths as character representations
-     * of 1 and 0 to later be parsed into respective bits
-     * allows for easier debugging and completely avoiding
-     * the how to figure out the end of a code in bits question
+     * the code of every character
+     * codes are kept as integers with their length so encoding
+     * a character is putting its bits in at the end of the
+     * output with a couple of shifts
      */
-    encodingstable = generateCharacterEncodings(hnodetable, hnodetablelen,
-                                                htree, indextable);
+    codes = generateCharacterEncodings(htree);
+    if (codes == NULL) {
+        goto err;
+    }
+    /* the same lengths so it comes to just as many bits, unless
+     * they have to be cut down to maxcodelen */
+    if (canonical) {
+        if (!limitCodes(hnodetable, hnodetablelen, codes, maxcodelen, NULL,
+                        stats)) {
+            goto err;
+        }
+        assignCanonicalCodes(codes);
+    } else if (!limitCodes(hnodetable, hnodetablelen, codes, 0, NULL,
+                           stats)) {
+        goto err;
+    }
 
 #ifdef DEBUG
     /* prints in format required by lab03 */
-    printEncodingsTableHex(encodingstable, indextable);
+    printEncodingsTableHex(codes);
 #endif
 
     /*
@@ -382,21 +1016,34 @@ int hencode(int infd, int outfd) {
      *        so leaf nodes are characters from original message
      * hnode table: alphabetically sorted list of HuffmanNodes for
      *              each character in original message.
-     * encoding table: path to get to each char in hnode table in htree
+     * codes: path to get to each char in htree, indexed by char
      * indextable: using char as index will yield the index
-     *             of the node in hnode table (for count) and
-     *             encoding in encoding table for the char
+     *             of the node in hnode table (for count)
      */
 
     /*
      * ENCODING STEP 1: write header
      */
 encodeheader:
-    status = encodeHeaderToFile(hnodetable, hnodetablelen, indextable, outfd);
+    if (canonical) {
+        status = encodeCanonicalHeaderToFile(htree, codes, outfd);
+    } else {
+        status =
+            encodeHeaderToFile(hnodetable, hnodetablelen, indextable, outfd);
+    }
+    if (!status) {
+        goto encoded;
+    }
 
 encode:
-    encodeMessageToFile(hnodetable, hnodetablelen, encodingstable, htree,
-                        indextable, infd, outfd);
+    status = encodeMessageToFile(hnodetablelen, codes, msgfd, start, outfd);
+encoded:
+    if (spool != NULL) {
+        fclose(spool);
+    }
+    if (!status) {
+        goto err;
+    }
 
 #ifdef DEBUG
     printEncodedFilePretty(outfd);
@@ -415,16 +1062,57 @@ err:
     return 0;
 }
 
+#ifndef LIBHUFFMAN
+/* not declared with -ansi */
+int getopt(int argc, char *const argv[], const char *optstring);
+extern char *optarg;
+extern int optind;
+
 int main(int argc, char *argv[]) {
     char *infile = NULL;
     char *outfile = NULL;
-    int infd, outfd;
-    switch (argc) {
+    int infd, outfd, opt, status;
+    /* 0 writes the original format, anything else the block format
+     * encoded on that many threads */
+    int numthreads = 0, canonical = FALSE, maxcodelen = 0, printstats = FALSE;
+    /* what the other formats count the chars of a file on */
+    int countthreads = 1;
+    EncodeStats stats;
+
+    while ((opt = getopt(argc, argv, "cj:l:st:")) != -1) {
+        if (opt == 'c') {
+            canonical = TRUE;
+        } else if (opt == 's') {
+            printstats = TRUE;
+        } else if (opt == 't') {
+            if ((countthreads = atoi(optarg)) < 1) {
+                error(0, EINVAL, "Usage: %s", hencodeusage);
+                return -1;
+            }
+        } else if (opt == 'l') {
+            /* a code for every byte has to fit */
+            maxcodelen = atoi(optarg);
+            if (maxcodelen < 8 || maxcodelen > MAXCODELEN) {
+                error(0, EINVAL, "Usage: %s", hencodeusage);
+                return -1;
+            }
+        } else if (opt != 'j' || (numthreads = atoi(optarg)) < 1) {
+            error(0, EINVAL, "Usage: %s", hencodeusage);
+            return -1;
+        }
+    }
+    /* the original format has no way to keep limited codes */
+    if (maxcodelen > 0) {
+        canonical = TRUE;
+    }
+    /* no infile (or -) reads from stdin */
+    switch (argc - optind) {
+    case 1:
+        infile = argv[optind];
+        break;
     case 2:
-        infile = argv[1];
-    case 3:
-        infile = argv[1];
-        outfile = argv[2];
+        infile = argv[optind];
+        outfile = argv[optind + 1];
     }
     if ((infd = openInFile('e', infile)) == -1) {
         return -1;
@@ -432,6 +1120,17 @@ int main(int argc, char *argv[]) {
     if ((outfd = openOutFile('e', outfile)) == -1) {
         return -1;
     }
+    memset(&stats, 0, sizeof(stats));
+    if (numthreads > 0) {
+        status = hencodeBlocks(infd, outfd, numthreads, maxcodelen, &stats);
+    } else {
+        status = hencode(infd, outfd, canonical, maxcodelen, countthreads,
+                         &stats);
+    }
+    if (status && printstats) {
+        printEncodeStats(&stats, maxcodelen);
+    }
     /* hencode uses normal true/false so return inverse */
-    return !hencode(infd, outfd);
+    return !status;
 }
+#endif /* LIBHUFFMAN */
@@ -2,13 +2,18 @@
 
 #ifndef HENCODE_H
 #define HENCODE_H
-void hencode(int infd, int outfd);
+struct EncodeStats;
 
-char **generateCharacterEncodings(HuffmanNode **hnodetable, HuffmanNode *htree,
-                                  int *indextable);
+int hencode(int infd, int outfd, int canonical, int maxcodelen,
+            int numthreads, struct EncodeStats *stats);
 
-void findPathsToLeafNodes(HuffmanNode *htree, int *indextable,
-                          char **encodingstable, char *currentpath);
+int hencodeBlocks(int infd, int outfd, int numthreads, int maxcodelen,
+                  struct EncodeStats *stats);
+
+HuffmanCode *generateCharacterEncodings(HuffmanNode *htree);
+
+int findPathsToLeafNodes(HuffmanNode *htree, HuffmanCode *codes,
+                         uint64_t path, int pathlen);
 
 void prepareHeaderInfo(int *charFreqTable, HuffmanNode **hnodetable);
 
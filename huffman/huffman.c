@@ -1,7 +1,8 @@
-#include "huffmannode.h"
+#include "huffman.h"
 #include <errno.h>
 #include <error.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,8 +15,17 @@ const int CHARFREQTABLESIZE = 256; /* # of possible chars */
 #define CHUNKSIZE 4000 /* ARBITRARY */
 const int TRUE = 1;
 const int FALSE = 0;
-const char *hencodeusage = "hencode infile [ outfile ]";
-const char *hdecodeusage = "hdecode [ ( infile | - ) [ outfile ] ]";
+const char *hencodeusage =
+    "hencode [ -c | -j threads ] [ -l maxcodelen ] [ -s ] [ -t threads ]\n"
+    "        [ ( infile | - ) [ outfile ] ]";
+const char *hdecodeusage =
+    "hdecode [ -j threads ] [ ( infile | - ) [ outfile ] ]";
+/* the second byte is above the seventh, which the first two chars of
+ * an original header never are, so no original file starts with it */
+const unsigned char BLOCKMAGIC[BLOCKMAGICLEN] = {0x89, 'H', 'U', 'F',
+                                                 '\r', '\n', 0x1a, '\n'};
+const unsigned char CANONMAGIC[BLOCKMAGICLEN] = {0x89, 'H', 'U', 'C',
+                                                 '\r', '\n', 0x1a, '\n'};
 
 HuffmanNode *constructHuffmanNode(unsigned char ch, int count,
                                   HuffmanNode *left, HuffmanNode *right) {
@@ -144,44 +154,392 @@ HuffmanNode *combineHuffmanNodes(HuffmanNode *left, HuffmanNode *right) {
     return combo;
 }
 
-/* assumes the hnodetable it recieves is sorted and null terminated */
-/* DOES NOT MODIFY ORIGINAL TABLE */
-/* DOES NOT GENERATE ENCODING */
+/*
+ * whether a comes out of the queue before b. that's what
+ * compareHuffmanNodes says, except for two combined nodes of the same
+ * count, which it can't put in order. sorting the queue kept those in
+ * the order they were in, which was newest first as each was put at
+ * the head. combined nodes are made from the end of one array
+ * backwards so the newer one is the lower
+ */
+static int huffmanNodeBefore(HuffmanNode *a, HuffmanNode *b) {
+    if (a->count == b->count && a->newcombinednode == TRUE &&
+        b->newcombinednode == TRUE) {
+        return a < b;
+    }
+    return compareHuffmanNodes(&a, &b) < 0;
+}
+
+/* moves the node at i up the heap until its parent comes first */
+static void siftHuffmanNodeUp(HuffmanNode **heap, int i) {
+    HuffmanNode *hnode = heap[i];
+    while (i > 0 && huffmanNodeBefore(hnode, heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = hnode;
+}
+
+/* moves the node at i down the heap until it comes before its kids */
+static void siftHuffmanNodeDown(HuffmanNode **heap, int len, int i) {
+    HuffmanNode *hnode = heap[i];
+    int kid;
+    while ((kid = 2 * i + 1) < len) {
+        if (kid + 1 < len && huffmanNodeBefore(heap[kid + 1], heap[kid])) {
+            kid++;
+        }
+        if (!huffmanNodeBefore(heap[kid], hnode)) {
+            break;
+        }
+        heap[i] = heap[kid];
+        i = kid;
+    }
+    heap[i] = hnode;
+}
+
+static HuffmanNode *popHuffmanNode(HuffmanNode **heap, int *len) {
+    HuffmanNode *first = heap[0];
+    heap[0] = heap[--*len];
+    if (*len > 0) {
+        siftHuffmanNodeDown(heap, *len, 0);
+    }
+    return first;
+}
+
+/*
+ * the two nodes that come first in the queue are combined, the first
+ * on the left, and the combination goes back in until one is left.
+ * the queue is a binary heap in heap and the hnodetablelen - 1
+ * combined nodes are made in combos, the root being the first
+ */
+static HuffmanNode *mergeHuffmanNodes(HuffmanNode **hnodetable,
+                                      int hnodetablelen, HuffmanNode **heap,
+                                      HuffmanNode *combos) {
+    HuffmanNode *combo, *left, *right;
+    int len = hnodetablelen, next = hnodetablelen - 1, i;
+
+    memcpy(heap, hnodetable, hnodetablelen * sizeofHuffmanNodePtr);
+    for (i = len / 2 - 1; i >= 0; i--) {
+        siftHuffmanNodeDown(heap, len, i);
+    }
+    while (len > 1) {
+        left = popHuffmanNode(heap, &len);
+        right = popHuffmanNode(heap, &len);
+        /* as combineHuffmanNodes does */
+        combo = &combos[--next];
+        combo->ch = left->ch;
+        combo->count = left->count + right->count;
+        combo->left = left;
+        combo->right = right;
+        left->newcombinednode = FALSE;
+        right->newcombinednode = FALSE;
+        combo->newcombinednode = TRUE;
+        heap[len++] = combo;
+        siftHuffmanNodeUp(heap, len - 1);
+    }
+    return combos;
+}
+
 HuffmanNode *createHuffmanTreeFromNodeList(HuffmanNode **hnodetable,
                                            int hnodetablelen) {
-    /* copy to preserve hnodetable */
-    HuffmanNode **queue =
-        (HuffmanNode **)malloc((hnodetablelen + 1) * sizeofHuffmanNodePtr);
-    void *copyresult =
-        memcpy(queue, hnodetable, (hnodetablelen + 1) * sizeofHuffmanNodePtr);
-    HuffmanNode **head;
-
-    /* used for verbosity when peeking */
-    HuffmanNode *left = NULL;
-    HuffmanNode *right = NULL;
-    HuffmanNode *combo = NULL;
-
-    if (copyresult == NULL) {
+    HuffmanNode **heap;
+    HuffmanNode *combos;
+
+    if (hnodetablelen < 2) {
+        return (hnodetablelen == 1 ? hnodetable[0] : NULL);
+    }
+    heap = (HuffmanNode **)malloc(hnodetablelen * sizeofHuffmanNodePtr);
+    combos = (HuffmanNode *)malloc((hnodetablelen - 1) * sizeofHuffmanNode);
+    if (heap == NULL || combos == NULL) {
+        free(heap);
+        free(combos);
         return NULL;
     }
-    /* following while loops through this series of steps */
-    /* peek top 2 */
-    /* combine top 2*/
-    /* set combination and queue to spot of second pop */
-    /* sort queue (making it a priority queue) */
-    /* repeat until second peek is NULL (end of queue) */
-    sortHuffmanNodeTable(queue, hnodetablelen);
-    head = queue;
-    while ((left = *head) != NULL && (right = *(head + 1)) != NULL) {
-        combo = combineHuffmanNodes(left, right);
-        head += 1;
-        hnodetablelen--;
-        *head = combo;
-        sortHuffmanNodeTable(head, hnodetablelen);
+    mergeHuffmanNodes(hnodetable, hnodetablelen, heap, combos);
+    free(heap);
+    return combos;
+}
+
+HuffmanNode *buildHuffmanTree(HuffmanNode **hnodetable, int hnodetablelen,
+                              HuffmanScratch *scratch) {
+    if (hnodetablelen < 2) {
+        return (hnodetablelen == 1 ? hnodetable[0] : NULL);
+    }
+    return mergeHuffmanNodes(hnodetable, hnodetablelen, scratch->heap,
+                             scratch->combos);
+}
+
+/* the leaves are nodes of their own */
+static void freeHuffmanLeaves(HuffmanNode *htree) {
+    if (htree->left == NULL && htree->right == NULL) {
+        free(htree);
+        return;
     }
+    freeHuffmanLeaves(htree->left);
+    freeHuffmanLeaves(htree->right);
+}
 
-    /* will return null if *head was ever null */
-    return *head;
+void freeHuffmanTree(HuffmanNode *htree) {
+    int combined;
+    if (htree == NULL) {
+        return;
+    }
+    combined = (htree->left != NULL || htree->right != NULL);
+    freeHuffmanLeaves(htree);
+    /* and every combined node is the one array the root starts */
+    if (combined) {
+        free(htree);
+    }
+}
+
+void assignCanonicalCodes(HuffmanCode *codes) {
+    int numcodes[MAXCODELEN + 1];
+    uint64_t next[MAXCODELEN + 1], code = 0;
+    int i, len;
+
+    memset(numcodes, 0, sizeof(numcodes));
+    for (i = 0; i < CHARFREQTABLESIZE; i++) {
+        numcodes[codes[i].len]++;
+    }
+    /* the first code of each length follows the last one shorter */
+    numcodes[0] = 0;
+    for (len = 1; len <= MAXCODELEN; len++) {
+        code = (code + numcodes[len - 1]) << 1;
+        next[len] = code;
+    }
+    for (i = 0; i < CHARFREQTABLESIZE; i++) {
+        if (codes[i].len > 0) {
+            codes[i].bits = next[codes[i].len]++;
+        }
+    }
+}
+
+/*
+ * package-merge sees a code length limit of maxcodelen as a list for
+ * each depth down to it. the deepest list is the chars in order of
+ * count, and each one above is the chars merged with packages of
+ * adjacent pairs from the list below. the 2n - 2 cheapest of the top
+ * list are what a code is made of, and taking a package takes both
+ * halves in the list below, so a char's code is as long as the number
+ * of lists it is taken from. the chars taken from a list are always
+ * the cheapest ones since they go in in order
+ */
+int limitCodeLengths(HuffmanNode **hnodetable, int hnodetablelen,
+                     HuffmanCode *codes, int maxcodelen,
+                     HuffmanScratch *scratch) {
+    int n = hnodetablelen, listcap = 2 * hnodetablelen - 1;
+    int listlens[MAXCODELEN + 1];
+    int depth, longest = 0, i, j, k, numpkgs, take, numleaves;
+    HuffmanNode **leaves;
+    uint64_t *weights, *list, *below, pkg;
+    unsigned char *packaged, *ispkg;
+
+    for (i = 0; i < n; i++) {
+        if (codes[hnodetable[i]->ch].len > longest) {
+            longest = codes[hnodetable[i]->ch].len;
+        }
+    }
+    if (longest <= maxcodelen) {
+        return 1;
+    }
+    if (maxcodelen < 1 || (maxcodelen < 16 && n > (1 << maxcodelen))) {
+        errno = EINVAL;
+        return 0;
+    }
+    if (scratch != NULL) {
+        leaves = scratch->leaves;
+        weights = scratch->weights;
+        packaged = scratch->packaged;
+    } else {
+        leaves = (HuffmanNode **)malloc(n * sizeofHuffmanNodePtr);
+        weights = (uint64_t *)malloc(maxcodelen * listcap * sizeof(uint64_t));
+        packaged = (unsigned char *)malloc(maxcodelen * listcap);
+    }
+    if (leaves == NULL || weights == NULL || packaged == NULL) {
+        free(leaves);
+        free(weights);
+        free(packaged);
+        errno = ENOMEM;
+        return 0;
+    }
+    memcpy(leaves, hnodetable, n * sizeofHuffmanNodePtr);
+    sortHuffmanNodeTable(leaves, n);
+
+    /* list d - 1 is for depth d */
+    list = weights + (maxcodelen - 1) * listcap;
+    ispkg = packaged + (maxcodelen - 1) * listcap;
+    for (i = 0; i < n; i++) {
+        list[i] = leaves[i]->count;
+        ispkg[i] = FALSE;
+    }
+    listlens[maxcodelen] = n;
+    for (depth = maxcodelen - 1; depth >= 1; depth--) {
+        below = weights + depth * listcap;
+        list = weights + (depth - 1) * listcap;
+        ispkg = packaged + (depth - 1) * listcap;
+        numpkgs = listlens[depth + 1] / 2;
+        for (i = j = k = 0; i < n || j < numpkgs; k++) {
+            pkg = (j < numpkgs ? below[2 * j] + below[2 * j + 1] : 0);
+            if (j == numpkgs || (i < n && leaves[i]->count <= pkg)) {
+                list[k] = leaves[i++]->count;
+                ispkg[k] = FALSE;
+            } else {
+                list[k] = pkg;
+                ispkg[k] = TRUE;
+                j++;
+            }
+        }
+        listlens[depth] = k;
+    }
+
+    for (i = 0; i < n; i++) {
+        codes[leaves[i]->ch].len = 0;
+    }
+    take = 2 * n - 2;
+    for (depth = 1; depth <= maxcodelen && take > 0; depth++) {
+        ispkg = packaged + (depth - 1) * listcap;
+        for (numleaves = k = 0; k < take; k++) {
+            numleaves += !ispkg[k];
+        }
+        for (i = 0; i < numleaves; i++) {
+            codes[leaves[i]->ch].len++;
+        }
+        take = 2 * (take - numleaves);
+    }
+    if (scratch == NULL) {
+        free(leaves);
+        free(weights);
+        free(packaged);
+    }
+    return 1;
+}
+
+int checkCodeLengths(HuffmanCode *codes) {
+    int numcodes[MAXCODELEN + 1];
+    int i, len;
+    uint64_t nodes = 0;
+
+    memset(numcodes, 0, sizeof(numcodes));
+    for (i = 0; i < CHARFREQTABLESIZE; i++) {
+        if (codes[i].len < 0 || codes[i].len > MAXCODELEN) {
+            return 0;
+        }
+        numcodes[codes[i].len]++;
+    }
+    /* going up a level at a time the nodes at each have to pair up
+     * into the ones above, ending in the root */
+    for (len = MAXCODELEN; len > 0; len--) {
+        nodes += numcodes[len];
+        if (nodes % 2 != 0) {
+            return 0;
+        }
+        nodes /= 2;
+    }
+    return nodes == 1;
+}
+
+/* bytes are taken a word at a time, in whatever order they load in as
+ * that doesn't change how many there are of each */
+void countChars(const unsigned char *bytes, size_t len,
+                unsigned int *charFreqTable) {
+    unsigned int counts[HISTOGRAMWAYS][256];
+    const unsigned char *end = bytes + len;
+    uint64_t word;
+    int c, way;
+
+    memset(counts, 0, sizeof(counts));
+    for (; end - bytes >= 8; bytes += 8) {
+        memcpy(&word, bytes, 8);
+        counts[0][word & 0xFF]++;
+        counts[1][(word >> 8) & 0xFF]++;
+        counts[2][(word >> 16) & 0xFF]++;
+        counts[3][(word >> 24) & 0xFF]++;
+        counts[4][(word >> 32) & 0xFF]++;
+        counts[5][(word >> 40) & 0xFF]++;
+        counts[6][(word >> 48) & 0xFF]++;
+        counts[7][word >> 56]++;
+    }
+    for (; bytes < end; bytes++) {
+        counts[0][*bytes]++;
+    }
+    for (c = 0; c < 256; c++) {
+        for (way = 0; way < HISTOGRAMWAYS; way++) {
+            charFreqTable[c] += counts[way][c];
+        }
+    }
+}
+
+void putBigEndian(unsigned char *bytes, uint64_t value, int len) {
+    while (len-- > 0) {
+        bytes[len] = (unsigned char)value;
+        value >>= 8;
+    }
+}
+
+uint64_t getBigEndian(const unsigned char *bytes, int len) {
+    uint64_t value = 0;
+    int i;
+    for (i = 0; i < len; i++) {
+        value = value << 8 | bytes[i];
+    }
+    return value;
+}
+
+ssize_t readAll(int fd, void *buf, size_t len) {
+    size_t got = 0;
+    ssize_t n;
+    while (got < len) {
+        if ((n = read(fd, (char *)buf + got, len - got)) == -1) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += n;
+    }
+    return got;
+}
+
+int writeAll(int fd, const void *buf, size_t len) {
+    ssize_t put;
+    const char *bytes = (const char *)buf;
+    for (; len > 0; bytes += put, len -= put) {
+        if ((put = write(fd, bytes, len)) == -1) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int runThreads(void *jobs, size_t jobsize, int numjobs,
+               void *(*run)(void *)) {
+    pthread_t *threads;
+    int i, started, err = 0;
+
+    if (numjobs == 1) {
+        run(jobs);
+        return 1;
+    }
+    threads = (pthread_t *)malloc(numjobs * sizeof(pthread_t));
+    if (threads == NULL) {
+        return 0;
+    }
+    for (started = 0; started < numjobs; started++) {
+        err = pthread_create(&threads[started], NULL, run,
+                             (char *)jobs + started * jobsize);
+        if (err != 0) {
+            break;
+        }
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    if (err != 0) {
+        errno = err;
+        return 0;
+    }
+    return 1;
 }
 
 /* gcc not recognizing filno as function at compile time? */
@@ -222,16 +580,7 @@ int openInFile(char encodeordecode, char *path) {
         return -1;
     }
     if (path == NULL || strcmp(path, "-") == 0) {
-        switch (encodeordecode) {
-        case 'e':
-            errno = EINVAL;
-            error(0, EINVAL,
-                  "hencode: hencode requires an infile.\nUsage: %s\n",
-                  hencodeusage);
-            return -1;
-        case 'd':
-            infd = fileno(stdin);
-        }
+        infd = fileno(stdin);
     } else {
         infd = open(path, O_RDONLY);
     }
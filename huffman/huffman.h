@@ -1,5 +1,7 @@
 #include "huffmannode.h"
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 #ifndef HUFFMAN_H
 #define HUFFMAN_H
@@ -13,6 +15,71 @@ extern const int CHARFREQTABLESIZE;
 extern const int TRUE;
 extern const int FALSE;
 
+/* longest code there can be, what fits in HuffmanCode's bits */
+#define MAXCODELEN 64
+
+/* a character's code, the first bit of it being the highest of
+ * the len bits in bits */
+typedef struct HuffmanCode {
+    uint64_t bits;
+    int len;
+} HuffmanCode;
+
+/*
+ * the block format hencode -j writes, which hdecode tells apart from
+ * the original format by its magic. the message is cut into blocks of
+ * BLOCKSIZE bytes (the last can be shorter) each coded on its own, so
+ * blocks can be encoded and decoded in parallel. all numbers are big
+ * endian:
+ *
+ *   BLOCKMAGIC
+ *   for each block:
+ *     uint32 chars in the block (never 0)
+ *     uint32 bytes of codes
+ *     uint8  symbols - 1
+ *     [ uint8 symbol  uint8 code length ] * symbols, in symbol order
+ *     the codes, padded with 0s to a whole byte
+ *   uint32 0, marking the end of the blocks
+ *   the index:
+ *     uint32 blocks
+ *     uint64 offset of each block in the file
+ *     uint64 offset of the index
+ *
+ * codes are canonical so the lengths are all that has to be kept, a
+ * block of one symbol having a code length of 0 and no codes
+ */
+#define BLOCKSIZE (1 << 20)
+#define BLOCKMAGICLEN 8
+/* chars, bytes of codes and symbols */
+#define BLOCKHEADERLEN 9
+/* the most a block's header and codes can come to, as no code for
+ * it averages more than the 8 bits a char */
+#define MAXENCODEDBLOCK (BLOCKHEADERLEN + 2 * 256 + BLOCKSIZE)
+extern const unsigned char BLOCKMAGIC[BLOCKMAGICLEN];
+
+/*
+ * the canonical format hencode -c writes, the original format with a
+ * header of code lengths in place of counts:
+ *
+ *   CANONMAGIC
+ *   uint32 chars in the message
+ *   the code length of every symbol from 0 to 255, packed into 4 bit
+ *   nibbles (high one first, the last byte padded with 0):
+ *     1 to 14       the next symbol's code is that long
+ *     15 hi lo      the next symbol's code is hi * 16 + lo long
+ *     0 hi lo       the next hi * 16 + lo + 1 symbols have no code
+ *   the codes, padded with 0s to a whole byte
+ *
+ * a message of one symbol gives it a length of 1 and has no codes, an
+ * empty one is an empty file like in the original format
+ */
+extern const unsigned char CANONMAGIC[BLOCKMAGICLEN];
+/* the most bytes the packed lengths can take */
+#define MAXCODELENGTHSLEN 384
+
+extern const char *hencodeusage;
+extern const char *hdecodeusage;
+
 int comphufchars(HuffmanNode *h1, HuffmanNode *h2);
 
 HuffmanNode *constructHuffmanNode(unsigned char ch, int count,
@@ -44,9 +111,10 @@ void sortHuffmanNodeTableAlphabetically(HuffmanNode **hnodetable,
 
 HuffmanNode *combineHuffmanNodes(HuffmanNode *left, HuffmanNode *right);
 
-/* assumes the hnodetable it recieves is sorted and null terminated */
+/* takes the hnodetablelen nodes of hnodetable in any order */
 /* DOES NOT MODIFY ORIGINAL TABLE */
 /* DOES NOT GENERATE ENCODING */
+/* the combined nodes are one allocation, free with freeHuffmanTree */
 HuffmanNode *createHuffmanTreeFromNodeList(HuffmanNode **hnodetable,
                                            int hnodetablelen);
 
@@ -56,6 +124,85 @@ HuffmanNode *createHuffmanTreeFromNodeList(HuffmanNode **hnodetable,
  * calls sortHuffmanNodes with the default node comparator function */
 void sortHuffmanNodeTable(HuffmanNode **hnodetable, const int hnodetablelen);
 
+/*
+ * room to build a tree and limit its codes in without allocating,
+ * which is worth keeping around when that is done over and over
+ */
+typedef struct HuffmanScratch {
+    HuffmanNode *heap[256];
+    HuffmanNode combos[255];
+    HuffmanNode *leaves[256];
+    /* package-merge's lists, one per depth */
+    uint64_t weights[MAXCODELEN * 511];
+    unsigned char packaged[MAXCODELEN * 511];
+} HuffmanScratch;
+
+/*
+ * createHuffmanTreeFromNodeList building the tree in scratch rather
+ * than allocating. the tree is only good until scratch is used again
+ * and isn't freed
+ */
+HuffmanNode *buildHuffmanTree(HuffmanNode **hnodetable, int hnodetablelen,
+                              HuffmanScratch *scratch);
+
+/* frees every node of the tree */
+void freeHuffmanTree(HuffmanNode *htree);
+
+/*
+ * gives every character with a code length the canonical code of
+ * that length: codes are handed out in order of length and then of
+ * character, each one more than the last (shifted up to its length)
+ */
+void assignCanonicalCodes(HuffmanCode *codes);
+
+/*
+ * makes the lengths of the codes of the hnodetablelen chars of
+ * hnodetable (at least two) no longer than maxcodelen, leaving them
+ * alone if they already aren't. the new lengths are the best there are
+ * within the limit, found with package-merge, in scratch unless it's
+ * NULL. returns 0 if there's no memory or the chars can't have codes
+ * that short
+ */
+int limitCodeLengths(HuffmanNode **hnodetable, int hnodetablelen,
+                     HuffmanCode *codes, int maxcodelen,
+                     HuffmanScratch *scratch);
+
+/*
+ * whether the lengths of the codes (0 being no code) are those of the
+ * leaves of a tree where every node has two children, which they have
+ * to be for the canonical codes to decode. needs two or more codes
+ */
+int checkCodeLengths(HuffmanCode *codes);
+
+/*
+ * adds the number of times each char is in the len bytes of bytes to
+ * charFreqTable. the counts are kept in HISTOGRAMWAYS tables, each
+ * taking every HISTOGRAMWAYSth byte, so a run of the same char doesn't
+ * have every count wait on the one before it
+ */
+#define HISTOGRAMWAYS 8
+void countChars(const unsigned char *bytes, size_t len,
+                unsigned int *charFreqTable);
+
+/* puts the len lowest bytes of value big endian, and gets them back */
+void putBigEndian(unsigned char *bytes, uint64_t value, int len);
+uint64_t getBigEndian(const unsigned char *bytes, int len);
+
+/* reads until there are len bytes or the input ends. returns how
+ * many were read, or -1 if a read fails */
+ssize_t readAll(int fd, void *buf, size_t len);
+
+/* writes all of buf to fd, returns 0 if it can't */
+int writeAll(int fd, const void *buf, size_t len);
+
+/*
+ * runs run on each of the numjobs jobs (every one jobsize bytes) at
+ * once, each on its own thread unless there's only one. returns 0 and
+ * sets errno if a thread can't be started
+ */
+int runThreads(void *jobs, size_t jobsize, int numjobs,
+               void *(*run)(void *));
+
 int openInFile(char encodeordecode, char *path);
 int openOutFile(char encodeordecode, char *path);
 #endif /* HUFFMAN_H */
@@ -0,0 +1,86 @@
+#include <stddef.h>
+
+#ifndef LIBHUFFMAN_H
+#define LIBHUFFMAN_H
+
+/*
+ * hencode and hdecode as a library (make libhuffman.a), for coding
+ * buffers in memory rather than files. an encoder or decoder holds
+ * everything it needs, allocated when it is constructed, and can be
+ * used over and over without allocating more. the only exceptions are
+ * a decoder growing its tables for codes far longer than it has seen
+ * and a stream having more blocks than any before it.
+ *
+ * a buffer is coded in the canonical format of hencode -c and a stream
+ * in the block format of hencode -j, so either can be decoded with
+ * hdecode too. every call returns 1, or 0 with errno set if it fails.
+ * EINVAL means what was being decoded isn't in the format (or is cut
+ * short) and ENOSPC that the output doesn't fit.
+ *
+ * an encoder or decoder is only ever used by one thread at a time
+ */
+
+typedef struct HuffmanEncoder HuffmanEncoder;
+typedef struct HuffmanDecoder HuffmanDecoder;
+
+/*
+ * where a stream's output goes, len bytes at a time. it returns 1 once
+ * they've been taken care of or 0, with errno set, to stop the stream
+ */
+typedef int (*HuffmanWriter)(void *ctx, const unsigned char *bytes,
+                             size_t len);
+
+/*
+ * makes codes no longer than maxcodelen, from 8 to 64, or of any
+ * length if it's 0, like hencode -l
+ */
+HuffmanEncoder *constructHuffmanEncoder(int maxcodelen);
+
+void freeHuffmanEncoder(HuffmanEncoder *enc);
+
+/* the most bytes encoding a buffer of len bytes can take */
+size_t huffmanEncodeBound(size_t len);
+
+/*
+ * encodes the len bytes of msg (less than 4GiB) to out, which has
+ * outcap bytes of room, setting *outlen to what it took. with
+ * huffmanEncodeBound(len) of room it always fits
+ */
+int huffmanEncodeBuffer(HuffmanEncoder *enc, const void *msg, size_t len,
+                        void *out, size_t outcap, size_t *outlen);
+
+/*
+ * encodes whatever is written to the stream until it is finished,
+ * handing it to writer a block at a time. the encoder can't encode
+ * anything else in between
+ */
+int startHuffmanEncodeStream(HuffmanEncoder *enc, HuffmanWriter writer,
+                             void *ctx);
+int writeHuffmanEncodeStream(HuffmanEncoder *enc, const void *bytes,
+                             size_t len);
+int finishHuffmanEncodeStream(HuffmanEncoder *enc);
+
+HuffmanDecoder *constructHuffmanDecoder(void);
+
+void freeHuffmanDecoder(HuffmanDecoder *dec);
+
+/*
+ * decodes the len bytes at in, which are in the canonical or the block
+ * format, to out, which has outcap bytes of room, setting *outlen to
+ * what it took
+ */
+int huffmanDecodeBuffer(HuffmanDecoder *dec, const void *in, size_t len,
+                        void *out, size_t outcap, size_t *outlen);
+
+/*
+ * decodes the block format written to the stream, in pieces of any
+ * size, handing writer each block as it is decoded. finishing fails if
+ * the stream stopped short of the end
+ */
+int startHuffmanDecodeStream(HuffmanDecoder *dec, HuffmanWriter writer,
+                             void *ctx);
+int writeHuffmanDecodeStream(HuffmanDecoder *dec, const void *bytes,
+                             size_t len);
+int finishHuffmanDecodeStream(HuffmanDecoder *dec);
+
+#endif /* LIBHUFFMAN_H */
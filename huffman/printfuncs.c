@@ -63,23 +63,37 @@ void printTable(int *table, int tablelen) {
     printf("%d ]\n", table[i]);
 }
 
+/* prints a code as the 0s and 1s of the path to its char */
+static void printCode(HuffmanCode *code) {
+    int i;
+    for (i = code->len - 1; i >= 0; i--) {
+        putchar((code->bits >> i) & 1 ? '1' : '0');
+    }
+}
+
 /* helper function for debugging */
-void printEncodingsTable(char **table, unsigned int *indextable) {
+void printEncodingsTable(HuffmanCode *codes) {
     int i;
     printf("[ ");
     for (i = 0; i < 256; i++) {
-        if (indextable[i] != -1)
-            printf("(%s %s), ", printCh((char)i), table[indextable[i]]);
+        if (codes[i].len != 0) {
+            printf("(%s ", printCh((char)i));
+            printCode(&codes[i]);
+            printf("), ");
+        }
     }
     printf("nul ]\n");
 }
 
 /* helper function for debugging */
-void printEncodingsTableHex(char **table, unsigned int *indextable) {
+void printEncodingsTableHex(HuffmanCode *codes) {
     int i;
     for (i = 0; i < CHARFREQTABLESIZE; i++) {
-        if (indextable[i] != -1)
-            printf("%s: %s\n", printChHex((char)i), table[indextable[i]]);
+        if (codes[i].len != 0) {
+            printf("%s: ", printChHex((char)i));
+            printCode(&codes[i]);
+            printf("\n");
+        }
     }
 }
 
@@ -5,8 +5,8 @@
 void printHuffmanTree(HuffmanNode *hnode);
 void printHuffmanNode(HuffmanNode *hnode, int depth);
 void printHuffmanNodeTable(HuffmanNode **table);
-void printEncodingsTableHex(char **table, unsigned int *indextable);
-void printEncodingsTable(char **table, unsigned int *indextable);
+void printEncodingsTableHex(HuffmanCode *codes);
+void printEncodingsTable(HuffmanCode *codes);
 void printTable(unsigned int *table, int tablelen);
 char *printCh(char ch);
 char *printChHex(char ch);